@@ -0,0 +1,169 @@
+#include "acpi.h"
+#include "paging.h"
+#include "klog.h"
+
+#define ACPI_EBDA_PTR       0x40E       // Real-mode segment of the EBDA
+#define ACPI_BIOS_START     0xE0000
+#define ACPI_BIOS_END       0x100000
+
+struct acpi_info acpi_info;
+
+static int __init acpi_checksum(const void* data, uint32_t length) {
+    const uint8_t* bytes = data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+static int __init acpi_signature(const char* have, const char* want, int length) {
+    for (int i = 0; i < length; i++) {
+        if (have[i] != want[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The RSDP sits on a 16-byte boundary in the first KiB of the EBDA or in the
+// BIOS area below 1 MiB, both inside the direct map
+static const struct acpi_rsdp* __init acpi_find_rsdp(void) {
+    uintptr_t ebda = (uintptr_t)*(const uint16_t*)phys_to_virt(ACPI_EBDA_PTR) << 4;
+    uintptr_t ranges[2][2] = {
+        { ebda, ebda + 1024 },
+        { ACPI_BIOS_START, ACPI_BIOS_END },
+    };
+
+    for (int r = 0; r < 2; r++) {
+        if (!ranges[r][0]) {
+            continue;
+        }
+        for (uintptr_t addr = ranges[r][0]; addr < ranges[r][1]; addr += 16) {
+            const struct acpi_rsdp* rsdp = phys_to_virt(addr);
+            if (acpi_signature(rsdp->signature, "RSD PTR ", 8) &&
+                acpi_checksum(rsdp, sizeof(*rsdp))) {
+                return rsdp;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Tables usually live in RAM below the end of the direct map; anything
+// above it gets its own mapping
+static const void* __init acpi_map(uint32_t phys, uint32_t length) {
+    if ((uint64_t)phys + length <= paging_direct_map_size()) {
+        return phys_to_virt(phys);
+    }
+    return ioremap(phys, length);
+}
+
+static const struct acpi_sdt_header* __init acpi_map_table(uint32_t phys) {
+    const struct acpi_sdt_header* header = acpi_map(phys, sizeof(*header));
+    if (!header) {
+        return NULL;
+    }
+    header = acpi_map(phys, header->length);
+    if (!header || !acpi_checksum(header, header->length)) {
+        return NULL;
+    }
+    return header;
+}
+
+static void __init acpi_parse_madt(const struct acpi_madt* madt) {
+    acpi_info.lapic_phys = madt->lapic_addr;
+    acpi_info.madt_flags = madt->flags;
+    for (int irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+        acpi_info.isa_gsi[irq] = irq;
+    }
+
+    const uint8_t* entry = madt->entries;
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+    while (entry + sizeof(struct acpi_madt_entry) <= end) {
+        const struct acpi_madt_entry* e = (const struct acpi_madt_entry*)entry;
+        if (e->length < sizeof(*e)) {
+            break;
+        }
+
+        switch (e->type) {
+            case ACPI_MADT_LAPIC: {
+                const struct acpi_madt_lapic* lapic = (const void*)e;
+                if ((lapic->flags & ACPI_MADT_LAPIC_ENABLED) &&
+                    acpi_info.cpu_count < ACPI_MAX_CPUS) {
+                    acpi_info.cpu_apic_ids[acpi_info.cpu_count++] = lapic->apic_id;
+                }
+                break;
+            }
+
+            case ACPI_MADT_IOAPIC: {
+                const struct acpi_madt_ioapic* ioapic = (const void*)e;
+                if (!acpi_info.ioapic_phys) {
+                    acpi_info.ioapic_phys = ioapic->addr;
+                    acpi_info.ioapic_id = ioapic->ioapic_id;
+                    acpi_info.ioapic_gsi_base = ioapic->gsi_base;
+                } else {
+                    KWARN("ACPI", "Ignoring extra I/O APIC %d", ioapic->ioapic_id);
+                }
+                break;
+            }
+
+            case ACPI_MADT_OVERRIDE: {
+                const struct acpi_madt_override* ovr = (const void*)e;
+                if (ovr->bus == 0 && ovr->source < ACPI_ISA_IRQS) {
+                    acpi_info.isa_gsi[ovr->source] = ovr->gsi;
+                    acpi_info.isa_flags[ovr->source] = ovr->flags;
+                    KDEBUG_INIT("ACPI", "IRQ %d -> GSI %u, flags 0x%x",
+                                ovr->source, ovr->gsi, ovr->flags);
+                }
+                break;
+            }
+
+            case ACPI_MADT_LAPIC_ADDR: {
+                const struct acpi_madt_lapic_addr* addr = (const void*)e;
+                acpi_info.lapic_phys = (uint32_t)addr->addr;
+                break;
+            }
+        }
+        entry += e->length;
+    }
+}
+
+int __init acpi_init(void) {
+    const struct acpi_rsdp* rsdp = acpi_find_rsdp();
+    if (!rsdp) {
+        KWARN("ACPI", "No RSDP found");
+        return -1;
+    }
+
+    const struct acpi_sdt_header* rsdt = acpi_map_table(rsdp->rsdt_addr);
+    if (!rsdt || !acpi_signature(rsdt->signature, "RSDT", 4)) {
+        KWARN("ACPI", "RSDT at 0x%x is invalid", rsdp->rsdt_addr);
+        return -1;
+    }
+    KINFO_INIT("ACPI", "RSDP rev %d, RSDT at 0x%x", rsdp->revision, rsdp->rsdt_addr);
+
+    const uint32_t* tables = (const uint32_t*)(rsdt + 1);
+    uint32_t count = (rsdt->length - sizeof(*rsdt)) / sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; i++) {
+        const struct acpi_sdt_header* table = acpi_map(tables[i], sizeof(*table));
+        if (!table || !acpi_signature(table->signature, "APIC", 4)) {
+            continue;
+        }
+
+        table = acpi_map_table(tables[i]);
+        if (!table) {
+            KWARN("ACPI", "MADT checksum mismatch");
+            return -1;
+        }
+
+        acpi_parse_madt((const struct acpi_madt*)table);
+        KINFO_INIT("ACPI", "MADT: %u CPUs, local APIC 0x%x, I/O APIC 0x%x (GSI base %u)",
+                   acpi_info.cpu_count, acpi_info.lapic_phys, acpi_info.ioapic_phys,
+                   acpi_info.ioapic_gsi_base);
+        return 0;
+    }
+
+    KWARN("ACPI", "No MADT");
+    return -1;
+}
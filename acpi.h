@@ -0,0 +1,107 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+
+// Root System Description Pointer (ACPI 1.0 part)
+struct acpi_rsdp {
+    char signature[8];          // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_addr;
+} __attribute__((packed));
+
+struct acpi_sdt_header {
+    char signature[4];
+    uint32_t length;            // Including this header
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+// Multiple APIC Description Table ("APIC")
+struct acpi_madt {
+    struct acpi_sdt_header header;
+    uint32_t lapic_addr;
+    uint32_t flags;
+    uint8_t entries[];
+} __attribute__((packed));
+
+#define ACPI_MADT_PCAT_COMPAT   0x01    // 8259 pair present
+
+// MADT entry types
+#define ACPI_MADT_LAPIC         0
+#define ACPI_MADT_IOAPIC        1
+#define ACPI_MADT_OVERRIDE      2
+#define ACPI_MADT_LAPIC_ADDR    5
+
+#define ACPI_MADT_LAPIC_ENABLED 0x01
+
+struct acpi_madt_entry {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+
+struct acpi_madt_lapic {
+    struct acpi_madt_entry header;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed));
+
+struct acpi_madt_ioapic {
+    struct acpi_madt_entry header;
+    uint8_t ioapic_id;
+    uint8_t reserved;
+    uint32_t addr;
+    uint32_t gsi_base;
+} __attribute__((packed));
+
+struct acpi_madt_override {
+    struct acpi_madt_entry header;
+    uint8_t bus;
+    uint8_t source;             // ISA IRQ
+    uint32_t gsi;
+    uint16_t flags;             // MPS INTI flags
+} __attribute__((packed));
+
+struct acpi_madt_lapic_addr {
+    struct acpi_madt_entry header;
+    uint16_t reserved;
+    uint64_t addr;
+} __attribute__((packed));
+
+// MPS INTI flags in interrupt source overrides
+#define ACPI_POLARITY_MASK      0x03
+#define ACPI_POLARITY_LOW       0x03
+#define ACPI_TRIGGER_MASK       0x0C
+#define ACPI_TRIGGER_LEVEL      0x0C
+
+#define ACPI_MAX_CPUS           16
+#define ACPI_ISA_IRQS           16
+
+// What the kernel needs from the MADT
+struct acpi_info {
+    uint32_t lapic_phys;
+    uint32_t cpu_count;
+    uint8_t cpu_apic_ids[ACPI_MAX_CPUS];
+    uint32_t ioapic_phys;       // First I/O APIC only
+    uint8_t ioapic_id;
+    uint32_t ioapic_gsi_base;
+    uint32_t isa_gsi[ACPI_ISA_IRQS];        // GSI each ISA IRQ is wired to
+    uint16_t isa_flags[ACPI_ISA_IRQS];      // Polarity/trigger overrides
+    uint32_t madt_flags;
+};
+
+extern struct acpi_info acpi_info;
+
+// Locate the RSDP and parse the MADT. Returns 0 on success, -1 if there is
+// no usable MADT. Needs paging_init() and pmm_init().
+int acpi_init(void);
+
+#endif // ACPI_H
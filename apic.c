@@ -0,0 +1,257 @@
+#include "apic.h"
+#include "acpi.h"
+#include "irqchip.h"
+#include "irq.h"
+#include "pic.h"
+#include "paging.h"
+#include "pmm.h"
+#include "timer.h"
+#include "cpu.h"
+#include "klog.h"
+
+// LAPIC timer calibration window
+#define LAPIC_CALIBRATE_US      10000
+
+volatile uint8_t* lapic_mmio;
+static volatile uint8_t* ioapic_mmio;
+static uint32_t ioapic_pins;
+
+// Low words of the ISA redirection entries, so masking is one write
+static uint32_t ioapic_redir[ACPI_ISA_IRQS];
+
+// ns to timer counts as (ns * lapic_timer_mult) >> 32
+static uint32_t lapic_timer_mult;
+
+static void lapic_timer_set_next_event(uint64_t delta_ns);
+static void lapic_timer_shutdown(void);
+
+static struct clock_event_device lapic_clockevent = {
+    .name = "lapic",
+    .rating = 200,
+    .min_delta_ns = NSEC_PER_USEC,
+    .set_next_event = lapic_timer_set_next_event,
+    .shutdown = lapic_timer_shutdown,
+};
+
+static uint32_t ioapic_read(uint32_t reg) {
+    *(volatile uint32_t*)(ioapic_mmio + IOAPIC_REGSEL) = reg;
+    return *(volatile uint32_t*)(ioapic_mmio + IOAPIC_WINDOW);
+}
+
+static void ioapic_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(ioapic_mmio + IOAPIC_REGSEL) = reg;
+    *(volatile uint32_t*)(ioapic_mmio + IOAPIC_WINDOW) = value;
+}
+
+static inline uint32_t ioapic_pin(uint8_t irq) {
+    return acpi_info.isa_gsi[irq] - acpi_info.ioapic_gsi_base;
+}
+
+// Entries ioapic_setup() could not route stay zero and are left alone
+static void apic_mask(uint8_t irq) {
+    if (irq >= ACPI_ISA_IRQS || !ioapic_redir[irq]) {
+        return;
+    }
+    ioapic_redir[irq] |= IOAPIC_REDIR_MASKED;
+    ioapic_write(IOAPIC_REG_REDIR + ioapic_pin(irq) * 2, ioapic_redir[irq]);
+}
+
+static void apic_unmask(uint8_t irq) {
+    if (irq >= ACPI_ISA_IRQS || !ioapic_redir[irq]) {
+        return;
+    }
+    ioapic_redir[irq] &= ~IOAPIC_REDIR_MASKED;
+    ioapic_write(IOAPIC_REG_REDIR + ioapic_pin(irq) * 2, ioapic_redir[irq]);
+}
+
+// One MMIO write, whatever the source
+static void apic_eoi(uint8_t irq) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static const struct irqchip apic_chip = {
+    .name = "APIC",
+    .mask = apic_mask,
+    .unmask = apic_unmask,
+    .eoi = apic_eoi,
+};
+
+static void lapic_timer_set_next_event(uint64_t delta_ns) {
+    uint32_t count = (((uint64_t)(uint32_t)delta_ns * lapic_timer_mult) >> 32) + 1;
+    lapic_write(LAPIC_TIMER_INIT, count);
+}
+
+static void lapic_timer_shutdown(void) {
+    lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+static void lapic_timer_irq(struct interrupt_frame* frame, void* ctx) {
+    if (lapic_clockevent.event_handler) {
+        lapic_clockevent.event_handler();
+    }
+}
+
+// Enable the calling CPU's local APIC and leave only NMIs on the LINT pins
+static void __init lapic_setup(void) {
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+
+    // Clear any errors latched before the APIC was enabled
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void __init apic_init_ap(void) {
+    uint64_t base = rdmsr(MSR_APIC_BASE);
+    wrmsr(MSR_APIC_BASE, base | MSR_APIC_BASE_ENABLE);
+
+    lapic_setup();
+
+    // The timer is calibrated once, on the boot CPU; the bus clock is shared
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    if (!lapic_timer_mult) {
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | APIC_TIMER_VECTOR);
+        return;
+    }
+    lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR);
+    timer_register_clockevent(&lapic_clockevent);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr) {
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        cpu_relax();
+    }
+}
+
+// Count timer ticks over a TSC-timed window, then derive the ns scaling the
+// same way the PIT does
+static void __init lapic_timer_init(void) {
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | APIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    udelay(LAPIC_CALIBRATE_US);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    uint32_t khz = elapsed / (LAPIC_CALIBRATE_US / 1000);
+    if (!khz) {
+        KWARN("APIC", "LAPIC timer did not count, keeping the PIT");
+        return;
+    }
+
+    lapic_timer_mult = ((uint64_t)khz << 32) / NSEC_PER_MSEC;
+
+    // Stay below both the 32-bit counter and the 32-bit ns argument
+    uint64_t max_ns = 0xFFFFFFFFULL * NSEC_PER_MSEC / khz;
+    lapic_clockevent.max_delta_ns = max_ns < 4 * NSEC_PER_SEC ? max_ns : 4 * NSEC_PER_SEC;
+
+    // One-shot mode, unmasked
+    lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR);
+
+    KINFO_INIT("APIC", "LAPIC timer at %u kHz (bus clock / 16)", khz);
+    timer_register_clockevent(&lapic_clockevent);
+}
+
+// Does an interrupt source override move some other ISA IRQ onto irq's pin?
+// Boards commonly wire IRQ 0 to GSI 2, which IRQ 2 would default to.
+static int __init ioapic_pin_overridden(int irq) {
+    for (int other = 0; other < ACPI_ISA_IRQS; other++) {
+        if (other != irq && acpi_info.isa_gsi[other] != (uint32_t)other &&
+            acpi_info.isa_gsi[other] == acpi_info.isa_gsi[irq]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Route every ISA IRQ to the boot CPU on vector 32 + irq, masked. The PIC
+// cascade and IRQs whose pin an override took are left unrouted.
+static void __init ioapic_setup(void) {
+    uint32_t version = ioapic_read(IOAPIC_REG_VERSION);
+    ioapic_pins = ((version >> 16) & 0xFF) + 1;
+    uint32_t dest = lapic_id() << 24;
+
+    for (int irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+        if (irq == IRQ_CASCADE - IRQ_BASE ||
+            (acpi_info.isa_gsi[irq] == (uint32_t)irq && ioapic_pin_overridden(irq))) {
+            continue;
+        }
+
+        uint32_t pin = ioapic_pin(irq);
+        if (pin >= ioapic_pins) {
+            KWARN("APIC", "IRQ %d maps to missing I/O APIC pin %u", irq, pin);
+            continue;
+        }
+
+        uint32_t low = (32 + irq) | IOAPIC_REDIR_MASKED;
+        uint16_t flags = acpi_info.isa_flags[irq];
+        if ((flags & ACPI_POLARITY_MASK) == ACPI_POLARITY_LOW) {
+            low |= IOAPIC_REDIR_LOW_ACTIVE;
+        }
+        if ((flags & ACPI_TRIGGER_MASK) == ACPI_TRIGGER_LEVEL) {
+            low |= IOAPIC_REDIR_LEVEL;
+        }
+
+        ioapic_redir[irq] = low;
+        ioapic_write(IOAPIC_REG_REDIR + pin * 2 + 1, dest);
+        ioapic_write(IOAPIC_REG_REDIR + pin * 2, low);
+    }
+
+    KINFO_INIT("APIC", "I/O APIC %d: %u pins, version 0x%x",
+               acpi_info.ioapic_id, ioapic_pins, version & 0xFF);
+}
+
+int __init apic_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_APIC) || !(edx & CPUID_EDX_MSR)) {
+        KINFO_INIT("APIC", "No local APIC, staying on the 8259 PIC");
+        return -1;
+    }
+    if (acpi_init() < 0 || !acpi_info.ioapic_phys) {
+        KWARN("APIC", "No I/O APIC described, staying on the 8259 PIC");
+        return -1;
+    }
+
+    uint64_t base = rdmsr(MSR_APIC_BASE);
+    wrmsr(MSR_APIC_BASE, base | MSR_APIC_BASE_ENABLE);
+
+    lapic_mmio = ioremap(acpi_info.lapic_phys, PAGE_SIZE);
+    ioapic_mmio = ioremap(acpi_info.ioapic_phys, PAGE_SIZE);
+    if (!lapic_mmio || !ioapic_mmio) {
+        KERROR("APIC", "Cannot map APIC registers");
+        return -1;
+    }
+
+    lapic_setup();
+    KINFO_INIT("APIC", "Local APIC %u, version 0x%x", lapic_id(),
+               lapic_read(LAPIC_VERSION) & 0xFF);
+
+    ioapic_setup();
+    request_irq(APIC_TIMER_VECTOR, lapic_timer_irq, NULL);
+
+    // Hand over: lines enabled on the 8259 stay enabled on the I/O APIC
+    uint32_t flags = irq_save();
+    uint16_t pic_masks = pic_get_mask();
+    pic_disable();
+    irq_chip = &apic_chip;
+    for (int irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+        if (irq != 2 && !(pic_masks & (1 << irq))) {
+            apic_unmask(irq);
+        }
+    }
+    irq_restore(flags);
+
+    lapic_timer_init();
+    return 0;
+}
+
+int apic_enabled(void) {
+    return irq_chip == &apic_chip;
+}
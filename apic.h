@@ -0,0 +1,82 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+#include "clock.h"
+
+// Vectors owned by the local APIC (ISA IRQs keep 32-47)
+#define APIC_TIMER_VECTOR       0xEF
+#define APIC_RESCHED_VECTOR     0xF0        // IPI: look for runnable threads
+#define APIC_TLB_VECTOR         0xF1        // IPI: flush a TLB range (smp.c)
+#define APIC_SPURIOUS_VECTOR    0xFF
+
+// Local APIC registers (offsets into its 4 KiB MMIO page)
+#define LAPIC_ID                0x020
+#define LAPIC_VERSION           0x030
+#define LAPIC_TPR               0x080       // Task priority
+#define LAPIC_EOI               0x0B0
+#define LAPIC_SVR               0x0F0       // Spurious interrupt vector
+#define LAPIC_ESR               0x280       // Error status
+#define LAPIC_ICR_LOW           0x300
+#define LAPIC_ICR_HIGH          0x310
+#define LAPIC_LVT_TIMER         0x320
+#define LAPIC_LVT_LINT0         0x350
+#define LAPIC_LVT_LINT1         0x360
+#define LAPIC_LVT_ERROR         0x370
+#define LAPIC_TIMER_INIT        0x380
+#define LAPIC_TIMER_CURRENT     0x390
+#define LAPIC_TIMER_DIV         0x3E0
+
+#define LAPIC_SVR_ENABLE        0x100
+#define LAPIC_LVT_MASKED        0x10000
+#define LAPIC_LVT_NMI           0x400
+#define LAPIC_TIMER_DIV_16      0x3
+
+// ICR low word
+#define LAPIC_ICR_INIT          0x500       // Delivery mode INIT
+#define LAPIC_ICR_STARTUP       0x600       // Delivery mode start-up, vector = page
+#define LAPIC_ICR_PENDING       0x1000      // Delivery status: send pending
+#define LAPIC_ICR_ASSERT        0x4000      // Level assert
+
+// I/O APIC registers, reached through IOREGSEL/IOWIN
+#define IOAPIC_REGSEL           0x00
+#define IOAPIC_WINDOW           0x10
+#define IOAPIC_REG_VERSION      0x01
+#define IOAPIC_REG_REDIR        0x10        // Two registers per pin
+
+#define IOAPIC_REDIR_LOW_ACTIVE 0x2000      // Active low polarity
+#define IOAPIC_REDIR_LEVEL      0x8000      // Level triggered
+#define IOAPIC_REDIR_MASKED     0x10000
+
+extern volatile uint8_t* lapic_mmio;
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return *(volatile uint32_t*)(lapic_mmio + reg);
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(lapic_mmio + reg) = value;
+}
+
+static inline uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+// Switch interrupt delivery from the 8259 pair to the local and I/O APIC
+// and make the LAPIC timer the clock event device. Returns -1, leaving the
+// 8259 in charge, if either APIC is missing. Needs pmm_init() and
+// timer_init().
+int apic_init(void);
+
+// Enable the calling application processor's local APIC and make its timer
+// that CPU's clock event device
+void apic_init_ap(void);
+
+// Send an inter-processor interrupt (ICR low word icr) to one local APIC
+// and wait until it has been accepted
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr);
+
+// Non-zero once apic_init() has succeeded
+int apic_enabled(void);
+
+#endif // APIC_H
@@ -0,0 +1,131 @@
+#include "async.h"
+#include "sched.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "cpu.h"
+#include "klog.h"
+
+// One FIFO of ready tasks, shared by every CPU's idle loop
+static struct task* async_head;
+static struct task* async_tail;
+static spinlock_t async_lock = SPINLOCK_INIT;
+
+static struct async_stats async_stats;
+
+// Called with async_lock held
+static void async_enqueue(struct task* t) {
+    t->next = NULL;
+    if (async_tail) {
+        async_tail->next = t;
+    } else {
+        async_head = t;
+    }
+    async_tail = t;
+    t->flags |= TASK_QUEUED;
+}
+
+void task_init(struct task* t, task_poll_t poll, void* data) {
+    t->next = NULL;
+    t->poll = poll;
+    t->data = data;
+    t->resume = 0;
+    t->flags = 0;
+}
+
+void task_spawn(struct task* t) {
+    uint32_t flags = spin_lock_irqsave(&async_lock);
+    async_stats.spawned++;
+    spin_unlock_irqrestore(&async_lock, flags);
+    task_wake(t);
+}
+
+void task_wake(struct task* t) {
+    uint32_t flags = spin_lock_irqsave(&async_lock);
+
+    if (t->flags & TASK_DONE) {
+        spin_unlock_irqrestore(&async_lock, flags);
+        return;
+    }
+    async_stats.wakeups++;
+    if (t->flags & TASK_RUNNING) {
+        t->flags |= TASK_NOTIFIED;
+    } else if (!(t->flags & TASK_QUEUED)) {
+        async_enqueue(t);
+    }
+
+    // An idle CPU woken by this interrupt must not go back to sleep before
+    // polling; anywhere else, get an idle CPU to come and look
+    if (sched_in_idle()) {
+        this_cpu()->need_resched = 1;
+    } else {
+        sched_kick_idle();
+    }
+    spin_unlock_irqrestore(&async_lock, flags);
+}
+
+void waker_wake(struct waker* w) {
+    struct task* t = __atomic_exchange_n(&w->task, NULL, __ATOMIC_ACQ_REL);
+    if (t) {
+        task_wake(t);
+    }
+}
+
+static void async_timer_expired(void* data) {
+    task_wake(data);
+}
+
+void async_timer_start(struct timer* timer, struct task* t, uint64_t ns) {
+    timer_setup(timer, async_timer_expired, t);
+    timer_add(timer, ns);
+}
+
+int async_run(void) {
+    int polled = 0;
+
+    while (polled < ASYNC_BUDGET) {
+        uint32_t flags = spin_lock_irqsave(&async_lock);
+        struct task* t = async_head;
+        if (!t) {
+            spin_unlock_irqrestore(&async_lock, flags);
+            break;
+        }
+        async_head = t->next;
+        if (!async_head) {
+            async_tail = NULL;
+        }
+        t->flags = (t->flags & ~TASK_QUEUED) | TASK_RUNNING;
+        async_stats.polls++;
+        spin_unlock_irqrestore(&async_lock, flags);
+
+        // Poll with interrupts as the caller had them; wakeups that arrive
+        // meanwhile are parked in TASK_NOTIFIED
+        int result = t->poll(t);
+        polled++;
+
+        flags = spin_lock_irqsave(&async_lock);
+        t->flags &= ~TASK_RUNNING;
+        if (result == ASYNC_DONE) {
+            t->flags = TASK_DONE;
+            async_stats.completed++;
+        } else if (t->flags & TASK_NOTIFIED) {
+            t->flags &= ~TASK_NOTIFIED;
+            async_enqueue(t);
+        }
+        spin_unlock_irqrestore(&async_lock, flags);
+    }
+    return polled;
+}
+
+void async_get_stats(struct async_stats* stats) {
+    uint32_t flags = spin_lock_irqsave(&async_lock);
+    *stats = async_stats;
+    spin_unlock_irqrestore(&async_lock, flags);
+}
+
+void async_dump_stats(void) {
+    struct async_stats stats;
+    async_get_stats(&stats);
+
+    KINFO("ASYNC", "%u tasks spawned, %u completed, %u polls, %u wakeups",
+          stats.spawned, stats.completed, stats.polls, stats.wakeups);
+}
@@ -0,0 +1,117 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <stdint.h>
+#include "timer.h"
+
+// Stackless tasks. A task is a poll function plus a few bytes of state; it
+// runs until it has to wait, records where it stopped and returns
+// ASYNC_PENDING. Whatever it waits for wakes it through a waker, and the
+// executor polls it again from the top, where ASYNC_BEGIN jumps back to the
+// recorded point. Locals do not survive a wait; keep them in the task's
+// own structure.
+//
+//     static int blink_poll(struct task* t) {
+//         struct blink* b = t->data;
+//         ASYNC_BEGIN(t);
+//         for (;;) {
+//             async_timer_start(&b->timer, t, 500 * NSEC_PER_MSEC);
+//             ASYNC_AWAIT(t, !timer_pending(&b->timer));
+//             toggle();
+//         }
+//         ASYNC_END(t);
+//     }
+
+#define ASYNC_PENDING   0
+#define ASYNC_DONE      1
+
+// Run the executor at most this many polls per async_run() call, so the
+// idle loop still gets round to draining logs and picking up threads
+#define ASYNC_BUDGET    32
+
+struct task;
+typedef int (*task_poll_t)(struct task* t);
+
+struct task {
+    struct task* next;          // Ready queue link
+    task_poll_t poll;
+    void* data;
+    uint16_t resume;            // Where ASYNC_BEGIN continues; 0 is the start
+    volatile uint8_t flags;     // TASK_* below
+};
+
+#define TASK_QUEUED     0x01    // On the ready queue
+#define TASK_RUNNING    0x02    // Being polled
+#define TASK_NOTIFIED   0x04    // Woken while running; poll again
+#define TASK_DONE       0x08
+
+// Something a task waits on. The event source keeps one per waiting task.
+struct waker {
+    struct task* task;
+};
+
+#define ASYNC_BEGIN(t)          switch ((t)->resume) { case 0:
+
+// Give other tasks a turn, continuing here on the next poll
+#define ASYNC_YIELD(t)                                                      \
+    do {                                                                    \
+        (t)->resume = __LINE__;                                             \
+        task_wake(t);                                                       \
+        return ASYNC_PENDING;                                               \
+        case __LINE__:;                                                     \
+    } while (0)
+
+// Wait until cond holds. The task has to be registered with a waker for
+// cond before this, so a wakeup between the check and the return is not
+// lost.
+#define ASYNC_AWAIT(t, cond)                                                \
+    do {                                                                    \
+        (t)->resume = __LINE__;                                             \
+        __attribute__((fallthrough));                                       \
+        case __LINE__:                                                      \
+        if (!(cond)) {                                                      \
+            return ASYNC_PENDING;                                           \
+        }                                                                   \
+    } while (0)
+
+#define ASYNC_END(t)            } (t)->resume = 0; return ASYNC_DONE
+
+// Prepare a task; it does not run until task_spawn()
+void task_init(struct task* t, task_poll_t poll, void* data);
+
+// Queue a task for its first poll
+void task_spawn(struct task* t);
+
+// Queue t to be polled again. Safe from interrupt handlers and any CPU.
+void task_wake(struct task* t);
+
+static inline int task_done(const struct task* t) {
+    return t->flags & TASK_DONE;
+}
+
+static inline void waker_register(struct waker* w, struct task* t) {
+    __atomic_store_n(&w->task, t, __ATOMIC_RELEASE);
+}
+
+// Wake the registered task, if any, and forget it
+void waker_wake(struct waker* w);
+
+// Wake t once ns have passed. The timer is the task's to check with
+// timer_pending().
+void async_timer_start(struct timer* timer, struct task* t, uint64_t ns);
+
+// Poll ready tasks, up to ASYNC_BUDGET of them. Returns the number polled.
+// Runs from every CPU's idle loop.
+int async_run(void);
+
+struct async_stats {
+    uint32_t spawned;
+    uint32_t polls;
+    uint32_t wakeups;
+    uint32_t completed;
+};
+
+void async_get_stats(struct async_stats* stats);
+void async_dump_stats(void);
+
+#endif // ASYNC_H
@@ -6,6 +6,14 @@
 .set MAGIC,    0x1BADB002       # 'magic number' lets bootloader find the header
 .set CHECKSUM, -(MAGIC + FLAGS) # checksum of above, to prove we are multiboot
 
+# Paging constants (keep in sync with paging.h)
+.set KERNEL_VMA,      0xC0000000        # where the kernel is linked
+.set KERNEL_PDE,      KERNEL_VMA >> 22  # its first page directory entry
+.set BOOT_MAP_PAGES,  4                 # 4 x 4 MiB = first 16 MiB mapped
+.set PDE_BOOT_FLAGS,  0x83              # present | writable | 4 MiB page
+.set CR4_PSE,         0x10
+.set CR0_PG,          0x80000000
+
 # Declare a multiboot header that marks the program as a kernel
 .section .multiboot
 .align 4
@@ -18,23 +26,73 @@
 .align 16
 stack_bottom:
 .skip 16384 # 16 KiB
+.global stack_top
 stack_top:
 
-# The kernel entry point
-.section .text
+# Page directory used until paging_init() builds the real one
+.align 4096
+.global boot_page_directory
+boot_page_directory:
+.skip 4096
+
+# The kernel entry point. The bootloader jumps here with paging off, so this
+# code is linked at its physical address and must not touch EAX/EBX, which
+# carry the Multiboot magic and info pointer.
+.section .boot.text, "ax"
 .global _start
 .type _start, @function
 _start:
+	# Note the time for the boot time breakdown (boottime.c), keeping the
+	# magic in EAX
+	mov %eax, %esi
+	rdtsc
+	mov %eax, (boot_tsc - KERNEL_VMA)
+	mov %edx, (boot_tsc - KERNEL_VMA + 4)
+	mov %esi, %eax
+
+	# Map the first 16 MiB twice with 4 MiB pages: at 0 so the next few
+	# instructions keep running, and at KERNEL_VMA where the kernel is linked
+	mov $(boot_page_directory - KERNEL_VMA), %edi
+	mov $PDE_BOOT_FLAGS, %edx
+	xor %ecx, %ecx
+1:	mov %edx, (%edi, %ecx, 4)
+	mov %edx, (KERNEL_PDE * 4)(%edi, %ecx, 4)
+	add $0x400000, %edx
+	inc %ecx
+	cmp $BOOT_MAP_PAGES, %ecx
+	jne 1b
+
+	# Enable 4 MiB pages, load the directory and turn paging on
+	mov %cr4, %ecx
+	or $CR4_PSE, %ecx
+	mov %ecx, %cr4
+	mov %edi, %cr3
+	mov %cr0, %ecx
+	or $CR0_PG, %ecx
+	mov %ecx, %cr0
+
+	# Jump to the higher half
+	lea higher_half_start, %ecx
+	jmp *%ecx
+
+# Set the size of the _start symbol to the current location '.' minus its start
+.size _start, . - _start
+
+.section .text
+higher_half_start:
 	# Setting up the stack
 	mov $stack_top, %esp
 
-	# Entering the high-level kernel
+	# Entering the high-level kernel: kernel_main(magic, multiboot_info_phys)
+	push %ebx
+	push %eax
 	call kernel_main
+	add $8, %esp
+
+	# Drain logs and wait for interrupts; does not return
+	call cpu_idle
 
 	# If the system has nothing more to do, put the computer into an infinite loop
 	cli
 1:	hlt
 	jmp 1b
-
-# Set the size of the _start symbol to the current location '.' minus its start
-.size _start, . - _start
@@ -0,0 +1,44 @@
+#include "boottime.h"
+#include "clock.h"
+#include "cpu.h"
+#include "klog.h"
+
+struct boottime_entry {
+    const char* name;
+    uint64_t cycles;
+};
+
+// Written by boot.s through its physical address, before paging is on
+uint64_t boot_tsc;
+
+// Only the boot CPU records stages
+static struct boottime_entry boottime_stages[BOOTTIME_MAX_STAGES];
+static uint32_t boottime_count;
+
+void boottime_stage(const char* name, uint64_t start) {
+    uint64_t now = rdtsc();
+
+    if (boottime_count < BOOTTIME_MAX_STAGES) {
+        boottime_stages[boottime_count].name = name;
+        boottime_stages[boottime_count].cycles = now - start;
+        boottime_count++;
+    }
+}
+
+static uint32_t boottime_us(uint64_t cycles) {
+    return clock_cycles_to_ns(cycles) / NSEC_PER_USEC;
+}
+
+void boottime_report(void) {
+    uint64_t total = rdtsc() - boot_tsc;
+    uint64_t staged = 0;
+
+    for (uint32_t i = 0; i < boottime_count; i++) {
+        KINFO("BOOT", "Boot stage %s: %u us", boottime_stages[i].name,
+              boottime_us(boottime_stages[i].cycles));
+        staged += boottime_stages[i].cycles;
+    }
+    // Code between the stages, and any stages past BOOTTIME_MAX_STAGES
+    KINFO("BOOT", "Boot stage other: %u us", boottime_us(total - staged));
+    KINFO("BOOT", "Boot total: %u us", boottime_us(total));
+}
@@ -0,0 +1,21 @@
+#ifndef BOOTTIME_H
+#define BOOTTIME_H
+
+#include <stdint.h>
+
+// Stages boottime_stage() remembers; later ones are only counted in the total
+#define BOOTTIME_MAX_STAGES 32
+
+// TSC when the bootloader jumped to _start, saved by boot.s
+extern uint64_t boot_tsc;
+
+// Record that the stage called name ran from TSC start until now. name must
+// stay valid until boottime_report().
+void boottime_stage(const char* name, uint64_t start);
+
+// Log each stage's time and the total since _start as "Boot stage" lines,
+// for tools/boottime.py. Called once, at the end of initialization; needs
+// clock_init() to convert cycles.
+void boottime_report(void);
+
+#endif // BOOTTIME_H
@@ -0,0 +1,50 @@
+#include "clock.h"
+#include "pit.h"
+#include "klog.h"
+
+struct clock_data clock_data;
+
+void __init clock_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_TSC)) {
+        KPANIC("CLOCK", "CPU has no time-stamp counter");
+    }
+
+    pit_init(CLOCK_TICK_HZ);
+
+    uint32_t khz = pit_calibrate_tsc();
+    if (!khz) {
+        KPANIC("CLOCK", "TSC calibration failed");
+    }
+
+    // Pick the largest shift whose multiplier still fits in 32 bits: one
+    // cycle is 10^6 / khz ns, so mult = (10^6 << shift) / khz
+    uint32_t shift = 32;
+    uint64_t mult;
+    while ((mult = ((uint64_t)NSEC_PER_MSEC << shift) / khz) > 0xFFFFFFFFULL) {
+        shift--;
+    }
+
+    clock_data.tsc_khz = khz;
+    clock_data.shift = shift;
+    clock_data.tsc_base = rdtsc();
+    clock_data.mult = mult;
+
+    KINFO_INIT("CLOCK", "TSC at %u.%u MHz, mult %u, shift %u", khz / 1000,
+               (khz % 1000) / 100, (uint32_t)mult, shift);
+}
+
+static void clock_spin_until(uint64_t end) {
+    while (ktime_ns() < end) {
+        cpu_relax();
+    }
+}
+
+void ndelay(uint32_t ns) {
+    clock_spin_until(ktime_ns() + ns);
+}
+
+void udelay(uint32_t us) {
+    clock_spin_until(ktime_ns() + (uint64_t)us * NSEC_PER_USEC);
+}
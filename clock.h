@@ -0,0 +1,60 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+#define NSEC_PER_SEC    1000000000ULL
+#define NSEC_PER_MSEC   1000000
+#define NSEC_PER_USEC   1000
+
+// Periodic timer interrupt rate. Override with -DCLOCK_TICK_HZ=...
+#ifndef CLOCK_TICK_HZ
+#define CLOCK_TICK_HZ   100
+#endif
+
+// TSC to nanosecond conversion: ns = (cycles * mult) >> shift. Written once
+// by clock_init() and read-only afterwards.
+struct clock_data {
+    uint64_t tsc_base;      // TSC value at ktime_ns() == 0
+    uint32_t mult;
+    uint32_t shift;
+    uint32_t tsc_khz;
+};
+
+extern struct clock_data clock_data;
+
+// Scale a TSC delta to nanoseconds with two 32x32->64 multiplies, so no
+// 64-bit division is needed
+static inline uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    uint32_t lo = (uint32_t)cycles;
+    uint32_t hi = (uint32_t)(cycles >> 32);
+
+    return (((uint64_t)lo * clock_data.mult) >> clock_data.shift) +
+           (((uint64_t)hi * clock_data.mult) << (32 - clock_data.shift));
+}
+
+// Monotonic nanoseconds since clock_init(); 0 before it. No port I/O.
+static inline uint64_t ktime_ns(void) {
+    return clock_cycles_to_ns(rdtsc() - clock_data.tsc_base);
+}
+
+// A programmable timer interrupt source, used in one-shot mode
+struct clock_event_device {
+    const char* name;
+    int rating;                             // Higher is preferred
+    uint64_t min_delta_ns;
+    uint64_t max_delta_ns;
+    void (*set_next_event)(uint64_t delta_ns);
+    void (*shutdown)(void);                 // Stop any periodic or pending event
+    void (*event_handler)(void);            // Set by the timer code
+};
+
+// Start the periodic tick and calibrate the TSC. Needs pic_init().
+void clock_init(void);
+
+// Busy-wait for at least the given time. Needs clock_init().
+void ndelay(uint32_t ns);
+void udelay(uint32_t us);
+
+#endif // CLOCK_H
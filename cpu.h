@@ -0,0 +1,116 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+// EFLAGS bits
+#define EFLAGS_IF       0x200   // Interrupt enable flag
+
+// Control register bits
+#define CR0_MP          0x00000002  // WAIT/FWAIT honour TS
+#define CR0_EM          0x00000004  // No x87: every FPU instruction faults
+#define CR0_TS          0x00000008  // Task switched: next FPU use raises #NM
+#define CR0_NE          0x00000020  // Native x87 error reporting
+#define CR0_WP          0x00010000  // Honour read-only pages in ring 0
+#define CR0_PG          0x80000000  // Paging
+#define CR4_PSE         0x00000010  // 4 MiB pages
+#define CR4_PGE         0x00000080  // Global pages
+#define CR4_OSFXSR      0x00000200  // FXSAVE/FXRSTOR and SSE instructions
+#define CR4_OSXMMEXCPT  0x00000400  // Unmasked SSE exceptions raise #XM
+
+// CPUID leaf 1 EDX feature bits
+#define CPUID_EDX_FPU   (1 << 0)
+#define CPUID_EDX_PSE   (1 << 3)
+#define CPUID_EDX_TSC   (1 << 4)
+#define CPUID_EDX_MSR   (1 << 5)
+#define CPUID_EDX_APIC  (1 << 9)
+#define CPUID_EDX_PGE   (1 << 13)
+#define CPUID_EDX_FXSR  (1 << 24)
+#define CPUID_EDX_SSE   (1 << 25)
+#define CPUID_EDX_SSE2  (1 << 26)
+
+// Model-specific registers
+#define MSR_APIC_BASE           0x1B
+#define MSR_APIC_BASE_BSP       (1 << 8)    // Set on the bootstrap processor
+#define MSR_APIC_BASE_ENABLE    (1 << 11)
+
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx,
+                         uint32_t* ecx, uint32_t* edx) {
+    __asm__ volatile ("cpuid"
+                      : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                      : "a"(leaf), "c"(0));
+}
+
+#define DEFINE_CR_ACCESSORS(n)                                              \
+    static inline uint32_t read_cr##n(void) {                               \
+        uint32_t value;                                                     \
+        __asm__ volatile ("mov %%cr" #n ", %0" : "=r"(value));              \
+        return value;                                                       \
+    }                                                                       \
+    static inline void write_cr##n(uint32_t value) {                        \
+        __asm__ volatile ("mov %0, %%cr" #n : : "r"(value) : "memory");     \
+    }
+
+DEFINE_CR_ACCESSORS(0)
+DEFINE_CR_ACCESSORS(2)
+DEFINE_CR_ACCESSORS(3)
+DEFINE_CR_ACCESSORS(4)
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)value),
+                      "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+// Load the task register with a TSS selector
+static inline void load_tr(uint16_t selector) {
+    __asm__ volatile ("ltr %0" : : "r"(selector));
+}
+
+static inline void load_gs(uint16_t selector) {
+    __asm__ volatile ("mov %0, %%gs" : : "r"(selector) : "memory");
+}
+
+// Drop the TLB entry for one page
+static inline void invlpg(uintptr_t addr) {
+    __asm__ volatile ("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+// Read the time-stamp counter
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Disable interrupts and return the previous EFLAGS so they can be restored
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// Restore the interrupt state saved by irq_save()
+static inline void irq_restore(uint32_t flags) {
+    if (flags & EFLAGS_IF) {
+        __asm__ volatile ("sti" : : : "memory");
+    }
+}
+
+// Enable interrupts and halt until the next one arrives. The instruction
+// after STI executes before any interrupt is taken, so no wakeup is lost.
+static inline void cpu_wait_for_interrupt(void) {
+    __asm__ volatile ("sti\n\thlt" : : : "memory");
+}
+
+// Spin-wait hint
+static inline void cpu_relax(void) {
+    __asm__ volatile ("pause" : : : "memory");
+}
+
+#endif // CPU_H
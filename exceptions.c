@@ -1,6 +1,10 @@
 #include "idt.h"
+#include "irq.h"
 #include "klog.h"
 #include "pic.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "cpu.h"
 #include <stdint.h>
 
 // Exception names for better error reporting
@@ -19,19 +23,60 @@ static const char* exception_messages[] = {
     "Segment Not Present", 
     "Stack Fault",
     "General Protection Fault",
-    "Page Fault"
+    "Page Fault",
+    "Reserved",
+    "x87 Floating Point",
+    "Alignment Check",
+    "Machine Check",
+    "SIMD Floating Point",
+    "Virtualization",
+    "Control Protection",
+    "Reserved",
+    "Reserved",
+    "Reserved",
+    "Reserved",
+    "Reserved",
+    "Reserved",
+    "Hypervisor Injection",
+    "VMM Communication",
+    "Security",
+    "Reserved"
 };
 
-// C exception handler called from assembly
+// Resolve demand-zero faults; anything else is reported and panics
+static void page_fault_handler(struct interrupt_frame* frame, void* ctx) {
+    uint32_t faulting_address = read_cr2();
+    uint32_t err = frame->err_code;
+
+    if (vmm_handle_fault(faulting_address, err)) {
+        return;
+    }
+
+    KERROR("CPU", "Page fault at address 0x%x, EIP: 0x%x", faulting_address, frame->eip);
+    KERROR("CPU", "Error Code: 0x%x (%s, %s, %s%s%s)", err,
+           (err & PF_PRESENT) ? "protection violation" : "page not present",
+           (err & PF_INSTRUCTION) ? "instruction fetch" : (err & PF_WRITE) ? "write" : "read",
+           (err & PF_USER) ? "user mode" : "kernel mode",
+           (err & PF_RESERVED) ? ", reserved bit set" : "",
+           faulting_address < PAGE_SIZE ? ", NULL dereference" : "");
+
+    const struct vmm_region* region = vmm_lookup(faulting_address);
+    if (region) {
+        KPANIC("IDT", "Page fault in lazy region %s", region->name);
+    }
+    KPANIC("IDT", "Page fault occurred!");
+}
+
+// Exceptions nobody claimed with request_irq()
 void exception_handler(struct interrupt_frame* frame) {
     const char* exception_name = "Unknown Exception";
-    
-    if (frame->int_no < 15) {
+
+    if (frame->int_no < sizeof(exception_messages) / sizeof(exception_messages[0])) {
         exception_name = exception_messages[frame->int_no];
     }
     
     // Log the exception details
-    KERROR("CPU", "Exception %d (%s) occurred!", frame->int_no, exception_name);
+    KERROR("CPU", "Exception %u (%s) occurred!", frame->int_no, exception_name);
     KERROR("CPU", "Error Code: 0x%x", frame->err_code);
     KERROR("CPU", "EIP: 0x%x, CS: 0x%x, EFLAGS: 0x%x", 
            frame->eip, frame->cs, frame->eflags);
@@ -54,64 +99,14 @@ void exception_handler(struct interrupt_frame* frame) {
             KPANIC("IDT", "General Protection Fault - memory access violation!");
             break;
             
-        case INT_PAGE_FAULT: {
-            uint32_t faulting_address;
-            __asm__ volatile ("mov %%cr2, %0" : "=r" (faulting_address));
-            KERROR("CPU", "Page fault at address 0x%x", faulting_address);
-            KPANIC("IDT", "Page fault occurred!");
-            break;
-        }
-        
         default:
             KPANIC("IDT", "Unhandled CPU exception!");
             break;
     }    
 }
 
-// Hardware interrupt handler (called from assembly)
-void irq_handler(struct interrupt_frame* frame) {
-    // Convert interrupt number back to IRQ number
-    uint8_t irq = frame->int_no - 32;
-
-    pic_send_eoi(irq);
-   
-    switch (irq) {
-        case 0:  // Timer interrupt
-            KDEBUG("IRQ", "Timer tick");
-            break;
-                
-        case 1: {  // Keyboard interrupt
-            // Leer el scancode del puerto del teclado
-            uint8_t scancode = inb(0x60);
-            KINFO("IRQ", "Key pressed! Scancode: 0x%x", scancode);
-                
-            // Convertir algunos scancodes básicos a caracteres para debug
-            switch (scancode) {
-                case 0x1E: KINFO("KBD", "Key: 'A'"); break;
-                case 0x30: KINFO("KBD", "Key: 'B'"); break;
-                case 0x2E: KINFO("KBD", "Key: 'C'"); break;
-                case 0x20: KINFO("KBD", "Key: 'D'"); break;
-                case 0x12: KINFO("KBD", "Key: 'E'"); break;
-                case 0x02: KINFO("KBD", "Key: '1'"); break;
-                case 0x03: KINFO("KBD", "Key: '2'"); break;
-                case 0x1C: KINFO("KBD", "Key: 'ENTER'"); break;
-                case 0x39: KINFO("KBD", "Key: 'SPACE'"); break;
-                default:
-                    if (scancode & 0x80) {
-                        KDEBUG("KBD", "Key released: 0x%x", scancode & 0x7F);
-                    } else {
-                        KDEBUG("KBD", "Unknown key pressed: 0x%x", scancode);
-                    }
-                    break;
-            }
-            break;
-        }
-                    
-            default:
-                KWARN("IRQ", "Unhandled IRQ %d", irq);
-                break;
-        }
-        
-    // Send End of Interrupt signal
-    pic_send_eoi(irq);
+void __init exceptions_init(void) {
+    // Page faults are routine once memory is populated lazily, so they
+    // skip the generic exception report
+    request_irq(INT_PAGE_FAULT, page_fault_handler, NULL);
 }
@@ -0,0 +1,189 @@
+#include "fpu.h"
+#include "irq.h"
+#include "sched.h"
+#include "smp.h"
+#include "slab.h"
+#include "string.h"
+#include "cpu.h"
+#include "klog.h"
+
+// Lazy switching. Each CPU remembers whose registers it holds (owner) and
+// whether that thread has touched them since it was last switched in
+// (live). Whenever the owner is not running, its saved image matches the
+// registers, so switching back to it on the same CPU only clears CR0.TS;
+// everyone else traps on first use and reloads.
+struct fpu_cpu {
+    struct thread* owner;
+    uint8_t live;               // Registers may be newer than owner's image
+    uint8_t ts;                 // Shadow of CR0.TS, to skip redundant writes
+    struct fpu_stats stats;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct fpu_cpu fpu_cpus[MAX_CPUS];
+static struct kmem_cache* fpu_cache;
+static struct fpu_state fpu_initial;    // What fninit leaves, for new threads
+static int fpu_enabled;
+static uint32_t fpu_states;
+
+static inline void fpu_fxsave(struct fpu_state* state) {
+    __asm__ volatile ("fxsave %0" : "=m"(*state));
+}
+
+static inline void fpu_fxrstor(const struct fpu_state* state) {
+    __asm__ volatile ("fxrstor %0" : : "m"(*state));
+}
+
+static inline void fpu_set_ts(struct fpu_cpu* fc, int ts) {
+    if (fc->ts == ts) {
+        return;
+    }
+    if (ts) {
+        write_cr0(read_cr0() | CR0_TS);
+    } else {
+        __asm__ volatile ("clts" : : : "memory");
+    }
+    fc->ts = ts;
+}
+
+// #NM: the running thread wants its registers
+static void fpu_trap(struct interrupt_frame* frame, void* ctx) {
+    struct fpu_cpu* fc = &fpu_cpus[cpu_id()];
+    struct thread* t = current_thread();
+
+    if (!fpu_enabled) {
+        KPANIC("FPU", "FPU instruction at 0x%x, but no FXSR support", frame->eip);
+    }
+
+    fc->stats.traps++;
+    fpu_set_ts(fc, 0);
+
+    if (!t->fpu) {
+        t->fpu = kmem_cache_alloc(fpu_cache);
+        if (!t->fpu) {
+            KPANIC("FPU", "No memory for the FPU state of %s", t->name);
+        }
+        memcpy(t->fpu, &fpu_initial, sizeof(fpu_initial));
+        __atomic_fetch_add(&fpu_states, 1, __ATOMIC_RELAXED);
+    }
+    if (fc->owner != t || t->fpu_cpu != cpu_id()) {
+        fpu_fxrstor(t->fpu);
+        fc->stats.restores++;
+    }
+
+    fc->owner = t;
+    fc->live = 1;
+    t->fpu_cpu = cpu_id();
+}
+
+void fpu_switch(struct thread* prev, struct thread* next) {
+    struct fpu_cpu* fc = &fpu_cpus[cpu_id()];
+
+    if (!fpu_enabled) {
+        return;
+    }
+
+    if (fc->live) {
+        // prev is the owner and may have changed its registers
+        if (prev->state == THREAD_DEAD) {
+            fc->owner = NULL;
+        } else {
+            fpu_fxsave(prev->fpu);
+            fc->stats.saves++;
+        }
+        fc->live = 0;
+    }
+
+    // Still loaded: let next carry on without a trap
+    int loaded = fc->owner == next && next->fpu_cpu == cpu_id();
+    fpu_set_ts(fc, !loaded);
+    fc->live = loaded;
+}
+
+void fpu_release(struct thread* t) {
+    if (t->fpu) {
+        kmem_cache_free(fpu_cache, t->fpu);
+        t->fpu = NULL;
+    }
+}
+
+uint32_t fpu_begin(void) {
+    uint32_t flags = irq_save();
+    struct fpu_cpu* fc = &fpu_cpus[cpu_id()];
+
+    if (fc->live) {
+        fpu_fxsave(fc->owner->fpu);
+        fc->stats.saves++;
+        fc->live = 0;
+    }
+    // The registers are about to belong to nobody
+    fc->owner = NULL;
+    fpu_set_ts(fc, 0);
+    return flags;
+}
+
+void fpu_end(uint32_t flags) {
+    fpu_set_ts(&fpu_cpus[cpu_id()], 1);
+    irq_restore(flags);
+}
+
+void __init fpu_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+
+    struct fpu_cpu* fc = &fpu_cpus[cpu_id()];
+    int boot = cpu_id() == 0;
+
+    if (!(edx & CPUID_EDX_FPU) || !(edx & CPUID_EDX_FXSR)) {
+        // Leave CR0.EM set so any FPU use traps into fpu_trap() and panics
+        write_cr0(read_cr0() | CR0_EM);
+        if (boot) {
+            KWARN("FPU", "No FXSR support, FPU and SSE disabled");
+        }
+        return;
+    }
+
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    if (edx & CPUID_EDX_SSE) {
+        write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    } else {
+        write_cr4(read_cr4() | CR4_OSFXSR);
+    }
+
+    __asm__ volatile ("fninit");
+    if (boot) {
+        if (edx & CPUID_EDX_SSE) {
+            uint32_t mxcsr = FPU_MXCSR_DEFAULT;
+            __asm__ volatile ("ldmxcsr %0" : : "m"(mxcsr));
+        }
+        fpu_fxsave(&fpu_initial);
+        fpu_cache = kmem_cache_create("fpu", sizeof(struct fpu_state), FPU_STATE_ALIGN, 0, NULL);
+        request_irq(INT_DEVICE_NOT_AVAIL, fpu_trap, NULL);
+        fpu_enabled = 1;
+        KINFO_INIT("FPU", "x87%s%s, lazy FXSAVE switching",
+                   (edx & CPUID_EDX_SSE) ? " + SSE" : "",
+                   (edx & CPUID_EDX_SSE2) ? "2" : "");
+    }
+
+    // Nobody owns the registers yet
+    fc->ts = 0;
+    fpu_set_ts(fc, 1);
+}
+
+void fpu_get_stats(struct fpu_stats* stats) {
+    *stats = (struct fpu_stats){ 0 };
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        stats->traps += fpu_cpus[cpu].stats.traps;
+        stats->restores += fpu_cpus[cpu].stats.restores;
+        stats->saves += fpu_cpus[cpu].stats.saves;
+    }
+    stats->states = fpu_states;
+}
+
+void fpu_dump_stats(void) {
+    struct fpu_stats stats;
+    fpu_get_stats(&stats);
+
+    KINFO("FPU", "%u threads with state, %u traps, %u restores, %u saves",
+          stats.states, stats.traps, stats.restores, stats.saves);
+}
@@ -0,0 +1,50 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+
+struct thread;
+
+// FXSAVE image: x87, MMX and SSE registers plus MXCSR
+#define FPU_STATE_SIZE          512
+#define FPU_STATE_ALIGN         16
+
+// Default MXCSR: every SSE exception masked, round to nearest
+#define FPU_MXCSR_DEFAULT       0x1F80
+
+// thread->fpu_cpu when no CPU holds the thread's registers
+#define FPU_NO_CPU              0xFF
+
+struct fpu_state {
+    uint8_t fxsave[FPU_STATE_SIZE];
+} __attribute__((aligned(FPU_STATE_ALIGN)));
+
+struct fpu_stats {
+    uint32_t traps;             // #NM taken
+    uint32_t restores;          // Registers loaded from a saved image
+    uint32_t saves;             // Registers saved on a switch away
+    uint32_t states;            // Threads that ever used the FPU
+};
+
+// Enable x87 and SSE on the calling CPU with CR0.TS set, so the first FPU
+// instruction of every thread traps. The boot CPU calls it after
+// sched_init(), application processors after sched_init_ap().
+void fpu_init(void);
+
+// Called by schedule() with interrupts off. Saves prev's registers only if
+// they are loaded and may have changed, and leaves the FPU trapping unless
+// next's registers are still loaded.
+void fpu_switch(struct thread* prev, struct thread* next);
+
+// Free a dead thread's saved state
+void fpu_release(struct thread* t);
+
+// Use SSE in kernel code: saves whatever is loaded and returns with
+// interrupts off until fpu_end(). Keep the section short.
+uint32_t fpu_begin(void);
+void fpu_end(uint32_t flags);
+
+void fpu_get_stats(struct fpu_stats* stats);
+void fpu_dump_stats(void);
+
+#endif // FPU_H
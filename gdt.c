@@ -1,83 +1,97 @@
 #include "gdt.h"
+#include "smp.h"
+#include "cpu.h"
 #include "klog.h"
 
-static struct gdt_entry gdt_entries[GDT_ENTRIES];
+// Top of the boot stack reserved in boot.s
+extern char stack_top[];
 
-static struct gdt_ptr gdt_ptr;
+void __init gdt_init(void) {
+    KINFO_INIT("GDT", "Initializing Global Descriptor Table...");
+
+    // The boot CPU keeps running on the stack boot.s set up
+    cpus[0].stack_top = (uintptr_t)stack_top;
+    gdt_init_cpu(&cpus[0]);
+
+    KINFO_INIT("GDT", "GDT loaded successfully! Kernel now using custom segments.");
+}
+
+void __init gdt_init_cpu(struct cpu* cpu) {
+    struct gdt_entry* gdt = cpu->gdt;
+    struct gdt_ptr ptr;
+
+    ptr.limit = sizeof(cpu->gdt) - 1;
+    ptr.base = (uint32_t)gdt;
+    cpu->self = cpu;
 
-void gdt_init(void) {
-    KINFO("GDT", "Initializing Global Descriptor Table...");
-    
-    gdt_ptr.limit = (sizeof(struct gdt_entry) * GDT_ENTRIES) - 1;
-    gdt_ptr.base = (uint32_t)&gdt_entries;
-    
-    KDEBUG("GDT", "GDT base address: 0x%x", gdt_ptr.base);
-    KDEBUG("GDT", "GDT limit: %d bytes", gdt_ptr.limit + 1);
-    
     // Set up GDT entries:
     
     // Entry 0: Null descriptor (required by x86)
-    gdt_set_gate(0, 0, 0, 0, 0);
-    KDEBUG("GDT", "Entry 0: Null descriptor");
+    gdt_set_gate(gdt, 0, 0, 0, 0, 0);
     
     // Entry 1: Kernel code segment (Ring 0)
     // Base: 0x00000000, Limit: 0xFFFFFFFF (4GB)
     // Access: Present | Ring 0 | Code | Executable | Readable
     // Granularity: 4KB blocks | 32-bit
-    gdt_set_gate(1, 0, 0xFFFFFFFF,
+    gdt_set_gate(gdt, 1, 0, 0xFFFFFFFF,
                  GDT_PRESENT | GDT_PRIVILEGE_0 | 0x10 | GDT_EXECUTABLE | GDT_READABLE,
                  GDT_GRANULARITY | GDT_32BIT | 0x0F);
-    KDEBUG("GDT", "Entry 1: Kernel code segment (0x08)");
     
     // Entry 2: Kernel data segment (Ring 0)  
     // Base: 0x00000000, Limit: 0xFFFFFFFF (4GB)
     // Access: Present | Ring 0 | Data | Writable
     // Granularity: 4KB blocks | 32-bit
-    gdt_set_gate(2, 0, 0xFFFFFFFF,
+    gdt_set_gate(gdt, 2, 0, 0xFFFFFFFF,
                  GDT_PRESENT | GDT_PRIVILEGE_0 | 0x10 | GDT_WRITABLE,
                  GDT_GRANULARITY | GDT_32BIT | 0x0F);
-    KDEBUG("GDT", "Entry 2: Kernel data segment (0x10)");
     
     // Entry 3: User code segment (Ring 3) - for future user programs
-    gdt_set_gate(3, 0, 0xFFFFFFFF,
+    gdt_set_gate(gdt, 3, 0, 0xFFFFFFFF,
                  GDT_PRESENT | GDT_PRIVILEGE_3 | 0x10 | GDT_EXECUTABLE | GDT_READABLE,
                  GDT_GRANULARITY | GDT_32BIT | 0x0F);  
-    KDEBUG("GDT", "Entry 3: User code segment (0x18)");
     
     // Entry 4: User data segment (Ring 3) - for future user programs
-    gdt_set_gate(4, 0, 0xFFFFFFFF,
+    gdt_set_gate(gdt, 4, 0, 0xFFFFFFFF,
                  GDT_PRESENT | GDT_PRIVILEGE_3 | 0x10 | GDT_WRITABLE,
                  GDT_GRANULARITY | GDT_32BIT | 0x0F);
-    KDEBUG("GDT", "Entry 4: User data segment (0x20)");
-    
-    // Load the GDT using assembly helper
-    KINFO("GDT", "Loading new GDT...");
-    gdt_flush((uint32_t)&gdt_ptr);
-    
-    KINFO("GDT", "GDT loaded successfully! Kernel now using custom segments.");
+
+    // Entry 5: This CPU's TSS, so interrupts from ring 3 land on its stack
+    cpu->tss.ss0 = KERNEL_DATA_SEGMENT;
+    cpu->tss.esp0 = cpu->stack_top;
+    cpu->tss.iomap_base = sizeof(struct tss);
+    gdt_set_gate(gdt, 5, (uint32_t)&cpu->tss, sizeof(struct tss) - 1, GDT_TSS, 0);
+
+    // Entry 6: Per-CPU data, byte granular and exactly as large as struct cpu
+    gdt_set_gate(gdt, 6, (uint32_t)cpu, sizeof(struct cpu) - 1,
+                 GDT_PRESENT | GDT_PRIVILEGE_0 | 0x10 | GDT_WRITABLE, GDT_32BIT);
+
+    // Load the GDT using assembly helper, then the per-CPU selectors
+    gdt_flush((uint32_t)&ptr);
+    load_tr(TSS_SEGMENT);
+    load_gs(PERCPU_SEGMENT);
+
+    KDEBUG_INIT("GDT", "CPU %u: GDT at 0x%x, TSS at 0x%x", cpu->id, ptr.base,
+                (uint32_t)&cpu->tss);
 }
 
-void gdt_set_gate(uint32_t num, uint32_t base, uint32_t limit,
+void gdt_set_gate(struct gdt_entry* gdt, uint32_t num, uint32_t base, uint32_t limit,
                   uint8_t access, uint8_t gran) {
     
     if (num >= GDT_ENTRIES) {
-        KERROR("GDT", "Invalid GDT entry number: %d", num);
+        KERROR("GDT", "Invalid GDT entry number: %u", num);
         return;
     }
     
     // Set base address
-    gdt_entries[num].base_low    = (base & 0xFFFF);
-    gdt_entries[num].base_middle = (base >> 16) & 0xFF;
-    gdt_entries[num].base_high   = (base >> 24) & 0xFF;
+    gdt[num].base_low    = (base & 0xFFFF);
+    gdt[num].base_middle = (base >> 16) & 0xFF;
+    gdt[num].base_high   = (base >> 24) & 0xFF;
     
     // Set limit  
-    gdt_entries[num].limit_low   = (limit & 0xFFFF);
-    gdt_entries[num].granularity = (limit >> 16) & 0x0F;
+    gdt[num].limit_low   = (limit & 0xFFFF);
+    gdt[num].granularity = (limit >> 16) & 0x0F;
     
     // Set granularity and access flags
-    gdt_entries[num].granularity |= gran & 0xF0;
-    gdt_entries[num].access       = access;
-    
-    KDEBUG("GDT", "Set entry %d: base=0x%x, limit=0x%x, access=0x%x, gran=0x%x", 
-           num, base, limit, access, gran);
-}
\ No newline at end of file
+    gdt[num].granularity |= gran & 0xF0;
+    gdt[num].access       = access;
+}
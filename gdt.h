@@ -39,15 +39,39 @@ struct gdt_ptr {
 #define KERNEL_DATA_SEGMENT 0x10    // GDT entry 2  
 #define USER_CODE_SEGMENT   0x18    // GDT entry 3
 #define USER_DATA_SEGMENT   0x20    // GDT entry 4
+#define TSS_SEGMENT         0x28    // GDT entry 5, this CPU's TSS
+#define PERCPU_SEGMENT      0x30    // GDT entry 6, based at this CPU's struct cpu
 
 // Number of GDT entries
-#define GDT_ENTRIES 5
+#define GDT_ENTRIES 7
 
-// Initialize the Global Descriptor Table
+// Access byte of an available 32-bit TSS
+#define GDT_TSS         0x89
+
+// 32-bit task state segment. Only the ring 0 stack is used, for interrupts
+// taken in ring 3; the kernel never switches tasks in hardware.
+struct tss {
+    uint32_t prev_tss;
+    uint32_t esp0;          // Stack loaded on entry to ring 0
+    uint32_t ss0;
+    uint32_t esp1, ss1, esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs, ldt;
+    uint16_t trap;
+    uint16_t iomap_base;    // Past the limit: no I/O permission bitmap
+} __attribute__((packed));
+
+struct cpu;
+
+// Build the boot CPU's GDT and load it
 void gdt_init(void);
 
-// Set a GDT entry with specified parameters
-void gdt_set_gate(uint32_t num, uint32_t base, uint32_t limit, 
+// Build cpu's GDT and TSS, then load them along with %gs on the calling CPU
+void gdt_init_cpu(struct cpu* cpu);
+
+// Set an entry of a GDT with specified parameters
+void gdt_set_gate(struct gdt_entry* gdt, uint32_t num, uint32_t base, uint32_t limit,
                   uint8_t access, uint8_t gran);
 
 // Assembly function to load the GDT (defined in gdt_asm.s)
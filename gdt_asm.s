@@ -16,12 +16,12 @@ gdt_flush:
     
 reload_segments:
     # Now we're using the new code segment (0x08)
-    # Reload all data segment registers with new data segment (0x10)
+    # Reload the data segment registers with new data segment (0x10).
+    # %gs is the per-CPU segment and is loaded by gdt_init_cpu().
     mov $0x10, %ax          # Load kernel data segment selector
     mov %ax, %ds            # Data segment
     mov %ax, %es            # Extra segment  
     mov %ax, %fs            # F segment
-    mov %ax, %gs            # G segment
     mov %ax, %ss            # Stack segment
     
     # Return to caller - now using new GDT!
@@ -18,7 +18,6 @@ struct idt_ptr {
 
 // Interrupt frame structure (pushed by CPU and our assembly code)
 struct interrupt_frame {
-    uint32_t ds;        // Data segment
     uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;  // General purpose registers (pusha)
     uint32_t int_no;    // Interrupt number
     uint32_t err_code;  // Error code
@@ -40,12 +39,23 @@ void idt_set_gate(uint32_t num, uint32_t base, uint16_t selector, uint8_t type);
 // Standard interrupt/exception numbers
 #define INT_DIVIDE_ERROR        0   // Division by zero
 #define INT_DEBUG               1   // Debug exception
+#define INT_NMI                 2   // Non-maskable interrupt
 #define INT_BREAKPOINT          3   // Breakpoint
 #define INT_OVERFLOW            4   // Overflow
+#define INT_BOUND_RANGE         5   // BOUND range exceeded
 #define INT_INVALID_OPCODE      6   // Invalid opcode
+#define INT_DEVICE_NOT_AVAIL    7   // FPU instruction with CR0.TS set
 #define INT_DOUBLE_FAULT        8   // Double fault
+#define INT_INVALID_TSS         10  // Invalid TSS
+#define INT_SEGMENT_NOT_PRESENT 11  // Segment not present
+#define INT_STACK_FAULT         12  // Stack segment fault
 #define INT_GENERAL_PROTECTION  13  // General protection fault
 #define INT_PAGE_FAULT          14  // Page fault
+#define INT_X87_FPU             16  // x87 floating point error
+#define INT_ALIGNMENT_CHECK     17  // Alignment check
+#define INT_MACHINE_CHECK       18  // Machine check
+#define INT_SIMD_FPU            19  // SSE floating point error
+#define INT_CONTROL_PROTECTION  21  // Control protection
 
 // Number of entries
 #define NUMBER_OF_IDT_ENTRIES 256
@@ -53,21 +63,13 @@ void idt_set_gate(uint32_t num, uint32_t base, uint16_t selector, uint8_t type);
 // Initialize idt
 void idt_init(void);
 
-extern void idt_flush(uint32_t idt_ptr);
-
-// Exception handlers
-extern void isr0(void);   // Division by zero
-extern void isr1(void);   // Debug
-extern void isr3(void);   // Breakpoint
-extern void isr4(void);   // Overflow
-extern void isr6(void);   // Invalid opcode
-extern void isr8(void);   // Double fault
-extern void isr13(void);  // General protection fault
-extern void isr14(void);  // Page fault
+// Load the shared IDT on an application processor
+void idt_load(void);
 
-// Hardware interrupt handlers
-extern void irq0(void);   // Timer
-extern void irq1(void);   // Keyboard
+extern void idt_flush(uint32_t idt_ptr);
 
+// Entry stubs for every vector (interrupts.s)
+extern const uint32_t isr_stub_table[NUMBER_OF_IDT_ENTRIES];
+extern void irq_spurious(void);
 
-#endif
\ No newline at end of file
+#endif // IDT_H
@@ -0,0 +1,20 @@
+#ifndef INIT_H
+#define INIT_H
+
+// Boot-only code and data. The linker gathers these into the .init section,
+// bracketed by __init_start/__init_end, and pmm_free_initmem() hands its
+// pages back to the page allocator once kernel_main() has finished
+// initialization. Nothing resident may call an __init function or keep a
+// pointer into __initdata past that point. __init functions are never
+// inlined, so a boot-only helper cannot end up inside resident code.
+#define __init          __attribute__((section(".init.text"), cold, noinline))
+#define __initdata      __attribute__((section(".init.data")))
+#define __initconst     __attribute__((section(".init.rodata")))
+
+// A string literal placed in .init.rodata instead of .rodata
+#define __initstr(s)    ({ static const char __initstr_[] __initconst = s; __initstr_; })
+
+extern char __init_start[];
+extern char __init_end[];
+
+#endif // INIT_H
@@ -2,125 +2,90 @@
 
 .section .text
 
-# Macro to create interrupt service routine stubs
-.macro ISR_NOERRCODE num
-    .global isr\num
-    isr\num:
-        push $0          # Push dummy error code
-        push $\num       # Push interrupt number
-        jmp isr_common   # Jump to common handler
-.endm
+# Offset of the CS the CPU pushed, past pusha (32 bytes), the vector and
+# the error code, and past the saved %ds and %es below them
+.set FRAME_CS, 44
+.set SAVED_CS, FRAME_CS + 8
+
+# One stub per vector. Exceptions that push an error code skip the dummy
+# one, so every frame has the same layout.
+.altmacro
 
-.macro ISR_ERRCODE num
-    .global isr\num
-    isr\num:
-        push $\num       # Push interrupt number (error code already pushed)
-        jmp isr_common   # Jump to common handler
+.macro ISR_STUB num
+    .align 8
+isr\num:
+    .if !(\num == 8 || (\num >= 10 && \num <= 14) || \num == 17 || \num == 21 || \num == 29 || \num == 30)
+        push $0             # Dummy error code
+    .endif
+    push $\num
+    jmp interrupt_common
 .endm
 
-# Macro for hardware interrupt (IRQ) stubs  
-.macro IRQ num, irq_num
-    .global irq\num
-    irq\num:
-        push $0          # Push dummy error code
-        push $\irq_num   # Push interrupt number (32 + IRQ number)
-        jmp irq_common   # Jump to common IRQ handler
+.macro ISR_ENTRY num
+    .long isr\num
 .endm
 
-# Create all the ISR stubs
-ISR_NOERRCODE 0   # Division by zero
-ISR_NOERRCODE 1   # Debug
-ISR_NOERRCODE 3   # Breakpoint
-ISR_NOERRCODE 4   # Overflow
-ISR_NOERRCODE 6   # Invalid opcode
-ISR_ERRCODE   8   # Double fault
-ISR_ERRCODE   13  # General protection fault
-ISR_ERRCODE   14  # Page fault
+.set vector, 0
+.rept 256
+    ISR_STUB %vector
+    .set vector, vector + 1
+.endr
 
-# Create IRQ stubs
-IRQ 0, 32  # Timer (IRQ 0 -> INT 32)
-IRQ 1, 33  # Keyboard (IRQ 1 -> INT 33)
+# Stub addresses in vector order, for idt_init()
+.section .rodata
+.align 4
+.global isr_stub_table
+isr_stub_table:
+.set vector, 0
+.rept 256
+    ISR_ENTRY %vector
+    .set vector, vector + 1
+.endr
 
-# Common ISR handler
-isr_common:
-    # Save all general-purpose registers
-    pusha
-    
-    # Save data segments
-    mov %ds, %ax
-    push %eax
-    
-    # Load kernel data segment
-    mov $0x10, %ax
-    mov %ax, %ds
-    mov %ax, %es
-    mov %ax, %fs
-    mov %ax, %gs
-
-    # Push pointer to interrupt frame as parameter
-    push %esp
-    
-    # Call C exception handler
-    call exception_handler
-
-    # Remove the frame pointer parameter
+.section .text
 
-    add $4, %esp
-    
-    # Restore data segments
-    pop %eax
-    mov %ax, %ds
-    mov %ax, %es
-    mov %ax, %fs
-    mov %ax, %gs
-    
-    # Restore all registers
-    popa
-    
-    # Clean up error code and interrupt number
-    add $8, %esp
-    
-    # Return from interrupt
+# Spurious local APIC interrupts (vector 0xFF) must not be acknowledged,
+# so they skip the dispatcher entirely. The 8259's spurious IRQ 7 and 15
+# need a check first and go through interrupt_dispatch().
+.global irq_spurious
+irq_spurious:
     iret
 
-# Common IRQ handler
-irq_common:
-    # Save all general-purpose registers
+# Common entry for every vector. The kernel runs on the flat data segment
+# and %gs holds this CPU's per-CPU segment (see smp.h), so segments only
+# need switching when the interrupt came from user mode.
+interrupt_common:
     pusha
-    
-    # Save data segments
-    mov %ds, %ax
-    push %eax
-    
-    # Load kernel data segment
+    cld                     # The interrupted code may be mid memmove()
+    push %ds
+    push %es
+
+    testb $3, SAVED_CS(%esp)
+    jz 1f
     mov $0x10, %ax
     mov %ax, %ds
     mov %ax, %es
-    mov %ax, %fs
-    mov %ax, %gs
-
-    # push %esp
-    
-    # Call C interrupt handler
-    call irq_handler
-
-    # Remove the frame pointer parameter
+1:
+    # Pointer to the interrupt frame, above the saved selectors, as the
+    # only argument
+    lea 8(%esp), %eax
+    push %eax
+    call interrupt_dispatch
     add $4, %esp
-    
-    # Restore data segments
-    pop %eax
-    mov %ax, %ds
-    mov %ax, %es
-    mov %ax, %fs
-    mov %ax, %gs
-    
-    # Restore all registers
+
+    # Give user mode back whatever selectors it had
+    testb $3, SAVED_CS(%esp)
+    jz 2f
+    pop %es
+    pop %ds
+    jmp 3f
+2:
+    add $8, %esp
+3:
     popa
-    
-    # Clean up error code and interrupt number
+
+    # Drop the vector and error code
     add $8, %esp
-    
-    # Return from interrupt
     iret
 
 # Assembly function to load IDT
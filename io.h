@@ -0,0 +1,41 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stdint.h>
+
+// Port I/O functions
+static inline void outb(uint16_t port, uint8_t value) {
+    __asm__ volatile ("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline void outw(uint16_t port, uint16_t value) {
+    __asm__ volatile ("outw %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint16_t inw(uint16_t port) {
+    uint16_t ret;
+    __asm__ volatile ("inw %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+// Short delay for devices that need time between port accesses
+static inline void io_wait(void) {
+    outb(0x80, 0);
+}
+
+// QEMU's isa-debug-exit device (-device isa-debug-exit,iobase=0xf4,iosize=0x04)
+// ends the emulator with exit status (code << 1) | 1. Real hardware ignores
+// the write.
+#define QEMU_EXIT_PORT  0xF4
+
+static inline void qemu_exit(uint8_t code) {
+    outb(QEMU_EXIT_PORT, code);
+}
+
+#endif // IO_H
@@ -0,0 +1,112 @@
+#include "irq.h"
+#include "irqchip.h"
+#include "apic.h"
+#include "spinlock.h"
+#include "smp.h"
+#include "sched.h"
+#include "softirq.h"
+#include "trace.h"
+#include "klog.h"
+
+struct irq_action {
+    irq_handler_t handler;
+    void* ctx;
+};
+
+static struct irq_action irq_actions[NUMBER_OF_IDT_ENTRIES];
+static spinlock_t irq_actions_lock = SPINLOCK_INIT;
+
+int request_irq(uint32_t vector, irq_handler_t handler, void* ctx) {
+    if (vector >= NUMBER_OF_IDT_ENTRIES || !handler) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&irq_actions_lock);
+    struct irq_action* action = &irq_actions[vector];
+    if (action->handler) {
+        spin_unlock_irqrestore(&irq_actions_lock, flags);
+        KWARN("IRQ", "Vector %u already claimed", vector);
+        return -1;
+    }
+
+    // Other CPUs dispatch without the lock: publish ctx before the handler
+    action->ctx = ctx;
+    __atomic_store_n(&action->handler, handler, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&irq_actions_lock, flags);
+    return 0;
+}
+
+void free_irq(uint32_t vector) {
+    if (vector >= NUMBER_OF_IDT_ENTRIES) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&irq_actions_lock);
+    __atomic_store_n(&irq_actions[vector].handler, NULL, __ATOMIC_RELEASE);
+    irq_actions[vector].ctx = NULL;
+    spin_unlock_irqrestore(&irq_actions_lock, flags);
+}
+
+// Vectors an interrupt controller delivers and waits for an EOI on: the
+// ISA IRQs, and with the local APIC its timer and IPIs. Anything else
+// from IRQ_BASE up can only come from a software int instruction.
+static inline int irq_needs_eoi(uint32_t vector) {
+    if (vector < IRQ_VECTOR(IRQ_ISA_LINES)) {
+        return 1;
+    }
+    return vector >= APIC_TIMER_VECTOR && vector < APIC_SPURIOUS_VECTOR && apic_enabled();
+}
+
+void interrupt_dispatch(struct interrupt_frame* frame) {
+    uint32_t vector = frame->int_no;
+    struct irq_action* action = &irq_actions[vector];
+    irq_handler_t handler = __atomic_load_n(&action->handler, __ATOMIC_ACQUIRE);
+
+    if (vector < IRQ_BASE) {
+        this_cpu_inc(exceptions);
+        TRACE_BEGIN("exception", vector);
+        if (handler) {
+            handler(frame, action->ctx);
+        } else {
+            exception_handler(frame);
+        }
+        TRACE_END("exception", vector);
+        return;
+    }
+
+    // The 8259 can raise IRQ 7 and 15 for requests that went away. Those
+    // must not reach a handler or get a normal EOI.
+    if ((vector == IRQ_VECTOR(7) || vector == IRQ_VECTOR(15)) && irq_is_spurious(vector - IRQ_BASE)) {
+        return;
+    }
+
+    struct cpu* cpu = this_cpu();
+    struct interrupt_frame* outer = cpu->irq_frame;
+
+    this_cpu_inc(irqs);
+    TRACE_BEGIN("irq", vector);
+    cpu->irq_frame = frame;
+    if (handler) {
+        handler(frame, action->ctx);
+    } else {
+        KWARN("IRQ", "Unhandled interrupt on vector %u", vector);
+    }
+
+    // Exactly one EOI, after the handler: the controller holds back lower
+    // priority sources until then, and a second EOI would retire one of
+    // them early
+    if (irq_needs_eoi(vector)) {
+        irq_eoi(vector - IRQ_BASE);
+    }
+    cpu->irq_frame = outer;
+    TRACE_END("irq", vector);
+
+    // Nested in a bottom half: the interrupt that started it finishes up
+    if (cpu->in_softirq) {
+        return;
+    }
+    if (cpu->softirq_pending) {
+        softirq_run();
+    }
+    sched_irq_exit();
+}
@@ -0,0 +1,32 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdint.h>
+#include "idt.h"
+
+// Vectors below this are CPU exceptions; ISA IRQ n arrives on IRQ_BASE + n
+#define IRQ_BASE                32
+#define IRQ_VECTOR(irq)         (IRQ_BASE + (irq))
+#define IRQ_ISA_LINES           16
+
+typedef void (*irq_handler_t)(struct interrupt_frame* frame, void* ctx);
+
+// Claim a vector. Exceptions go to handler instead of the generic report;
+// for vectors from IRQ_BASE up the dispatcher sends the one EOI after the
+// handler returns. Handlers run with interrupts disabled and leave anything
+// slow to a softirq (softirq.h). Returns -1 if the vector is already taken.
+int request_irq(uint32_t vector, irq_handler_t handler, void* ctx);
+
+// Release a vector. The caller makes sure the source is masked first.
+void free_irq(uint32_t vector);
+
+// Called from interrupt_common for every vector
+void interrupt_dispatch(struct interrupt_frame* frame);
+
+// Report and panic for an exception nobody claimed (exceptions.c)
+void exception_handler(struct interrupt_frame* frame);
+
+// Claim the exceptions the kernel resolves itself (exceptions.c)
+void exceptions_init(void);
+
+#endif // IRQ_H
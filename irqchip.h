@@ -0,0 +1,37 @@
+#ifndef IRQCHIP_H
+#define IRQCHIP_H
+
+#include <stdint.h>
+
+// Interrupt controller operations. Drivers use ISA IRQ numbers (0-15); every
+// backend delivers IRQ n on vector 32 + n so the IDT does not change.
+struct irqchip {
+    const char* name;
+    void (*mask)(uint8_t irq);
+    void (*unmask)(uint8_t irq);
+    void (*eoi)(uint8_t irq);
+    // Optional: non-zero if irq was raised spuriously. Whatever
+    // acknowledgement that needs has been sent; the dispatcher drops it.
+    int (*spurious)(uint8_t irq);
+};
+
+// The active controller: the 8259 pair until apic_init() takes over
+extern const struct irqchip* irq_chip;
+
+static inline void irq_set_mask(uint8_t irq) {
+    irq_chip->mask(irq);
+}
+
+static inline void irq_clear_mask(uint8_t irq) {
+    irq_chip->unmask(irq);
+}
+
+static inline void irq_eoi(uint8_t irq) {
+    irq_chip->eoi(irq);
+}
+
+static inline int irq_is_spurious(uint8_t irq) {
+    return irq_chip->spurious && irq_chip->spurious(irq);
+}
+
+#endif // IRQCHIP_H
@@ -4,122 +4,254 @@
 #include "klog.h"
 #include "gdt.h"
 #include "idt.h"
+#include "irq.h"
 #include "pic.h"
+#include "cpu.h"
+#include "serial.h"
+#include "keyboard.h"
+#include "multiboot.h"
+#include "pmm.h"
+#include "paging.h"
+#include "slab.h"
+#include "vmm.h"
+#include "clock.h"
+#include "timer.h"
+#include "apic.h"
+#include "smp.h"
+#include "sched.h"
+#include "async.h"
+#include "softirq.h"
+#include "fpu.h"
+#include "profile.h"
+#include "trace.h"
+#include "boottime.h"
+#include "string_test.h"
+#include "io.h"
+#include "string.h"
 
-uint8_t vga_entry_color(enum vga_color fg, enum vga_color bg) {
-    return fg | bg << 4;
+// Burn CPU for a few slices so preemption and work stealing get exercised
+static void sched_test_spin(void* arg) {
+    udelay(30000);
+    KDEBUG("TEST", "Spinner %u finished on CPU %u", (uint32_t)arg, cpu_id());
 }
 
-uint16_t vga_entry(unsigned char uc, uint8_t color) {
-    return (uint16_t) uc | (uint16_t) color << 8;
+static void sched_test_report(void* arg) {
+    thread_sleep(500 * NSEC_PER_MSEC);
+    sched_dump_stats();
+    softirq_dump_stats();
+    async_dump_stats();
+    keyboard_dump_stats();
+    fpu_dump_stats();
+    profile_dump_stats();
+    trace_dump_stats();
 }
 
-size_t strlen(const char* str) {
-    size_t len = 0;
-    while (str[len])
-        len++;
-    return len;
+// x87 arithmetic in two threads at once, so their registers get switched
+static void fpu_test(void* arg) {
+    double x = (uint32_t)arg;
+
+    for (int i = 0; i < 100000; i++) {
+        x = x * 1.00001 + 0.5;
+    }
+    KDEBUG("TEST", "FPU thread %u on CPU %u: %u", (uint32_t)arg, cpu_id(), (uint32_t)x);
 }
 
-static const size_t VGA_WIDTH = 80;
-static const size_t VGA_HEIGHT = 25;
-
-size_t terminal_row;
-size_t terminal_column;
-uint8_t terminal_color;
-uint16_t* terminal_buffer;
-
-void terminal_initialize(void) {
-    terminal_row = 0;
-    terminal_column = 0;
-    terminal_color = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-    terminal_buffer = (uint16_t*) 0xB8000;
-    for (size_t y = 0; y < VGA_HEIGHT; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            const size_t index = y * VGA_WIDTH + x;
-            terminal_buffer[index] = vga_entry(' ', terminal_color);
+// Log what is typed, from thread context
+static void keyboard_echo(void* arg) {
+    struct key_event ev;
+
+    for (;;) {
+        keyboard_read(&ev);
+        if (ev.released) {
+            continue;
+        }
+        if (ev.keycode == KEY_F9) {
+            profile_dump();
+            continue;
+        }
+        if (ev.ascii >= ' ') {
+            KINFO("KBD", "Key '%c' (keycode 0x%x)", ev.ascii, ev.keycode);
+        } else {
+            KDEBUG("KBD", "Key 0x%x, modifiers 0x%x", ev.keycode, ev.modifiers);
         }
     }
 }
 
-void terminal_setcolor(uint8_t color) {
-    terminal_color = color;
-}
+// Wait on the timer wheel a few times without a stack of its own
+struct async_test {
+    struct task task;
+    struct timer timer;
+    uint32_t ticks;
+};
 
-void terminal_putentryat(char c, uint8_t color, size_t x, size_t y) {
-    const size_t index = y * VGA_WIDTH + x;
-    terminal_buffer[index] = vga_entry(c, color);
-}
+static struct async_test async_test;
 
-void terminal_scroll(void) {
-    // Move all lines up by one
-    for (size_t y = 0; y < VGA_HEIGHT - 1; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            size_t src_index = (y + 1) * VGA_WIDTH + x;
-            size_t dst_index = y * VGA_WIDTH + x;
-            terminal_buffer[dst_index] = terminal_buffer[src_index];
-        }
-    }
-    
-    // Clear the last line
-    for (size_t x = 0; x < VGA_WIDTH; x++) {
-        const size_t index = (VGA_HEIGHT - 1) * VGA_WIDTH + x;
-        terminal_buffer[index] = vga_entry(' ', terminal_color);
+static int async_test_poll(struct task* t) {
+    struct async_test* a = t->data;
+
+    ASYNC_BEGIN(t);
+    for (a->ticks = 0; a->ticks < 3; a->ticks++) {
+        async_timer_start(&a->timer, t, 100 * NSEC_PER_MSEC);
+        ASYNC_AWAIT(t, !timer_pending(&a->timer));
+        KDEBUG("TEST", "Async tick %u on CPU %u", a->ticks, cpu_id());
     }
+    ASYNC_END(t);
 }
 
-void terminal_putchar(char c) {
-    if (c == '\n') {
-        terminal_column = 0;
-        if (++terminal_row == VGA_HEIGHT) {
-            terminal_scroll();
-            terminal_row = VGA_HEIGHT - 1;
-        }
-        return;
-    }
-    
-    terminal_putentryat(c, terminal_color, terminal_column, terminal_row);
-    if (++terminal_column == VGA_WIDTH) {
-        terminal_column = 0;
-        if (++terminal_row == VGA_HEIGHT) {
-            terminal_scroll();
-            terminal_row = VGA_HEIGHT - 1;
-        }
+// Set by kernel_init() when booted with "boottime" (make boottime)
+static int kernel_boottime_exit;
+
+// Let everything logged so far reach COM1, then end the emulator with exit
+// code arg
+static void kernel_exit(void* arg) {
+    klog_sync();
+    while (serial_pending(SERIAL_COM1)) {
+        serial_flush(SERIAL_COM1);
+        thread_sleep(NSEC_PER_MSEC);
     }
+    qemu_exit((uint32_t)arg);
+}
+
+// Booted with "trace" (make trace): let the system run for the window, then
+// hand the rings to the host
+static void trace_window(void* arg) {
+    thread_sleep(TRACE_WINDOW_MS * NSEC_PER_MSEC);
+    trace_stop();
+    trace_dump();
+    kernel_exit(NULL);
 }
 
-void terminal_write(const char* data, size_t size) {
-    for (size_t i = 0; i < size; i++)
-        terminal_putchar(data[i]);
+// Booted with "selftest" (make selftest): check and time the string
+// primitives, check demand-zero memory, dump the statistics the exercisers
+// ran up, and report through the exit code
+static void selftest(void* arg) {
+    int failures = string_selftest();
+    failures += vmm_selftest();
+    string_benchmark();
+    sched_test_report(NULL);
+    kernel_exit((void*)(failures ? 1 : 0));
 }
 
-void terminal_writestring(const char* data) {
-    terminal_write(data, strlen(data));
+// The Multiboot command line, if any. Runs before the magic is checked.
+static const char* __init kernel_cmdline(uint32_t magic, uint32_t mbi_phys) {
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC) {
+        return NULL;
+    }
+    // boot.s maps the first 16 MiB, which is where loaders put these
+    struct multiboot_info* mbi = phys_to_virt(mbi_phys);
+    return (mbi->flags & MULTIBOOT_INFO_CMDLINE) ? phys_to_virt(mbi->cmdline) : NULL;
 }
 
-void kernel_main(void) {
-    terminal_initialize();
-    klog_init();
-    gdt_init();
-    idt_init();
-    pic_init();
+// Run one initialization step as a trace span named after it, and time it
+// for the boot time breakdown
+#define BOOT_STAGE(fn, ...) do {                \
+        uint64_t __stage_start = rdtsc();       \
+        TRACE_BEGIN(#fn, 0);                    \
+        fn(__VA_ARGS__);                        \
+        TRACE_END(#fn, 0);                      \
+        boottime_stage(#fn, __stage_start);     \
+    } while (0)
+
+// Everything that runs exactly once at boot. Lives in .init and is freed
+// by kernel_main() when it returns.
+static void __init kernel_init(uint32_t magic, uint32_t mbi_phys) {
+    const char* cmdline = kernel_cmdline(magic, mbi_phys);
+
+    BOOT_STAGE(terminal_initialize);
+    BOOT_STAGE(klog_init);
+    BOOT_STAGE(gdt_init);
+    // cpu_id() works from here on, which is all tracing needs
+    trace_init(cmdline);
+    kernel_boottime_exit = cmdline && strword(cmdline, "boottime");
+    BOOT_STAGE(idt_init);
+    BOOT_STAGE(exceptions_init);
+    BOOT_STAGE(pic_init);
+    BOOT_STAGE(clock_init);
+    BOOT_STAGE(timer_init);
+    BOOT_STAGE(serial_init);
+    BOOT_STAGE(keyboard_init);
+
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC) {
+        KPANIC("BOOT", "Not loaded by a Multiboot bootloader (magic 0x%x)", magic);
+    }
+    // boot.s maps the first 16 MiB, which is where loaders put this structure
+    struct multiboot_info* mbi = phys_to_virt(mbi_phys);
+    BOOT_STAGE(paging_init, mbi);
+    BOOT_STAGE(pmm_init, mbi);
+    BOOT_STAGE(kmem_init);
+    BOOT_STAGE(sched_init);
+    BOOT_STAGE(softirq_init);
+    BOOT_STAGE(fpu_init);
+    BOOT_STAGE(apic_init);
+    BOOT_STAGE(profile_init);
+    BOOT_STAGE(smp_init);
 
-    KINFO("BOOT", "Glasgow kernel starting up...");
-    KINFO("VGA", "Text mode initialized successfully");
-    KINFO("MEM", "Stack configured at %x", (unsigned int)&terminal_row);
+    KINFO_INIT("BOOT", "Glasgow kernel starting up...");
+    KINFO_INIT("VGA", "Text mode initialized successfully");
+    KINFO_INIT("MEM", "Stack configured at %x", (unsigned int)&terminal_row);
     
-    KDEBUG("TEST", "This is a debug message");
-    KINFO("TEST", "This is an info message");  
+    KDEBUG_INIT("TEST", "This is a debug message");
+    KINFO_INIT("TEST", "This is an info message");  
     KWARN("TEST", "This is a warning message");
     KERROR("TEST", "This is an error message");
-        
+
+    // Start running once kernel_main() settles into the idle loop
+    thread_create("kbd-echo", keyboard_echo, NULL, SCHED_PRIO_DEFAULT);
+    if (trace_active) {
+        thread_create("trace-window", trace_window, NULL, SCHED_PRIO_DEFAULT);
+    }
+
+    // The exercisers burn CPU and would skew boot time and trace numbers,
+    // so only a self-test boot gets them
+    if (cmdline && strword(cmdline, "selftest")) {
+        thread_create("selftest", selftest, NULL, SCHED_PRIO_DEFAULT);
+        for (uint32_t i = 0; i < 4; i++) {
+            thread_create("spin-test", sched_test_spin, (void*)i, SCHED_PRIO_DEFAULT);
+        }
+        thread_create("fpu-test", fpu_test, (void*)1, SCHED_PRIO_DEFAULT);
+        thread_create("fpu-test", fpu_test, (void*)2, SCHED_PRIO_DEFAULT);
+        task_init(&async_test.task, async_test_poll, &async_test);
+        task_spawn(&async_test.task);
+    }
+}
+
+void kernel_main(uint32_t magic, uint32_t mbi_phys) {
+    boottime_stage("_start", boot_tsc);
+    kernel_init(magic, mbi_phys);
+
+    // Let the queued boot messages reach the console before writing to it directly
+    klog_flush();
+
     terminal_setcolor(vga_entry_color(VGA_COLOR_GREEN, VGA_COLOR_BLACK));
     kprintf("\nKernel Status: RUNNING\n");
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
     
     KINFO("BOOT", "Kernel initialization complete");
+    // Queued records may still point at format strings in .init
+    BOOT_STAGE(klog_sync);
+    BOOT_STAGE(pmm_free_initmem);
+    pmm_dump_stats();
+    kmem_dump_stats();
+    timer_dump_stats();
+    vmm_dump_regions();
+    boottime_report();
+    if (kernel_boottime_exit) {
+        thread_create("boottime-exit", kernel_exit, NULL, SCHED_PRIO_DEFAULT);
+    }
             
     KINFO("CPU", "Enabling interrupts...");
     __asm__ volatile ("sti");
     KINFO("CPU", "Interrupts enabled - kernel ready!");
 }
+
+// Called from boot.s once kernel_main() returns, and by every AP once it is
+// up; each CPU's boot context becomes its idle thread. Log output queued by
+// interrupt handlers is drained here, outside of interrupt context, and
+// ready async tasks are polled before the CPU halts.
+void cpu_idle(void) {
+    for (;;) {
+        klog_flush();
+        async_run();
+        sched_idle();
+    }
+}
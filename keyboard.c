@@ -0,0 +1,279 @@
+#include "keyboard.h"
+#include "irq.h"
+#include "irqchip.h"
+#include "pic.h"
+#include "softirq.h"
+#include "sched.h"
+#include "smp.h"
+#include "io.h"
+#include "cpu.h"
+#include "klog.h"
+
+#define KBD_RAW_RING_MASK       (KBD_RAW_RING_SIZE - 1)
+#define KBD_EVENT_RING_MASK     (KBD_EVENT_RING_SIZE - 1)
+
+#define KBD_PREFIX_EXTENDED     0xE0
+#define KBD_PREFIX_PAUSE        0xE1    // Pause sends E1 1D 45 E1 9D C5, no break
+#define KBD_PAUSE_LENGTH        5
+#define KBD_BREAK               0x80
+
+// Printable keys, indexed by make code up to the space bar
+#define KBD_MAP_SIZE            0x3A
+
+static const char kbd_map[KBD_MAP_SIZE] =
+    "\0\0331234567890-=\b\tqwertyuiop[]\n\0asdfghjkl;'`\0\\zxcvbnm,./\0*\0 ";
+static const char kbd_map_shift[KBD_MAP_SIZE] =
+    "\0\033!@#$%^&*()_+\b\tQWERTYUIOP{}\n\0ASDFGHJKL:\"~\0|ZXCVBNM<>?\0*\0 ";
+
+// Keypad 0x47-0x53; only - and + do not depend on num lock
+#define KBD_KEYPAD_FIRST        0x47
+#define KBD_KEYPAD_LAST         0x53
+static const char kbd_keypad[] = "789-456+1230.";
+
+// Held modifier keys, left and right separately
+#define KBD_HELD_LSHIFT         0x01
+#define KBD_HELD_RSHIFT         0x02
+#define KBD_HELD_LCTRL          0x04
+#define KBD_HELD_RCTRL          0x08
+#define KBD_HELD_LALT           0x10
+#define KBD_HELD_RALT           0x20
+
+// Raw bytes: written by the IRQ handler, read by the softirq. Both run on
+// the CPU the IRQ is routed to.
+static uint8_t kbd_raw[KBD_RAW_RING_SIZE];
+static volatile uint32_t kbd_raw_head;
+static volatile uint32_t kbd_raw_tail;
+
+// Decoded events: written by the softirq, read by one thread
+static struct key_event kbd_events[KBD_EVENT_RING_SIZE];
+static volatile uint32_t kbd_event_head;
+static volatile uint32_t kbd_event_tail;
+static struct thread* volatile kbd_reader;
+
+// Decoder state, softirq only
+static uint8_t kbd_extended;
+static uint8_t kbd_skip;
+static uint8_t kbd_held;
+static uint8_t kbd_locks;
+
+static struct keyboard_stats kbd_stats;
+
+// Top half: move the byte off the controller and leave
+static void keyboard_irq(struct interrupt_frame* frame, void* ctx) {
+    uint8_t scancode = inb(KBD_DATA_PORT);
+    uint32_t head = kbd_raw_head;
+
+    kbd_stats.scancodes++;
+    if (head - __atomic_load_n(&kbd_raw_tail, __ATOMIC_ACQUIRE) >= KBD_RAW_RING_SIZE) {
+        kbd_stats.raw_dropped++;
+        return;
+    }
+    kbd_raw[head & KBD_RAW_RING_MASK] = scancode;
+    __atomic_store_n(&kbd_raw_head, head + 1, __ATOMIC_RELEASE);
+    raise_softirq(SOFTIRQ_INPUT);
+}
+
+static uint8_t kbd_modifiers(void) {
+    uint8_t mods = kbd_locks;
+
+    if (kbd_held & (KBD_HELD_LSHIFT | KBD_HELD_RSHIFT)) {
+        mods |= KBD_MOD_SHIFT;
+    }
+    if (kbd_held & (KBD_HELD_LCTRL | KBD_HELD_RCTRL)) {
+        mods |= KBD_MOD_CTRL;
+    }
+    if (kbd_held & (KBD_HELD_LALT | KBD_HELD_RALT)) {
+        mods |= KBD_MOD_ALT;
+    }
+    return mods;
+}
+
+static char kbd_translate(uint8_t keycode, uint8_t mods) {
+    if (keycode == KEY_KP_ENTER) {
+        return '\n';
+    }
+    if (keycode == KEY_KP_SLASH) {
+        return '/';
+    }
+    if (keycode & KEY_EXTENDED) {
+        return 0;
+    }
+
+    if (keycode >= KBD_KEYPAD_FIRST && keycode <= KBD_KEYPAD_LAST) {
+        char c = kbd_keypad[keycode - KBD_KEYPAD_FIRST];
+        return (mods & KBD_MOD_NUMLOCK) || c == '-' || c == '+' ? c : 0;
+    }
+    if (keycode >= KBD_MAP_SIZE) {
+        return 0;
+    }
+
+    char c = (mods & KBD_MOD_SHIFT) ? kbd_map_shift[keycode] : kbd_map[keycode];
+    int letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    if (letter && (mods & KBD_MOD_CAPSLOCK)) {
+        c ^= 0x20;
+    }
+    if (letter && (mods & KBD_MOD_CTRL)) {
+        c &= 0x1F;
+    }
+    return c;
+}
+
+static void kbd_update_modifiers(uint8_t keycode, int released) {
+    uint8_t held = 0;
+
+    switch (keycode) {
+        case KEY_LSHIFT: held = KBD_HELD_LSHIFT; break;
+        case KEY_RSHIFT: held = KBD_HELD_RSHIFT; break;
+        case KEY_LCTRL:  held = KBD_HELD_LCTRL;  break;
+        case KEY_RCTRL:  held = KBD_HELD_RCTRL;  break;
+        case KEY_LALT:   held = KBD_HELD_LALT;   break;
+        case KEY_RALT:   held = KBD_HELD_RALT;   break;
+        case KEY_CAPSLOCK:
+            if (!released) {
+                kbd_locks ^= KBD_MOD_CAPSLOCK;
+            }
+            return;
+        case KEY_NUMLOCK:
+            if (!released) {
+                kbd_locks ^= KBD_MOD_NUMLOCK;
+            }
+            return;
+        default:
+            return;
+    }
+
+    if (released) {
+        kbd_held &= ~held;
+    } else {
+        kbd_held |= held;
+    }
+}
+
+static int kbd_push(const struct key_event* ev) {
+    uint32_t head = kbd_event_head;
+
+    if (head - __atomic_load_n(&kbd_event_tail, __ATOMIC_ACQUIRE) >= KBD_EVENT_RING_SIZE) {
+        kbd_stats.events_dropped++;
+        return 0;
+    }
+    kbd_events[head & KBD_EVENT_RING_MASK] = *ev;
+    __atomic_store_n(&kbd_event_head, head + 1, __ATOMIC_RELEASE);
+    kbd_stats.events++;
+    return 1;
+}
+
+// Turn one scancode byte into at most one event. Returns 1 if it queued one.
+static int kbd_decode(uint8_t scancode) {
+    if (kbd_skip) {
+        kbd_skip--;
+        return 0;
+    }
+    if (scancode == KBD_PREFIX_PAUSE) {
+        kbd_skip = KBD_PAUSE_LENGTH;
+        return 0;
+    }
+    if (scancode == KBD_PREFIX_EXTENDED) {
+        kbd_extended = 1;
+        return 0;
+    }
+
+    int released = scancode & KBD_BREAK;
+    uint8_t code = scancode & ~KBD_BREAK;
+    uint8_t keycode = code;
+
+    if (kbd_extended) {
+        kbd_extended = 0;
+        // Print Screen and the navigation keys wrap themselves in fake
+        // shift presses for the benefit of old software
+        if (code == KEY_LSHIFT || code == KEY_RSHIFT) {
+            return 0;
+        }
+        keycode |= KEY_EXTENDED;
+    } else if (!code || code > KEY_F12) {
+        // Controller acknowledgements and error bytes land here too
+        kbd_stats.unknown++;
+        return 0;
+    }
+
+    kbd_update_modifiers(keycode, released);
+
+    struct key_event ev = {
+        .keycode = keycode,
+        .modifiers = kbd_modifiers(),
+        .released = released != 0,
+    };
+    ev.ascii = kbd_translate(keycode, ev.modifiers);
+    return kbd_push(&ev);
+}
+
+// Bottom half: decode everything the IRQ handler buffered
+static void keyboard_softirq(void) {
+    uint32_t tail = kbd_raw_tail;
+    uint32_t head = __atomic_load_n(&kbd_raw_head, __ATOMIC_ACQUIRE);
+    int queued = 0;
+
+    while (tail != head) {
+        queued |= kbd_decode(kbd_raw[tail & KBD_RAW_RING_MASK]);
+        tail++;
+    }
+    __atomic_store_n(&kbd_raw_tail, tail, __ATOMIC_RELEASE);
+
+    if (queued) {
+        // Pairs with keyboard_read(): the new head is visible before the
+        // reader is looked at
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        struct thread* reader = __atomic_load_n(&kbd_reader, __ATOMIC_SEQ_CST);
+        if (reader) {
+            thread_wake(reader);
+        }
+    }
+}
+
+int keyboard_poll(struct key_event* ev) {
+    uint32_t tail = kbd_event_tail;
+
+    if (tail == __atomic_load_n(&kbd_event_head, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    *ev = kbd_events[tail & KBD_EVENT_RING_MASK];
+    __atomic_store_n(&kbd_event_tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void keyboard_read(struct key_event* ev) {
+    // Announce the wait before the last check, so an event queued in
+    // between finds the reader and its wakeup is remembered
+    while (!keyboard_poll(ev)) {
+        __atomic_store_n(&kbd_reader, current_thread(), __ATOMIC_SEQ_CST);
+        if (keyboard_poll(ev)) {
+            break;
+        }
+        thread_block();
+    }
+    __atomic_store_n(&kbd_reader, NULL, __ATOMIC_SEQ_CST);
+}
+
+void __init keyboard_init(void) {
+    // Whatever was typed before now belongs to the bootloader
+    for (int i = 0; i < KBD_RAW_RING_SIZE && (inb(KBD_STATUS_PORT) & KBD_STATUS_OUTPUT_FULL); i++) {
+        (void)inb(KBD_DATA_PORT);
+    }
+
+    open_softirq(SOFTIRQ_INPUT, keyboard_softirq);
+    request_irq(IRQ_KEYBOARD, keyboard_irq, NULL);
+    irq_clear_mask(IRQ_KEYBOARD - IRQ_BASE);
+    KINFO_INIT("KBD", "PS/2 keyboard, scancode set 1, %d event buffer", KBD_EVENT_RING_SIZE);
+}
+
+void keyboard_get_stats(struct keyboard_stats* stats) {
+    *stats = kbd_stats;
+}
+
+void keyboard_dump_stats(void) {
+    struct keyboard_stats stats;
+    keyboard_get_stats(&stats);
+
+    KINFO("KBD", "%u scancodes, %u events, %u unknown, %u raw dropped, %u events dropped",
+          stats.scancodes, stats.events, stats.unknown, stats.raw_dropped,
+          stats.events_dropped);
+}
@@ -0,0 +1,87 @@
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+#include <stdint.h>
+
+// i8042 controller ports
+#define KBD_DATA_PORT           0x60
+#define KBD_STATUS_PORT         0x64
+#define KBD_STATUS_OUTPUT_FULL  0x01
+
+// Raw scancode bytes buffered between the IRQ and the softirq, and decoded
+// events buffered for the reader. Both powers of two.
+#define KBD_RAW_RING_SIZE       64
+#define KBD_EVENT_RING_SIZE     128
+
+// Keycodes are the scancode set 1 make code, with bit 7 set for keys that
+// come after an 0xE0 prefix. Only the ones without a character are named.
+#define KEY_ESC                 0x01
+#define KEY_BACKSPACE           0x0E
+#define KEY_TAB                 0x0F
+#define KEY_ENTER               0x1C
+#define KEY_LCTRL               0x1D
+#define KEY_LSHIFT              0x2A
+#define KEY_RSHIFT              0x36
+#define KEY_LALT                0x38
+#define KEY_CAPSLOCK            0x3A
+#define KEY_F1                  0x3B    // F1-F10 are consecutive
+#define KEY_F9                  0x43
+#define KEY_F10                 0x44
+#define KEY_NUMLOCK             0x45
+#define KEY_SCROLLLOCK          0x46
+#define KEY_F11                 0x57
+#define KEY_F12                 0x58
+#define KEY_EXTENDED            0x80
+#define KEY_KP_ENTER            (KEY_EXTENDED | 0x1C)
+#define KEY_RCTRL               (KEY_EXTENDED | 0x1D)
+#define KEY_KP_SLASH            (KEY_EXTENDED | 0x35)
+#define KEY_RALT                (KEY_EXTENDED | 0x38)
+#define KEY_HOME                (KEY_EXTENDED | 0x47)
+#define KEY_UP                  (KEY_EXTENDED | 0x48)
+#define KEY_PAGEUP              (KEY_EXTENDED | 0x49)
+#define KEY_LEFT                (KEY_EXTENDED | 0x4B)
+#define KEY_RIGHT               (KEY_EXTENDED | 0x4D)
+#define KEY_END                 (KEY_EXTENDED | 0x4F)
+#define KEY_DOWN                (KEY_EXTENDED | 0x50)
+#define KEY_PAGEDOWN            (KEY_EXTENDED | 0x51)
+#define KEY_INSERT              (KEY_EXTENDED | 0x52)
+#define KEY_DELETE              (KEY_EXTENDED | 0x53)
+#define KEY_LGUI                (KEY_EXTENDED | 0x5B)
+#define KEY_RGUI                (KEY_EXTENDED | 0x5C)
+
+// Modifier state at the time of the event
+#define KBD_MOD_SHIFT           0x01
+#define KBD_MOD_CTRL            0x02
+#define KBD_MOD_ALT             0x04
+#define KBD_MOD_CAPSLOCK        0x08
+#define KBD_MOD_NUMLOCK         0x10
+
+struct key_event {
+    uint8_t keycode;
+    char ascii;                 // 0 for keys without a character
+    uint8_t modifiers;
+    uint8_t released;
+};
+
+struct keyboard_stats {
+    uint32_t scancodes;         // Bytes read from the controller
+    uint32_t events;            // Events queued for the reader
+    uint32_t raw_dropped;       // Scancodes lost to a full raw ring
+    uint32_t events_dropped;    // Events lost to a full event ring
+    uint32_t unknown;           // Scancodes with no keycode
+};
+
+// Claim IRQ 1 and the input softirq, and empty the controller
+void keyboard_init(void);
+
+// Take the next event without waiting. Returns 0 if there is none.
+int keyboard_poll(struct key_event* ev);
+
+// Wait for the next event. There is one consumer: only one thread at a
+// time may read.
+void keyboard_read(struct key_event* ev);
+
+void keyboard_get_stats(struct keyboard_stats* stats);
+void keyboard_dump_stats(void);
+
+#endif // KEYBOARD_H
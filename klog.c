@@ -1,8 +1,25 @@
 #include "klog.h"
 #include "vga.h"
+#include "string.h"
+#include "cpu.h"
+#include "clock.h"
+#include "spinlock.h"
+
+#define KLOG_RING_MASK  (KLOG_RING_SIZE - 1)
 
 static log_level_t min_log_level = LOG_DEBUG;
 
+// Subsystems with a level of their own. Written under klog_level_lock;
+// klog() itself only ever looks at the per-site flag.
+struct klog_subsystem_level {
+    const char* name;
+    log_level_t level;
+};
+
+static struct klog_subsystem_level klog_subsystem_levels[KLOG_MAX_SUBSYSTEMS];
+static int klog_subsystem_count;
+static spinlock_t klog_level_lock = SPINLOCK_INIT;
+
 static const char* log_level_names[] = {
     "DEBUG", "INFO ", "WARN ", "ERROR", "PANIC"
 };
@@ -10,65 +27,415 @@ static const char* log_level_names[] = {
 static const uint8_t log_level_colors[] = {
     8,  // DEBUG - Dark grey
     7,  // INFO  - Light grey
-    14, // WARN  - Yellow  
+    14, // WARN  - Yellow
     12, // ERROR - Light red
     15  // PANIC - White
 };
 
-void klog_init(void) {
-    KINFO("KLOG", "Kernel logging system initialized");
-}
+// Lock-free multi-producer ring. Each slot carries a turn counter: a slot is
+// free for position pos when turn == lap(pos), holds a published record when
+// turn == lap(pos) + 1, and is handed back by the consumer by advancing turn
+// to the next lap. A zeroed ring is therefore a valid empty ring.
+struct klog_slot {
+    volatile uint32_t turn;
+    struct klog_record rec;
+};
 
-void klog_set_level(log_level_t level) {
-    min_log_level = level;
-    KINFO("KLOG", "Log level set to %s", log_level_names[level]);
+static struct klog_slot klog_ring[KLOG_RING_SIZE];
+static volatile uint32_t klog_head;     // Next position to reserve
+static uint32_t klog_tail;              // Next position to drain
+static volatile int klog_draining;
+static volatile int klog_panic_mode;
+
+static struct klog_stats klog_stats;
+static uint32_t klog_reported_drops;
+
+static const struct klog_sink* klog_sinks[KLOG_MAX_SINKS];
+static int klog_sink_count;
+
+// Reported by the drain itself, which has no call site of its own
+static struct klog_site klog_drop_site __klog_site = {
+    .format = "%u records dropped (ring full)",
+    .subsystem = "KLOG",
+    .level = LOG_WARN,
+};
+
+static void klog_scan(struct klog_site* site);
+
+static inline uint32_t klog_lap(uint32_t pos) {
+    return pos & ~KLOG_RING_MASK;
 }
 
-void klog(log_level_t level, const char* subsystem, const char* format, ...) {
-    if (level < min_log_level) {
-        return;
-    }
-    
+static void klog_console_write(const struct klog_record* rec, const char* msg, size_t len) {
+    uint8_t level = rec->site->level;
+
     if (level == LOG_PANIC) {
         terminal_setcolor(vga_entry_color(15, 4));
     } else {
         terminal_setcolor(vga_entry_color(log_level_colors[level], 0));
     }
-    
+
     terminal_writestring("[");
-    terminal_writestring(log_level_names[level]);
+    terminal_writestring(klog_level_name(level));
     terminal_writestring("] ");
-    terminal_writestring(subsystem);
+    terminal_writestring(rec->site->subsystem);
     terminal_writestring(": ");
-    
-    va_list args;
-    va_start(args, format);
-    kvprintf(format, args);
-    va_end(args);
-    
+    terminal_write(msg, len);
     terminal_putchar('\n');
 
     terminal_setcolor(vga_entry_color(7, 0));
-    
+}
+
+static const struct klog_sink klog_console_sink = {
+    .name = "console",
+    .write = klog_console_write,
+    .flush = terminal_flush,
+    .puts = terminal_writestring,
+};
+
+void __init klog_init(void) {
+    klog_register_sink(&klog_console_sink);
+    KINFO_INIT("KLOG", "Kernel logging system initialized (%d-entry ring)", KLOG_RING_SIZE);
+}
+
+static log_level_t klog_level_of(const char* subsystem) {
+    for (int i = 0; i < klog_subsystem_count; i++) {
+        if (!strcmp(klog_subsystem_levels[i].name, subsystem)) {
+            return klog_subsystem_levels[i].level;
+        }
+    }
+    return min_log_level;
+}
+
+// Recompute the enabled flag of every site logging under subsystem, or of
+// all sites if subsystem is NULL
+static void klog_update_sites(const char* subsystem) {
+    for (struct klog_site* site = __klog_sites_start; site < __klog_sites_end; site++) {
+        if (subsystem && strcmp(site->subsystem, subsystem)) {
+            continue;
+        }
+        // Panics halt inside klog(), so their sites are never skipped
+        if (site->level != LOG_PANIC && site->level < klog_level_of(site->subsystem)) {
+            __atomic_fetch_or(&site->flags, KLOG_SITE_DISABLED, __ATOMIC_RELAXED);
+        } else {
+            __atomic_fetch_and(&site->flags, ~KLOG_SITE_DISABLED, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+int klog_set_level(log_level_t level) {
+    if ((uint32_t)level > LOG_PANIC) {
+        KERROR("KLOG", "Invalid log level %u", level);
+        return -1;
+    }
+
+    spin_lock(&klog_level_lock);
+    min_log_level = level;
+    klog_update_sites(NULL);
+    spin_unlock(&klog_level_lock);
+
+    KINFO("KLOG", "Log level set to %s", log_level_names[level]);
+    return 0;
+}
+
+int klog_set_subsystem_level(const char* subsystem, log_level_t level) {
+    if ((uint32_t)level > LOG_PANIC) {
+        KERROR("KLOG", "Invalid log level %u for %s", level, subsystem);
+        return -1;
+    }
+
+    spin_lock(&klog_level_lock);
+
+    int i;
+    for (i = 0; i < klog_subsystem_count; i++) {
+        if (!strcmp(klog_subsystem_levels[i].name, subsystem)) {
+            break;
+        }
+    }
+    if (i == KLOG_MAX_SUBSYSTEMS) {
+        spin_unlock(&klog_level_lock);
+        KERROR("KLOG", "Too many subsystem levels, ignoring %s", subsystem);
+        return -1;
+    }
+    if (i == klog_subsystem_count) {
+        klog_subsystem_levels[i].name = subsystem;
+        klog_subsystem_count++;
+    }
+    klog_subsystem_levels[i].level = level;
+    klog_update_sites(subsystem);
+
+    spin_unlock(&klog_level_lock);
+
+    KINFO("KLOG", "Log level of %s set to %s", subsystem, log_level_names[level]);
+    return 0;
+}
+
+int klog_register_sink(const struct klog_sink* sink) {
+    if (klog_sink_count >= KLOG_MAX_SINKS) {
+        KERROR("KLOG", "Too many log sinks, ignoring %s", sink->name);
+        return -1;
+    }
+    klog_sinks[klog_sink_count++] = sink;
+    return 0;
+}
+
+void klog_get_stats(struct klog_stats* stats) {
+    *stats = klog_stats;
+}
+
+const char* klog_level_name(log_level_t level) {
+    return (uint32_t)level <= LOG_PANIC ? log_level_names[level] : "?????";
+}
+
+size_t klog_format_time(char* buf, uint64_t ns) {
+    uint32_t sec = ns / NSEC_PER_SEC;
+    uint32_t usec = (ns % NSEC_PER_SEC) / NSEC_PER_USEC;
+    size_t n = 0;
+
+    buf[n++] = '[';
+    for (uint32_t div = 10000; div; div /= 10) {
+        buf[n++] = (sec >= div || div == 1) ? '0' + (sec / div) % 10 : ' ';
+    }
+    buf[n++] = '.';
+    for (uint32_t div = 100000; div; div /= 10) {
+        buf[n++] = '0' + (usec / div) % 10;
+    }
+    buf[n++] = ']';
+    buf[n++] = ' ';
+    return n;
+}
+
+int klog_in_panic(void) {
+    return klog_panic_mode;
+}
+
+uint64_t klog_record_time(const struct klog_record* rec) {
+    // Records from before clock_init() count as time zero
+    if (rec->tsc < clock_data.tsc_base) {
+        return 0;
+    }
+    return clock_cycles_to_ns(rec->tsc - clock_data.tsc_base);
+}
+
+// Copy the raw arguments: words as they are, strings after them. Nothing is
+// formatted here; that waits for the drain.
+static void klog_capture(struct klog_record* rec, struct klog_site* site, va_list args) {
+    uint8_t* data = (uint8_t*)rec->data;
+    size_t pos = site->words * sizeof(uint32_t);
+    uint32_t* word = rec->data;
+
+    rec->tsc = rdtsc();
+    rec->site = site;
+
+    for (uint32_t kinds = site->args; kinds; kinds >>= 2) {
+        switch (kinds & 3) {
+            case KLOG_ARG_WORD:
+                *word++ = va_arg(args, uint32_t);
+                break;
+            case KLOG_ARG_DWORD: {
+                uint64_t value = va_arg(args, uint64_t);
+                *word++ = (uint32_t)value;
+                *word++ = (uint32_t)(value >> 32);
+                break;
+            }
+            case KLOG_ARG_STRING: {
+                const char* str = va_arg(args, const char*);
+                if (!str || pos >= KLOG_DATA_SIZE) {
+                    // Renders as "(null)"
+                    if (str) {
+                        __atomic_fetch_add(&klog_stats.truncated, 1, __ATOMIC_RELAXED);
+                    }
+                    *word++ = KLOG_DATA_SIZE;
+                    break;
+                }
+                size_t room = KLOG_DATA_SIZE - 1 - pos;
+                size_t len = strnlen(str, room + 1);
+                if (len > room) {
+                    __atomic_fetch_add(&klog_stats.truncated, 1, __ATOMIC_RELAXED);
+                    len = room;
+                }
+                memcpy(data + pos, str, len);
+                data[pos + len] = '\0';
+                *word++ = pos;
+                pos += len + 1;
+                break;
+            }
+        }
+    }
+    rec->size = pos;
+}
+
+static void klog_emit(const struct klog_record* rec) {
+    char msg[KLOG_MSG_MAX];
+    size_t len = klog_record_format(rec, msg, sizeof(msg));
+
+    for (int i = 0; i < klog_sink_count; i++) {
+        klog_sinks[i]->write(rec, msg, len);
+    }
+}
+
+static void klog_emit_flush(void) {
+    for (int i = 0; i < klog_sink_count; i++) {
+        if (klog_sinks[i]->flush) {
+            klog_sinks[i]->flush();
+        }
+    }
+}
+
+void klog(struct klog_site* site, ...) {
+    log_level_t level = site->level;
+
+    if (!(__atomic_load_n(&site->flags, __ATOMIC_ACQUIRE) & KLOG_SITE_SCANNED)) {
+        klog_scan(site);
+    }
+
+    va_list args;
+    va_start(args, site);
+
+    if (klog_panic_mode) {
+        // Nothing will ever drain the ring again; write straight through
+        struct klog_record rec;
+        klog_capture(&rec, site, args);
+        rec.seq = klog_head;
+        klog_emit(&rec);
+        klog_emit_flush();
+    } else {
+        uint32_t pos = __atomic_load_n(&klog_head, __ATOMIC_RELAXED);
+        struct klog_slot* slot = NULL;
+
+        for (;;) {
+            slot = &klog_ring[pos & KLOG_RING_MASK];
+            int32_t diff = (int32_t)(__atomic_load_n(&slot->turn, __ATOMIC_ACQUIRE) - klog_lap(pos));
+            if (diff == 0) {
+                if (__atomic_compare_exchange_n(&klog_head, &pos, pos + 1, 1,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // Ring is full: drop the new record rather than block
+                slot = NULL;
+                break;
+            } else {
+                pos = __atomic_load_n(&klog_head, __ATOMIC_RELAXED);
+            }
+        }
+
+        if (slot) {
+            klog_capture(&slot->rec, site, args);
+            slot->rec.seq = pos;
+            __atomic_store_n(&slot->turn, klog_lap(pos) + 1, __ATOMIC_RELEASE);
+            __atomic_fetch_add(&klog_stats.written, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_fetch_add(&klog_stats.dropped, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    va_end(args);
+
     if (level == LOG_PANIC) {
         kernel_panic("PANIC log message triggered");
     }
 }
 
-void kernel_panic(const char* message) {
+// Deliver every published record to the sinks. Stops at the first slot that
+// is reserved but not yet published, so records are always emitted in order.
+static void klog_drain(void) {
+    uint32_t delivered = 0;
+
+    while (delivered < KLOG_RING_SIZE) {
+        struct klog_slot* slot = &klog_ring[klog_tail & KLOG_RING_MASK];
+        if (__atomic_load_n(&slot->turn, __ATOMIC_ACQUIRE) != klog_lap(klog_tail) + 1) {
+            break;
+        }
+
+        klog_emit(&slot->rec);
+        __atomic_store_n(&slot->turn, klog_lap(klog_tail) + KLOG_RING_SIZE, __ATOMIC_RELEASE);
+        klog_tail++;
+        delivered++;
+    }
+
+    uint32_t dropped = __atomic_load_n(&klog_stats.dropped, __ATOMIC_RELAXED);
+    if (dropped != klog_reported_drops) {
+        if (!(klog_drop_site.flags & KLOG_SITE_SCANNED)) {
+            klog_scan(&klog_drop_site);
+        }
+        struct klog_record rec = {
+            .tsc = rdtsc(),
+            .seq = klog_tail,
+            .site = &klog_drop_site,
+            .size = sizeof(uint32_t),
+            .data = { dropped - klog_reported_drops },
+        };
+        klog_reported_drops = dropped;
+        klog_emit(&rec);
+        klog_emit_flush();
+    } else if (delivered) {
+        klog_emit_flush();
+    }
+    klog_stats.flushed += delivered;
+}
+
+void klog_flush(void) {
+    if (__atomic_exchange_n(&klog_draining, 1, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    klog_drain();
+    __atomic_store_n(&klog_draining, 0, __ATOMIC_RELEASE);
+}
+
+void klog_sync(void) {
+    uint32_t target = __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE);
+
+    for (;;) {
+        klog_flush();
+        if ((int32_t)(__atomic_load_n(&klog_tail, __ATOMIC_ACQUIRE) - target) >= 0) {
+            break;
+        }
+        // Stuck behind a reserved but unpublished slot, or another drain
+        cpu_relax();
+    }
+}
+
+void klog_panic_flush(void) {
     __asm__ volatile ("cli");
-    
+
+    if (klog_panic_mode) {
+        return;
+    }
+    klog_panic_mode = 1;
+
+    // We may have interrupted a drain in progress; take over regardless
+    klog_draining = 1;
+    klog_drain();
+}
+
+static void klog_puts_all(const char* str) {
+    for (int i = 0; i < klog_sink_count; i++) {
+        if (klog_sinks[i]->puts) {
+            klog_sinks[i]->puts(str);
+        }
+    }
+}
+
+void kernel_panic(const char* message) {
+    klog_panic_flush();
+
     terminal_setcolor(vga_entry_color(15, 4));
-    terminal_writestring("\n\n*** KERNEL PANIC ***\n");
-    terminal_writestring("System halted due to critical error:\n");
-    terminal_writestring(message);
-    terminal_writestring("\n\nSystem must be restarted.\n");
-    
+    klog_puts_all("\n\n*** KERNEL PANIC ***\n");
+    klog_puts_all("System halted due to critical error:\n");
+    klog_puts_all(message);
+    klog_puts_all("\n\nSystem must be restarted.\n");
+    klog_emit_flush();
+
     while (1) {
         __asm__ volatile ("hlt");
     }
 }
 
+static void kprintf_sink(void* ctx, const char* data, size_t len) {
+    terminal_write(data, len);
+}
+
 void kprintf(const char* format, ...) {
     va_list args;
     va_start(args, format);
@@ -77,113 +444,505 @@ void kprintf(const char* format, ...) {
 }
 
 void kvprintf(const char* format, va_list args) {
-    char buffer[512];
-    char* buf_ptr = buffer;
-    const char* fmt_ptr = format;
-    
-    while (*fmt_ptr) {
-        if (*fmt_ptr == '%') {
-            fmt_ptr++; // Skip the %
-            
-            switch (*fmt_ptr) {
-                case 's': { // String
-                    char* str = va_arg(args, char*);
-                    while (*str) {
-                        *buf_ptr++ = *str++;
-                    }
-                    break;
+    kvformat(kprintf_sink, NULL, format, args);
+    terminal_flush();
+}
+
+// Caller buffer for ksnprintf(): keeps the first size - 1 bytes
+struct kformat_buf {
+    char* buf;
+    size_t size;
+    size_t pos;
+};
+
+static void kformat_null_sink(void* ctx, const char* data, size_t len) {
+}
+
+static void kformat_buf_write(void* ctx, const char* data, size_t len) {
+    struct kformat_buf* b = ctx;
+
+    if (b->pos + 1 < b->size) {
+        size_t room = b->size - 1 - b->pos;
+        memcpy(b->buf + b->pos, data, len < room ? len : room);
+    }
+    b->pos += len;
+}
+
+size_t ksnprintf(char* buf, size_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t len = kvsnprintf(buf, size, format, args);
+    va_end(args);
+    return len;
+}
+
+size_t kvsnprintf(char* buf, size_t size, const char* format, va_list args) {
+    struct kformat_buf b = { .buf = buf, .size = size, .pos = 0 };
+    size_t len = kvformat(kformat_buf_write, &b, format, args);
+
+    if (size) {
+        buf[len < size ? len : size - 1] = '\0';
+    }
+    return len;
+}
+
+#define KFORMAT_LEFT    0x01    // '-': pad on the right
+#define KFORMAT_ZERO    0x02    // '0': pad numbers with zeros
+#define KFORMAT_PLUS    0x04    // '+': always print a sign
+#define KFORMAT_SPACE   0x08    // ' ': space in place of a plus sign
+#define KFORMAT_ALT     0x10    // '#': 0x prefix on hex
+
+// Enough for a 64-bit value in decimal
+#define KFORMAT_NUM_MAX 24
+
+struct kformat_spec {
+    uint8_t flags;
+    int width;
+    int precision;              // -1 if not given
+};
+
+// Two decimal digits per division
+static const char kformat_digit_pairs[200] = {
+    '0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+    '1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+    '2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+    '3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+    '4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+    '5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+    '6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+    '7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+    '8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+    '9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9',
+};
+
+static const char kformat_hex_lower[16] = "0123456789abcdef";
+static const char kformat_hex_upper[16] = "0123456789ABCDEF";
+
+static const char kformat_spaces[16] = "                ";
+static const char kformat_zeros[16]  = "0000000000000000";
+
+// Write value in decimal so that it ends at end; returns its first digit.
+// Only values above 32 bits pay for 64-bit division.
+static char* kformat_dec(char* end, uint64_t value) {
+    char* p = end;
+
+    while (value >> 32) {
+        uint64_t q = value / 100;
+        uint32_t r = (uint32_t)(value - q * 100);
+        p -= 2;
+        memcpy(p, &kformat_digit_pairs[r * 2], 2);
+        value = q;
+    }
+
+    uint32_t v = (uint32_t)value;
+    while (v >= 100) {
+        uint32_t q = v / 100;
+        uint32_t r = v - q * 100;
+        p -= 2;
+        memcpy(p, &kformat_digit_pairs[r * 2], 2);
+        v = q;
+    }
+    if (v >= 10) {
+        p -= 2;
+        memcpy(p, &kformat_digit_pairs[v * 2], 2);
+    } else {
+        *--p = '0' + v;
+    }
+    return p;
+}
+
+// Hex needs no division, only shifts
+static char* kformat_hex(char* end, uint64_t value, const char* digits) {
+    char* p = end;
+    uint32_t lo = (uint32_t)value;
+    uint32_t hi = (uint32_t)(value >> 32);
+
+    if (hi) {
+        for (int i = 0; i < 8; i++) {
+            *--p = digits[lo & 0xF];
+            lo >>= 4;
+        }
+        lo = hi;
+    }
+    do {
+        *--p = digits[lo & 0xF];
+        lo >>= 4;
+    } while (lo);
+    return p;
+}
+
+static void kformat_pad(kformat_sink_t sink, void* ctx, const char* fill, size_t count) {
+    while (count) {
+        size_t n = count < 16 ? count : 16;
+        sink(ctx, fill, n);
+        count -= n;
+    }
+}
+
+// Emit prefix, leading zeros and body as one field of at least spec->width
+// characters. Returns the field length.
+static size_t kformat_field(kformat_sink_t sink, void* ctx, const struct kformat_spec* spec,
+                            const char* prefix, size_t prefix_len, size_t zeros,
+                            const char* body, size_t len) {
+    size_t total = prefix_len + zeros + len;
+    size_t pad = (size_t)spec->width > total ? spec->width - total : 0;
+
+    if (!(spec->flags & KFORMAT_LEFT)) {
+        kformat_pad(sink, ctx, kformat_spaces, pad);
+    }
+    if (prefix_len) {
+        sink(ctx, prefix, prefix_len);
+    }
+    kformat_pad(sink, ctx, kformat_zeros, zeros);
+    if (len) {
+        sink(ctx, body, len);
+    }
+    if (spec->flags & KFORMAT_LEFT) {
+        kformat_pad(sink, ctx, kformat_spaces, pad);
+    }
+    return total + pad;
+}
+
+static size_t kformat_number(kformat_sink_t sink, void* ctx, struct kformat_spec* spec,
+                             uint64_t value, int negative, char conv) {
+    char num[KFORMAT_NUM_MAX];
+    char* end = num + sizeof(num);
+    char* digits;
+    const char* prefix = "";
+    size_t prefix_len = 0;
+
+    if (conv == 'x' || conv == 'X' || conv == 'p') {
+        digits = kformat_hex(end, value, conv == 'X' ? kformat_hex_upper : kformat_hex_lower);
+        if (conv == 'p' || ((spec->flags & KFORMAT_ALT) && value)) {
+            prefix = conv == 'X' ? "0X" : "0x";
+            prefix_len = 2;
+        }
+    } else {
+        digits = kformat_dec(end, value);
+        if (negative) {
+            prefix = "-";
+            prefix_len = 1;
+        } else if (spec->flags & (KFORMAT_PLUS | KFORMAT_SPACE)) {
+            prefix = (spec->flags & KFORMAT_PLUS) ? "+" : " ";
+            prefix_len = 1;
+        }
+    }
+
+    size_t len = end - digits;
+    size_t zeros = 0;
+
+    if (spec->precision >= 0) {
+        // An explicit zero precision prints nothing for zero
+        if (spec->precision == 0 && value == 0) {
+            len = 0;
+        }
+        if ((size_t)spec->precision > len) {
+            zeros = spec->precision - len;
+        }
+    } else if ((spec->flags & (KFORMAT_ZERO | KFORMAT_LEFT)) == KFORMAT_ZERO &&
+               (size_t)spec->width > prefix_len + len) {
+        zeros = spec->width - prefix_len - len;
+    }
+
+    return kformat_field(sink, ctx, spec, prefix, prefix_len, zeros, digits, len);
+}
+
+// Length modifiers
+enum {
+    KFORMAT_INT,
+    KFORMAT_CHAR,               // hh
+    KFORMAT_SHORT,              // h
+    KFORMAT_LONG,               // l, z
+    KFORMAT_LONG_LONG,          // ll
+};
+
+// Where kformat() takes its arguments from
+enum {
+    KFORMAT_ARGS_VA,            // A va_list
+    KFORMAT_ARGS_RECORD,        // The data of a captured klog record
+    KFORMAT_ARGS_SCAN,          // Nowhere; note the kind of each argument
+};
+
+struct kformat_args {
+    int source;
+    va_list va;
+    const uint32_t* data;       // Record: argument words, then strings
+    size_t size;                // Record: bytes of data
+    uint32_t pos;               // Record: next word. Scan: arguments seen.
+    uint32_t words;             // Record: argument words. Scan: words seen.
+    uint32_t kinds;             // Scan: KLOG_ARG_* of each argument
+};
+
+static void kformat_scan_arg(struct kformat_args* a, uint32_t kind) {
+    if (a->pos < KLOG_MAX_ARGS) {
+        a->kinds |= kind << (2 * a->pos);
+        a->words += kind == KLOG_ARG_DWORD ? 2 : 1;
+    }
+    a->pos++;
+}
+
+// int, long, char and pointers are all one word here
+static uint32_t kformat_word(struct kformat_args* a) {
+    switch (a->source) {
+        case KFORMAT_ARGS_VA:
+            return va_arg(a->va, uint32_t);
+        case KFORMAT_ARGS_RECORD:
+            return a->pos < a->words ? a->data[a->pos++] : 0;
+        default:
+            kformat_scan_arg(a, KLOG_ARG_WORD);
+            return 0;
+    }
+}
+
+static uint64_t kformat_dword(struct kformat_args* a) {
+    switch (a->source) {
+        case KFORMAT_ARGS_VA:
+            return va_arg(a->va, uint64_t);
+        case KFORMAT_ARGS_RECORD: {
+            uint32_t lo = kformat_word(a);
+            return lo | (uint64_t)kformat_word(a) << 32;
+        }
+        default:
+            kformat_scan_arg(a, KLOG_ARG_DWORD);
+            return 0;
+    }
+}
+
+static const char* kformat_string(struct kformat_args* a) {
+    switch (a->source) {
+        case KFORMAT_ARGS_VA:
+            return va_arg(a->va, const char*);
+        case KFORMAT_ARGS_RECORD: {
+            if (a->pos >= a->words) {
+                return NULL;
+            }
+            uint32_t offset = a->data[a->pos++];
+            return offset < a->size ? (const char*)a->data + offset : NULL;
+        }
+        default:
+            kformat_scan_arg(a, KLOG_ARG_STRING);
+            return "";
+    }
+}
+
+// See kvformat()
+static size_t kformat(kformat_sink_t sink, void* ctx, const char* format,
+                      struct kformat_args* args) {
+    const char* p = format;
+    size_t total = 0;
+
+    for (;;) {
+        const char* run = p;
+        while (*p && *p != '%') {
+            p++;
+        }
+        if (p != run) {
+            sink(ctx, run, p - run);
+            total += p - run;
+        }
+        if (!*p) {
+            break;
+        }
+
+        const char* start = p++;
+        struct kformat_spec spec = { .flags = 0, .width = 0, .precision = -1 };
+
+        for (;; p++) {
+            if (*p == '-') {
+                spec.flags |= KFORMAT_LEFT;
+            } else if (*p == '0') {
+                spec.flags |= KFORMAT_ZERO;
+            } else if (*p == '+') {
+                spec.flags |= KFORMAT_PLUS;
+            } else if (*p == ' ') {
+                spec.flags |= KFORMAT_SPACE;
+            } else if (*p == '#') {
+                spec.flags |= KFORMAT_ALT;
+            } else {
+                break;
+            }
+        }
+
+        if (*p == '*') {
+            spec.width = (int)kformat_word(args);
+            if (spec.width < 0) {
+                spec.flags |= KFORMAT_LEFT;
+                spec.width = -spec.width;
+            }
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') {
+                spec.width = spec.width * 10 + (*p++ - '0');
+            }
+        }
+
+        if (*p == '.') {
+            p++;
+            spec.precision = 0;
+            if (*p == '*') {
+                spec.precision = (int)kformat_word(args);
+                if (spec.precision < 0) {
+                    spec.precision = -1;
                 }
-                case 'd': { // Decimal integer
-                    int value = va_arg(args, int);
-                    char num_str[32];
-                    kitoa(value, num_str, 10);
-                    char* num_ptr = num_str;
-                    while (*num_ptr) {
-                        *buf_ptr++ = *num_ptr++;
-                    }
-                    break;
+                p++;
+            } else {
+                while (*p >= '0' && *p <= '9') {
+                    spec.precision = spec.precision * 10 + (*p++ - '0');
                 }
-                case 'x': { // Hexadecimal
-                    int value = va_arg(args, int);
-                    char num_str[32];
-                    kitoa(value, num_str, 16);
-                    char* num_ptr = num_str;
-                    while (*num_ptr) {
-                        *buf_ptr++ = *num_ptr++;
-                    }
-                    break;
+            }
+        }
+
+        int length = KFORMAT_INT;
+        if (*p == 'h') {
+            length = (*++p == 'h') ? (p++, KFORMAT_CHAR) : KFORMAT_SHORT;
+        } else if (*p == 'l') {
+            length = (*++p == 'l') ? (p++, KFORMAT_LONG_LONG) : KFORMAT_LONG;
+        } else if (*p == 'z') {
+            length = KFORMAT_LONG;
+            p++;
+        }
+
+        char conv = *p;
+        switch (conv) {
+            case 'd':
+            case 'i': {
+                int64_t value;
+                switch (length) {
+                    case KFORMAT_CHAR:      value = (int8_t)kformat_word(args); break;
+                    case KFORMAT_SHORT:     value = (int16_t)kformat_word(args); break;
+                    case KFORMAT_LONG_LONG: value = (int64_t)kformat_dword(args); break;
+                    default:                value = (int32_t)kformat_word(args); break;
                 }
-                case 'c': { // Character
-                    char c = (char)va_arg(args, int);
-                    *buf_ptr++ = c;
-                    break;
+                uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+                total += kformat_number(sink, ctx, &spec, magnitude, value < 0, conv);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X': {
+                uint64_t value;
+                switch (length) {
+                    case KFORMAT_CHAR:      value = (uint8_t)kformat_word(args); break;
+                    case KFORMAT_SHORT:     value = (uint16_t)kformat_word(args); break;
+                    case KFORMAT_LONG_LONG: value = kformat_dword(args); break;
+                    default:                value = kformat_word(args); break;
                 }
-                case '%': { // Literal %
-                    *buf_ptr++ = '%';
-                    break;
+                total += kformat_number(sink, ctx, &spec, value, 0, conv);
+                break;
+            }
+            case 'p':
+                // Every digit of the address, so columns line up
+                if (spec.precision < 0) {
+                    spec.precision = sizeof(void*) * 2;
                 }
-                default:
-                    // Unknown format specifier
-                    *buf_ptr++ = '%';
-                    *buf_ptr++ = *fmt_ptr;
-                    break;
+                total += kformat_number(sink, ctx, &spec,
+                                        kformat_word(args), 0, conv);
+                break;
+            case 's': {
+                const char* str = kformat_string(args);
+                if (!str) {
+                    str = "(null)";
+                }
+                size_t len = spec.precision >= 0 ? strnlen(str, spec.precision) : strlen(str);
+                total += kformat_field(sink, ctx, &spec, NULL, 0, 0, str, len);
+                break;
             }
-        } else {
-            *buf_ptr++ = *fmt_ptr;
+            case 'c': {
+                char c = (char)kformat_word(args);
+                total += kformat_field(sink, ctx, &spec, NULL, 0, 0, &c, 1);
+                break;
+            }
+            case '%':
+                sink(ctx, "%", 1);
+                total++;
+                break;
+            default:
+                // Unknown conversion: print it as written
+                if (!conv) {
+                    p--;
+                }
+                sink(ctx, start, p + 1 - start);
+                total += p + 1 - start;
+                break;
         }
-        fmt_ptr++;
+        p++;
     }
-    
-    *buf_ptr = '\0';
-    terminal_writestring(buffer);
+
+    return total;
 }
 
-// String utilities
-size_t kstrlen(const char* str) {
-    size_t len = 0;
-    while (str[len]) {
-        len++;
-    }
+
+// printf subset: flags - 0 + space #, width and precision (including *),
+// length hh h l ll z, conversions d i u x X p s c %. Output goes to sink in
+// pieces; runs of literal text are passed as one piece. Returns the total
+// length written.
+size_t kvformat(kformat_sink_t sink, void* ctx, const char* format, va_list args) {
+    struct kformat_args a = { .source = KFORMAT_ARGS_VA };
+    va_copy(a.va, args);
+    size_t len = kformat(sink, ctx, format, &a);
+    va_end(a.va);
     return len;
 }
 
-void kstrcpy(char* dest, const char* src) {
-    while (*src) {
-        *dest++ = *src++;
-    }
-    *dest = '\0';
+// Work out once per site where each argument goes in a record
+static void klog_scan(struct klog_site* site) {
+    struct kformat_args a = { .source = KFORMAT_ARGS_SCAN };
+
+    kformat(kformat_null_sink, NULL, site->format, &a);
+    site->args = a.kinds;
+    site->words = a.words;
+    __atomic_fetch_or(&site->flags, KLOG_SITE_SCANNED, __ATOMIC_RELEASE);
 }
 
-void kmemset(void* ptr, int value, size_t num) {
-    unsigned char* p = (unsigned char*)ptr;
-    while (num--) {
-        *p++ = (unsigned char)value;
+size_t klog_record_format(const struct klog_record* rec, char* buf, size_t size) {
+    struct kformat_args a = {
+        .source = KFORMAT_ARGS_RECORD,
+        .data = rec->data,
+        .size = rec->size,
+        .words = rec->site->words,
+    };
+    struct kformat_buf b = { .buf = buf, .size = size, .pos = 0 };
+    size_t len = kformat(kformat_buf_write, &b, rec->site->format, &a);
+
+    if (len >= size) {
+        __atomic_fetch_add(&klog_stats.truncated, 1, __ATOMIC_RELAXED);
+        len = size - 1;
     }
+    buf[len] = '\0';
+    return len;
 }
 
-void kitoa(int value, char* str, int base) {
-    char* ptr = str;
-    char* ptr1 = str;
-    char tmp_char;
-    int tmp_value;
-    
-    if (value < 0 && base == 10) {
-        *ptr++ = '-';
-        value = -value;
-        ptr1++;
-    }
-    
-    do {
-        tmp_value = value;
-        value /= base;
-        *ptr++ = "0123456789abcdef"[tmp_value - value * base];
-    } while (value);
-    
-    *ptr-- = '\0';
-    
-    while (ptr1 < ptr) {
-        tmp_char = *ptr;
-        *ptr-- = *ptr1;
-        *ptr1++ = tmp_char;
+size_t klog_record_encode(const struct klog_record* rec, uint8_t* buf) {
+    struct klog_bin_header hdr = {
+        .sync = KLOG_BIN_SYNC,
+        .size = rec->size,
+        .site = rec->site - __klog_sites_start,
+        .tsc = rec->tsc,
+    };
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), rec->data, rec->size);
+    return sizeof(hdr) + rec->size;
+}
+
+size_t klog_clock_encode(uint8_t* buf) {
+    struct klog_bin_header hdr = {
+        .sync = KLOG_BIN_SYNC,
+        .size = 2 * sizeof(uint32_t),
+        .site = KLOG_BIN_CLOCK,
+        .tsc = clock_data.tsc_base,
+    };
+    uint32_t data[2] = { clock_data.mult, clock_data.shift };
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), data, sizeof(data));
+    return sizeof(hdr) + sizeof(data);
+}
+
+// String utilities
+void kstrcpy(char* dest, const char* src) {
+    while (*src) {
+        *dest++ = *src++;
     }
+    *dest = '\0';
 }
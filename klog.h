@@ -4,6 +4,7 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
+#include "init.h"
 
 // Log levels (higher number = more important)
 typedef enum {
@@ -14,35 +15,243 @@ typedef enum {
     LOG_PANIC = 4
 } log_level_t;
 
+// Calls below this level are compiled out entirely. A plain number so the
+// preprocessor can test it; PANIC can never be compiled out.
+#ifndef KLOG_MIN_LEVEL
+#define KLOG_MIN_LEVEL  0       // LOG_DEBUG
+#endif
+
 // Log colors for different levels
 typedef enum {
     LOG_COLOR_DEBUG = 8,   // Dark grey
-    LOG_COLOR_INFO  = 7,   // Light grey  
+    LOG_COLOR_INFO  = 7,   // Light grey
     LOG_COLOR_WARN  = 14,  // Yellow
     LOG_COLOR_ERROR = 12,  // Light red
     LOG_COLOR_PANIC = 15   // White on red background
 } log_color_t;
 
+// Number of records in the log ring (must be a power of two)
+#define KLOG_RING_SIZE  256
+
+// Maximum rendered message text, including the terminator
+#define KLOG_MSG_MAX    120
+
+// Raw argument storage per record: argument words, then copies of the %s
+// strings
+#define KLOG_DATA_SIZE  128
+
+// Argument kinds in klog_site.args, two bits each, first argument lowest
+#define KLOG_ARG_WORD   1       // int, long, char, pointer, * width
+#define KLOG_ARG_DWORD  2       // long long, low word first
+#define KLOG_ARG_STRING 3       // %s; the word is the offset of the copy in data
+#define KLOG_MAX_ARGS   12      // Further arguments are dropped
+
+// klog_site.flags
+#define KLOG_SITE_SCANNED   0x01    // args and words are valid
+#define KLOG_SITE_DISABLED  0x02    // Below the runtime level; klog() is not called
+
+// One per KDEBUG/KINFO/... call, gathered into .klog_sites. Records refer
+// to their site instead of carrying text, and the binary log identifies a
+// message by its site's index in the section.
+struct klog_site {
+    const char* format;
+    const char* subsystem;
+    uint32_t args;              // KLOG_ARG_* of each argument
+    uint8_t level;              // log_level_t
+    uint8_t flags;              // KLOG_SITE_*
+    uint8_t words;              // Argument words in a record's data
+    uint8_t reserved;
+};
+
+#define __klog_site     __attribute__((section(".klog_sites"), used, aligned(4)))
+
+extern struct klog_site __klog_sites_start[];
+extern struct klog_site __klog_sites_end[];
+
+// A log call as stored in the ring and handed to sinks. Nothing is
+// formatted until the record is drained.
+struct klog_record {
+    uint64_t tsc;               // rdtsc() when klog() was called
+    uint32_t seq;               // Ring sequence number (gaps mean drops)
+    struct klog_site* site;
+    uint8_t size;               // Bytes of data in use
+    uint32_t data[KLOG_DATA_SIZE / 4];
+};
+
+// A log sink receives drained records in batches
+struct klog_sink {
+    const char* name;
+    // Deliver one record, along with its rendered text
+    void (*write)(const struct klog_record* rec, const char* msg, size_t len);
+    void (*flush)(void);                            // End of a batch (optional)
+    void (*puts)(const char* str);                  // Raw text, used by panic
+};
+
+// Binary log entry, little endian, followed by size bytes of record data.
+// The stream may interleave entries with plain text, which never contains
+// KLOG_BIN_SYNC. tools/klogdecode.py turns it back into text.
+struct klog_bin_header {
+    uint8_t sync;               // KLOG_BIN_SYNC
+    uint8_t size;               // Bytes of data that follow
+    uint16_t site;              // Index in .klog_sites, or KLOG_BIN_CLOCK
+    uint64_t tsc;
+} __attribute__((packed));
+
+#define KLOG_BIN_SYNC   0xFE
+
+// Clock entry: tsc is clock_data.tsc_base, data is mult and shift
+#define KLOG_BIN_CLOCK  0xFFFF
+
+#define KLOG_BIN_MAX    (sizeof(struct klog_bin_header) + KLOG_DATA_SIZE)
+
+// Logging statistics
+struct klog_stats {
+    uint32_t written;       // Records appended to the ring
+    uint32_t dropped;       // Records lost because the ring was full
+    uint32_t truncated;     // Records whose strings or text did not fit
+    uint32_t flushed;       // Records delivered to the sinks
+};
+
+#define KLOG_MAX_SINKS  4
+
 void klog_init(void);
 
-void klog_set_level(log_level_t level);
+// Runtime levels. A subsystem level overrides the global one for every
+// call site logging under that name (e.g. "PIC"). Both update the flag the
+// macros test, so a disabled call costs a load and a branch. Levels above
+// LOG_PANIC are rejected, and KPANIC sites are never disabled.
+int klog_set_level(log_level_t level);
+int klog_set_subsystem_level(const char* subsystem, log_level_t level);
+
+// Up to this many subsystems can have their own level
+#define KLOG_MAX_SUBSYSTEMS 16
+
+// Register a sink; records already in the ring will be delivered to it
+int klog_register_sink(const struct klog_sink* sink);
+
+// Append a record to the ring. Safe to call from interrupt context; never
+// touches the console. Use the macros below, which supply the site.
+void klog(struct klog_site* site, ...);
+
+// Drain pending records to all sinks. Must not be called from interrupt
+// context; concurrent callers return immediately.
+void klog_flush(void);
+
+// Drain until every record published before the call has been delivered,
+// waiting for a concurrent drain if needed
+void klog_sync(void);
+
+// Switch to synchronous panic mode and drain everything still queued
+void klog_panic_flush(void);
 
-void klog(log_level_t level, const char* subsystem, const char* format, ...);
+// Non-zero once kernel_panic() has started; sinks must then write synchronously
+int klog_in_panic(void);
 
-#define KDEBUG(sys, fmt, ...) klog(LOG_DEBUG, sys, fmt, ##__VA_ARGS__)
-#define KINFO(sys, fmt, ...)  klog(LOG_INFO,  sys, fmt, ##__VA_ARGS__)  
-#define KWARN(sys, fmt, ...)  klog(LOG_WARN,  sys, fmt, ##__VA_ARGS__)
-#define KERROR(sys, fmt, ...) klog(LOG_ERROR, sys, fmt, ##__VA_ARGS__)
-#define KPANIC(sys, fmt, ...) klog(LOG_PANIC, sys, fmt, ##__VA_ARGS__)
+void klog_get_stats(struct klog_stats* stats);
+
+// Fixed-width name of a level, e.g. "INFO "
+const char* klog_level_name(log_level_t level);
+
+// Nanoseconds since clock_init() at which rec was logged
+uint64_t klog_record_time(const struct klog_record* rec);
+
+// Render rec's message into buf; returns its length, at most size - 1
+size_t klog_record_format(const struct klog_record* rec, char* buf, size_t size);
+
+// Encode rec as a binary entry into buf, which must hold KLOG_BIN_MAX
+// bytes; returns the entry's length
+size_t klog_record_encode(const struct klog_record* rec, uint8_t* buf);
+
+// Encode the clock entry the decoder needs to turn TSC values into time
+size_t klog_clock_encode(uint8_t* buf);
+
+// Longest output of klog_format_time()
+#define KLOG_TIME_MAX   16
+
+// Render a timestamp as "[sssss.uuuuuu] " into buf; returns the length
+size_t klog_format_time(char* buf, uint64_t ns);
+
+// Never called; lets GCC check the arguments against the format, which
+// klog() only sees through the site
+static inline __attribute__((format(printf, 1, 2)))
+void klog_check_format(const char* format, ...) {
+}
+
+static inline int klog_site_enabled(const struct klog_site* site) {
+    return !(__atomic_load_n(&site->flags, __ATOMIC_RELAXED) & KLOG_SITE_DISABLED);
+}
+
+// Arguments are not evaluated unless the site is enabled
+#define KLOG(lvl, sys, fmt_section, fmt, ...) do {                          \
+        static const char __klog_fmt_[] fmt_section = fmt;                  \
+        static struct klog_site __klog_site_ __klog_site = {                \
+            .format = __klog_fmt_, .subsystem = sys, .level = lvl,          \
+        };                                                                  \
+        if (0) klog_check_format(fmt, ##__VA_ARGS__);                       \
+        if (klog_site_enabled(&__klog_site_)) {                             \
+            klog(&__klog_site_, ##__VA_ARGS__);                             \
+        }                                                                   \
+    } while (0)
+
+// A call below KLOG_MIN_LEVEL: no site, no code, but still type-checked
+#define KLOG_OFF(fmt, ...) do {                                             \
+        if (0) klog_check_format(fmt, ##__VA_ARGS__);                       \
+    } while (0)
+
+// For __init code the format string is discarded along with the function,
+// so kernel_main() drains the ring before freeing it. The site and the
+// subsystem name stay resident.
+#if KLOG_MIN_LEVEL <= 0
+#define KDEBUG(sys, fmt, ...)      KLOG(LOG_DEBUG, sys, , fmt, ##__VA_ARGS__)
+#define KDEBUG_INIT(sys, fmt, ...) KLOG(LOG_DEBUG, sys, __initconst, fmt, ##__VA_ARGS__)
+#else
+#define KDEBUG(sys, fmt, ...)      KLOG_OFF(fmt, ##__VA_ARGS__)
+#define KDEBUG_INIT(sys, fmt, ...) KLOG_OFF(fmt, ##__VA_ARGS__)
+#endif
+
+#if KLOG_MIN_LEVEL <= 1
+#define KINFO(sys, fmt, ...)       KLOG(LOG_INFO, sys, , fmt, ##__VA_ARGS__)
+#define KINFO_INIT(sys, fmt, ...)  KLOG(LOG_INFO, sys, __initconst, fmt, ##__VA_ARGS__)
+#else
+#define KINFO(sys, fmt, ...)       KLOG_OFF(fmt, ##__VA_ARGS__)
+#define KINFO_INIT(sys, fmt, ...)  KLOG_OFF(fmt, ##__VA_ARGS__)
+#endif
+
+#if KLOG_MIN_LEVEL <= 2
+#define KWARN(sys, fmt, ...)       KLOG(LOG_WARN, sys, , fmt, ##__VA_ARGS__)
+#else
+#define KWARN(sys, fmt, ...)       KLOG_OFF(fmt, ##__VA_ARGS__)
+#endif
+
+#if KLOG_MIN_LEVEL <= 3
+#define KERROR(sys, fmt, ...)      KLOG(LOG_ERROR, sys, , fmt, ##__VA_ARGS__)
+#else
+#define KERROR(sys, fmt, ...)      KLOG_OFF(fmt, ##__VA_ARGS__)
+#endif
+
+#define KPANIC(sys, fmt, ...)      KLOG(LOG_PANIC, sys, , fmt, ##__VA_ARGS__)
 
 void kernel_panic(const char* message);
 
-void kprintf(const char* format, ...);
+// Receives formatted output in pieces, which are not NUL-terminated
+typedef void (*kformat_sink_t)(void* ctx, const char* data, size_t len);
+
+// Format into sink. Supports flags "-0+ #", width and precision (also as
+// *), length modifiers hh h l ll z and conversions d i u x X p s c %.
+// Returns the number of characters produced.
+size_t kvformat(kformat_sink_t sink, void* ctx, const char* format, va_list args);
+
+// Format into buf, never writing more than size bytes, and terminate it if
+// size is non-zero. Returns the length the full output would have had; a
+// result >= size means it was truncated.
+size_t ksnprintf(char* buf, size_t size, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+size_t kvsnprintf(char* buf, size_t size, const char* format, va_list args);
+
+// Format straight to the console
+void kprintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
 void kvprintf(const char* format, va_list args);
 
-size_t kstrlen(const char* str);
 void kstrcpy(char* dest, const char* src);
-void kmemset(void* ptr, int value, size_t num);
-void kitoa(int value, char* str, int base);
 
 #endif
@@ -0,0 +1,57 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include <stdint.h>
+
+// Value passed in EAX by a Multiboot-compliant bootloader
+#define MULTIBOOT_BOOTLOADER_MAGIC  0x2BADB002
+
+// multiboot_info.flags bits
+#define MULTIBOOT_INFO_MEMORY       0x001   // mem_lower/mem_upper are valid
+#define MULTIBOOT_INFO_CMDLINE      0x004   // cmdline is valid
+#define MULTIBOOT_INFO_MODS         0x008   // mods_count/mods_addr are valid
+#define MULTIBOOT_INFO_MEM_MAP      0x040   // mmap_length/mmap_addr are valid
+
+// Memory map entry types
+#define MULTIBOOT_MEMORY_AVAILABLE          1
+#define MULTIBOOT_MEMORY_RESERVED           2
+#define MULTIBOOT_MEMORY_ACPI_RECLAIMABLE   3
+#define MULTIBOOT_MEMORY_NVS                4
+#define MULTIBOOT_MEMORY_BADRAM             5
+
+// Boot information structure (Multiboot specification 0.6.96, section 3.3)
+struct multiboot_info {
+    uint32_t flags;
+    uint32_t mem_lower;         // KiB of memory below 1 MiB
+    uint32_t mem_upper;         // KiB of memory above 1 MiB
+    uint32_t boot_device;
+    uint32_t cmdline;           // Physical address of the command line
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;       // Size of the memory map buffer in bytes
+    uint32_t mmap_addr;         // Physical address of the memory map
+    uint32_t drives_length;
+    uint32_t drives_addr;
+    uint32_t config_table;
+    uint32_t boot_loader_name;
+    uint32_t apm_table;
+} __attribute__((packed));
+
+// Memory map entry. 'size' does not include the size field itself.
+struct multiboot_mmap_entry {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed));
+
+// Boot module descriptor
+struct multiboot_module {
+    uint32_t mod_start;
+    uint32_t mod_end;
+    uint32_t cmdline;
+    uint32_t reserved;
+} __attribute__((packed));
+
+#endif // MULTIBOOT_H
@@ -0,0 +1,273 @@
+#include "paging.h"
+#include "pmm.h"
+#include "klog.h"
+#include "string.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "smp.h"
+
+// The one kernel address space. Page tables for 4 KiB mappings come from the
+// page allocator and are reached through the direct map. Every CPU runs on
+// this directory; changes to present entries are flushed on all of them by
+// smp_flush_tlb_range(), after paging_lock is dropped so a CPU spinning on
+// it with interrupts off cannot hold up the shootdown.
+static uint32_t kernel_page_directory[1024] __attribute__((aligned(PAGE_SIZE)));
+static spinlock_t paging_lock = SPINLOCK_INIT;
+
+static uintptr_t direct_map_size;
+static uintptr_t vmap_next = VMAP_START;
+static spinlock_t vmap_lock = SPINLOCK_INIT;
+static int global_pages;
+
+void __init paging_init(const struct multiboot_info* mbi) {
+    KINFO_INIT("PAGE", "Initializing paging...");
+
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_PSE)) {
+        KPANIC("PAGE", "CPU does not support 4 MiB pages");
+    }
+    global_pages = (edx & CPUID_EDX_PGE) != 0;
+
+    // Direct map every 4 MiB that holds available RAM, up to DIRECT_MAP_MAX
+    uint64_t top = BOOT_MAP_SIZE;
+    if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+        uintptr_t entry = (uintptr_t)phys_to_virt(mbi->mmap_addr);
+        uintptr_t end = entry + mbi->mmap_length;
+        while (entry < end) {
+            const struct multiboot_mmap_entry* e = (const struct multiboot_mmap_entry*)entry;
+            if (e->type == MULTIBOOT_MEMORY_AVAILABLE && e->addr + e->len > top) {
+                top = e->addr + e->len;
+            }
+            entry += e->size + sizeof(e->size);
+        }
+    }
+    top = (top + LARGE_PAGE_SIZE - 1) & ~(uint64_t)(LARGE_PAGE_SIZE - 1);
+    direct_map_size = top < DIRECT_MAP_MAX ? top : DIRECT_MAP_MAX;
+
+    uint32_t flags = PTE_PRESENT | PTE_WRITE | PTE_LARGE | (global_pages ? PTE_GLOBAL : 0);
+    for (uintptr_t phys = 0; phys < direct_map_size; phys += LARGE_PAGE_SIZE) {
+        kernel_page_directory[PD_INDEX(KERNEL_VMA + phys)] = phys | flags;
+    }
+
+    if (global_pages) {
+        write_cr4(read_cr4() | CR4_PGE);
+    }
+    write_cr3(virt_to_phys(kernel_page_directory));
+
+    KINFO_INIT("PAGE", "Direct map 0x%x - 0x%x with %u 4 MiB %spages",
+               KERNEL_VMA, KERNEL_VMA + direct_map_size - 1,
+               direct_map_size / LARGE_PAGE_SIZE, global_pages ? "global " : "");
+    KDEBUG_INIT("PAGE", "Page directory at 0x%x, identity mapping removed",
+                virt_to_phys(kernel_page_directory));
+}
+
+uintptr_t paging_direct_map_size(void) {
+    return direct_map_size;
+}
+
+// Page table covering virt, allocating it if asked. NULL if there is none,
+// or if virt is covered by a 4 MiB page.
+static uint32_t* paging_get_table(uintptr_t virt, int create) {
+    uint32_t* pde = &kernel_page_directory[PD_INDEX(virt)];
+
+    if (*pde & PTE_PRESENT) {
+        if (*pde & PTE_LARGE) {
+            return NULL;
+        }
+        return phys_to_virt(*pde & PTE_ADDR_MASK);
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    uintptr_t table = pmm_alloc_page();
+    if (!table) {
+        return NULL;
+    }
+    memset(phys_to_virt(table), 0, PAGE_SIZE);
+    *pde = table | PTE_PRESENT | PTE_WRITE;
+    return phys_to_virt(table);
+}
+
+int paging_map(uintptr_t virt, uintptr_t phys, size_t size, uint32_t flags) {
+    uintptr_t start = virt;
+    uintptr_t end = (virt + size + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+    int replaced = 0;
+    int result = 0;
+
+    uint32_t irq_flags = spin_lock_irqsave(&paging_lock);
+
+    while (virt < end) {
+        uint32_t* pde = &kernel_page_directory[PD_INDEX(virt)];
+        int has_table = (*pde & PTE_PRESENT) && !(*pde & PTE_LARGE);
+
+        if (!(virt & (LARGE_PAGE_SIZE - 1)) && !(phys & (LARGE_PAGE_SIZE - 1)) &&
+            end - virt >= LARGE_PAGE_SIZE && !has_table) {
+            replaced |= *pde & PTE_PRESENT;
+            *pde = phys | flags | PTE_PRESENT | PTE_LARGE;
+            virt += LARGE_PAGE_SIZE;
+            phys += LARGE_PAGE_SIZE;
+            continue;
+        }
+
+        uint32_t* table = paging_get_table(virt, 1);
+        if (!table) {
+            KERROR("PAGE", "Cannot map 0x%x: no page table", virt);
+            result = -1;
+            break;
+        }
+
+        uint32_t* pte = &table[PT_INDEX(virt)];
+        replaced |= *pte & PTE_PRESENT;
+        *pte = phys | flags | PTE_PRESENT;
+        virt += PAGE_SIZE;
+        phys += PAGE_SIZE;
+    }
+
+    spin_unlock_irqrestore(&paging_lock, irq_flags);
+
+    // New entries need no invalidation; only replaced ones might be cached
+    if (replaced) {
+        smp_flush_tlb_range(start, virt - start, 1);
+    }
+    return result;
+}
+
+// Replace the 4 MiB page covering virt with a page table mapping the same
+// frames with the same flags, so part of it can be unmapped. Returns the
+// table, or NULL if none could be allocated.
+static uint32_t* paging_split_large(uintptr_t virt) {
+    uint32_t* pde = &kernel_page_directory[PD_INDEX(virt)];
+    uintptr_t table = pmm_alloc_page();
+    if (!table) {
+        return NULL;
+    }
+
+    uint32_t* entries = phys_to_virt(table);
+    uintptr_t phys = *pde & ~(uintptr_t)(LARGE_PAGE_SIZE - 1);
+    uint32_t flags = *pde & (PAGE_SIZE - 1) & ~PTE_LARGE;
+    for (uint32_t i = 0; i < 1024; i++) {
+        entries[i] = (phys + i * PAGE_SIZE) | flags;
+    }
+    *pde = table | PTE_PRESENT | PTE_WRITE;
+    return entries;
+}
+
+int paging_unmap(uintptr_t virt, size_t size) {
+    uintptr_t start = virt & ~(uintptr_t)(PAGE_SIZE - 1);
+    uintptr_t end = (virt + size + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+    uintptr_t flush_start = start;
+    uintptr_t flush_end = end;
+    int global = 0;
+    int result = 0;
+
+    uint32_t irq_flags = spin_lock_irqsave(&paging_lock);
+
+    for (virt = start; virt < end; ) {
+        uint32_t* pde = &kernel_page_directory[PD_INDEX(virt)];
+        uintptr_t large = virt & ~(uintptr_t)(LARGE_PAGE_SIZE - 1);
+
+        if ((*pde & PTE_PRESENT) && (*pde & PTE_LARGE)) {
+            global |= *pde & PTE_GLOBAL;
+            if (virt == large && end - virt >= LARGE_PAGE_SIZE) {
+                *pde = 0;
+                virt += LARGE_PAGE_SIZE;
+                continue;
+            }
+
+            // Only part of it goes. The rest keeps its translation, but the
+            // TLB may hold it as a large page: flush the whole 4 MiB.
+            if (!paging_split_large(virt)) {
+                KERROR("PAGE", "Cannot unmap 0x%x: no page table to split its 4 MiB page", virt);
+                result = -1;
+                break;
+            }
+            if (large < flush_start) {
+                flush_start = large;
+            }
+            if (large + LARGE_PAGE_SIZE > flush_end) {
+                flush_end = large + LARGE_PAGE_SIZE;
+            }
+        }
+
+        uint32_t* table = paging_get_table(virt, 0);
+        if (table) {
+            global |= table[PT_INDEX(virt)] & PTE_GLOBAL;
+            table[PT_INDEX(virt)] = 0;
+        }
+        virt += PAGE_SIZE;
+    }
+
+    spin_unlock_irqrestore(&paging_lock, irq_flags);
+
+    smp_flush_tlb_range(flush_start, flush_end - flush_start, global);
+    return result;
+}
+
+uintptr_t paging_translate(uintptr_t virt) {
+    uint32_t pde = kernel_page_directory[PD_INDEX(virt)];
+
+    if (!(pde & PTE_PRESENT)) {
+        return 0;
+    }
+    if (pde & PTE_LARGE) {
+        return (pde & ~(LARGE_PAGE_SIZE - 1)) | (virt & (LARGE_PAGE_SIZE - 1));
+    }
+
+    uint32_t pte = ((uint32_t*)phys_to_virt(pde & PTE_ADDR_MASK))[PT_INDEX(virt)];
+    if (!(pte & PTE_PRESENT)) {
+        return 0;
+    }
+    return (pte & PTE_ADDR_MASK) | (virt & (PAGE_SIZE - 1));
+}
+
+void tlb_flush_range(uintptr_t virt, size_t size, int global) {
+    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    if (pages <= TLB_FLUSH_THRESHOLD) {
+        for (size_t i = 0; i < pages; i++) {
+            invlpg(virt + i * PAGE_SIZE);
+        }
+    } else if (global && global_pages) {
+        // Toggling PGE flushes everything, global entries included
+        uint32_t cr4 = read_cr4();
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        write_cr3(read_cr3());
+    }
+}
+
+uintptr_t vmap_reserve(size_t size) {
+    size = (size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+
+    uint32_t flags = spin_lock_irqsave(&vmap_lock);
+    uintptr_t base = vmap_next;
+    if (size > VMAP_END - base) {
+        spin_unlock_irqrestore(&vmap_lock, flags);
+        KERROR("PAGE", "vmap area exhausted (%u bytes requested)", size);
+        return 0;
+    }
+    vmap_next += size;
+    spin_unlock_irqrestore(&vmap_lock, flags);
+
+    return base;
+}
+
+void* ioremap(uintptr_t phys, size_t size) {
+    uintptr_t offset = phys & (PAGE_SIZE - 1);
+    size_t length = size + offset;
+
+    uintptr_t base = vmap_reserve(length);
+    if (!base) {
+        return NULL;
+    }
+
+    uint32_t flags = PTE_WRITE | PTE_PCD | PTE_PWT | (global_pages ? PTE_GLOBAL : 0);
+    if (paging_map(base, phys - offset, length, flags) < 0) {
+        return NULL;
+    }
+    return (void*)(base + offset);
+}
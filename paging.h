@@ -0,0 +1,85 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "multiboot.h"
+
+// Virtual address layout
+//   0x00000000 - 0xBFFFFFFF  unmapped (NULL dereferences fault)
+//   0xC0000000 - ...         direct map of physical memory, 4 MiB pages.
+//                            The kernel image sits at 0xC0100000.
+//   0xF0000000 - 0xFFBFFFFF  vmap area: 4 KiB mappings for MMIO and other
+//                            ranges that need fine granularity
+#define KERNEL_VMA          0xC0000000  // Keep in sync with linker.ld and boot.s
+#define DIRECT_MAP_MAX      0x30000000  // At most 768 MiB of RAM is direct mapped
+#define VMAP_START          0xF0000000
+#define VMAP_END            0xFFC00000
+
+// Size of the boot.s mapping available before paging_init()
+#define BOOT_MAP_SIZE       0x01000000
+
+#define LARGE_PAGE_SIZE     0x400000    // 4 MiB
+
+// Page directory / page table entry bits
+#define PTE_PRESENT         0x001
+#define PTE_WRITE           0x002
+#define PTE_USER            0x004
+#define PTE_PWT             0x008       // Write-through
+#define PTE_PCD             0x010       // Cache disable
+#define PTE_ACCESSED        0x020
+#define PTE_DIRTY           0x040
+#define PTE_LARGE           0x080       // 4 MiB page (page directory entries only)
+#define PTE_GLOBAL          0x100       // Survives CR3 reloads
+#define PTE_ADDR_MASK       0xFFFFF000
+
+// Above this many pages a range flush reloads CR3 instead of using INVLPG
+#define TLB_FLUSH_THRESHOLD 32
+
+#define PD_INDEX(addr)      ((uintptr_t)(addr) >> 22)
+#define PT_INDEX(addr)      (((uintptr_t)(addr) >> 12) & 0x3FF)
+
+static inline void* phys_to_virt(uintptr_t phys) {
+    return (void*)(phys + KERNEL_VMA);
+}
+
+static inline uintptr_t virt_to_phys(const void* virt) {
+    return (uintptr_t)virt - KERNEL_VMA;
+}
+
+// Build the kernel page directory: direct map RAM with global 4 MiB pages,
+// drop the boot identity mapping and enable global pages. Does not allocate.
+void paging_init(const struct multiboot_info* mbi);
+
+// Bytes of physical memory covered by the direct map
+uintptr_t paging_direct_map_size(void);
+
+// Map [virt, virt+size) to [phys, phys+size). Uses 4 MiB pages wherever both
+// addresses are 4 MiB aligned and a whole large page fits, 4 KiB pages
+// elsewhere. Returns 0 on success, -1 if a page table could not be allocated.
+int paging_map(uintptr_t virt, uintptr_t phys, size_t size, uint32_t flags);
+
+// Remove the mappings in [virt, virt+size) and flush the TLB once for the
+// whole range, on every CPU, before returning. Page tables are kept.
+// Callers must not hold a lock other CPUs may spin on with interrupts
+// off. A 4 MiB page only partly in the range
+// is split into 4 KiB pages first. Returns 0 on success, -1 if the page
+// table for a split could not be allocated; the range is then unmapped
+// only up to that page.
+int paging_unmap(uintptr_t virt, size_t size);
+
+// Physical address mapped at virt, or 0 if it is not mapped
+uintptr_t paging_translate(uintptr_t virt);
+
+// Invalidate the TLB for a range: INVLPG per page for small ranges, a full
+// flush above TLB_FLUSH_THRESHOLD pages (toggling CR4.PGE if global
+// entries are involved)
+void tlb_flush_range(uintptr_t virt, size_t size, int global);
+
+// Reserve page-aligned virtual space in the vmap area (never released)
+uintptr_t vmap_reserve(size_t size);
+
+// Map a physical MMIO range uncached into the vmap area
+void* ioremap(uintptr_t phys, size_t size);
+
+#endif // PAGING_H
@@ -1,14 +1,24 @@
 #include "pic.h"
 #include "klog.h"
 
-void pic_init(void) {
-    KINFO("PIC", "Initializing Programmable Interrupt Controller...");
+const struct irqchip pic_chip = {
+    .name = "8259 PIC",
+    .mask = pic_mask,
+    .unmask = pic_unmask,
+    .eoi = pic_send_eoi,
+    .spurious = pic_spurious,
+};
+
+const struct irqchip* irq_chip = &pic_chip;
+
+void __init pic_init(void) {
+    KINFO_INIT("PIC", "Initializing Programmable Interrupt Controller...");
     
     // Save current interrupt masks
     uint8_t mask1 = inb(PIC1_DATA);
     uint8_t mask2 = inb(PIC2_DATA);
     
-    KDEBUG("PIC", "Current masks - Master: 0x%x, Slave: 0x%x", mask1, mask2);
+    KDEBUG_INIT("PIC", "Current masks - Master: 0x%x, Slave: 0x%x", mask1, mask2);
     
     // Start initialization sequence (ICW1)
     outb(PIC1_COMMAND, ICW1_INIT | ICW1_ICW4);  // Master PIC
@@ -32,16 +42,16 @@ void pic_init(void) {
     outb(PIC1_DATA, 0xFF);  // Mask all master PIC interrupts
     outb(PIC2_DATA, 0xFF);  // Mask all slave PIC interrupts
     
-    KINFO("PIC", "PIC initialized - IRQs remapped to 32-47");
-    KDEBUG("PIC", "Master PIC: IRQ 0-7 -> INT 32-39");
-    KDEBUG("PIC", "Slave PIC: IRQ 8-15 -> INT 40-47");
+    KINFO_INIT("PIC", "PIC initialized - IRQs remapped to 32-47");
+    KDEBUG_INIT("PIC", "Master PIC: IRQ 0-7 -> INT 32-39");
+    KDEBUG_INIT("PIC", "Slave PIC: IRQ 8-15 -> INT 40-47");
     
     // Enable only timer and keyboard for now
-    irq_clear_mask(0);  // Enable timer (IRQ 0)
-    irq_clear_mask(1);  // Enable keyboard (IRQ 1)
-    irq_clear_mask(2);  // Enable cascade (required for slave PIC)
+    pic_unmask(0);  // Enable timer (IRQ 0)
+    pic_unmask(1);  // Enable keyboard (IRQ 1)
+    pic_unmask(2);  // Enable cascade (required for slave PIC)
     
-    KINFO("PIC", "Enabled IRQ 0 (timer) and IRQ 1 (keyboard)");
+    KINFO_INIT("PIC", "Enabled IRQ 0 (timer) and IRQ 1 (keyboard)");
 }
 
 void pic_send_eoi(uint8_t irq) {
@@ -53,13 +63,34 @@ void pic_send_eoi(uint8_t irq) {
     outb(PIC1_COMMAND, PIC_EOI);
 }
 
+int pic_spurious(uint8_t irq) {
+    // A chip whose request went away before the acknowledge reports its
+    // lowest priority input, 7, without setting its in-service bit
+    if (irq == 7) {
+        outb(PIC1_COMMAND, PIC_READ_ISR);
+        return !(inb(PIC1_COMMAND) & 0x80);
+    }
+    if (irq == 15) {
+        outb(PIC2_COMMAND, PIC_READ_ISR);
+        if (!(inb(PIC2_COMMAND) & 0x80)) {
+            outb(PIC1_COMMAND, PIC_EOI);
+            return 1;
+        }
+    }
+    return 0;
+}
+
 void pic_disable(void) {
     KINFO("PIC", "Disabling PIC...");
     outb(PIC1_DATA, 0xFF);  // Mask all interrupts
     outb(PIC2_DATA, 0xFF);
 }
 
-void irq_set_mask(uint8_t irq_line) {
+uint16_t pic_get_mask(void) {
+    return inb(PIC1_DATA) | (inb(PIC2_DATA) << 8);
+}
+
+void pic_mask(uint8_t irq_line) {
     uint16_t port;
     
     if (irq_line < 8) {
@@ -75,7 +106,7 @@ void irq_set_mask(uint8_t irq_line) {
     KDEBUG("PIC", "Masked IRQ %d", irq_line < 8 ? irq_line : irq_line + 8);
 }
 
-void irq_clear_mask(uint8_t irq_line) {
+void pic_unmask(uint8_t irq_line) {
     uint16_t port;
     uint8_t original_irq = irq_line;
     
@@ -2,6 +2,8 @@
 #define PIC_H
 
 #include <stdint.h>
+#include "io.h"
+#include "irqchip.h"
 
 // PIC port addresses
 #define PIC1_COMMAND    0x20    // Master PIC command port
@@ -11,6 +13,7 @@
 
 // PIC commands
 #define PIC_EOI         0x20    // End of Interrupt command
+#define PIC_READ_ISR    0x0B    // OCW3: next command port read returns the ISR
 
 // ICW1 (Initialization Control Word 1)
 #define ICW1_ICW4       0x01    // ICW4 needed
@@ -48,18 +51,18 @@
 void pic_init(void);
 void pic_send_eoi(uint8_t irq);
 void pic_disable(void);
-void irq_set_mask(uint8_t irq_line);
-void irq_clear_mask(uint8_t irq_line);
+void pic_mask(uint8_t irq_line);
+void pic_unmask(uint8_t irq_line);
 
-// Port I/O functions
-static inline void outb(uint16_t port, uint8_t value) {
-    __asm__ volatile ("outb %0, %1" : : "a"(value), "Nd"(port));
-}
+// Non-zero if IRQ 7 or 15 was spurious: its in-service bit is clear. A
+// spurious IRQ 15 still occupies the master's cascade input, so the master
+// alone gets an EOI.
+int pic_spurious(uint8_t irq);
 
-static inline uint8_t inb(uint16_t port) {
-    uint8_t ret;
-    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
-    return ret;
-}
+// Current mask of both chips, bit n set if IRQ n is masked
+uint16_t pic_get_mask(void);
+
+// The 8259 backend for irq_chip
+extern const struct irqchip pic_chip;
 
 #endif // PIC_H
@@ -0,0 +1,116 @@
+#include "pit.h"
+#include "io.h"
+#include "irq.h"
+#include "pic.h"
+#include "cpu.h"
+#include "klog.h"
+
+// Each calibration pass times this many PIT periods; the shortest of
+// PIT_CALIBRATE_PASSES wins, as SMIs and VM exits only ever add cycles
+#define PIT_CALIBRATE_MS        10
+#define PIT_CALIBRATE_PASSES    5
+
+// ns to PIT counts as (ns * PIT_NS_MULT) >> 32, PIT_NS_MULT = 2^32 * 1.193182e6 / 1e9
+#define PIT_NS_MULT             5124678
+
+static volatile uint64_t pit_tick_count;
+
+static void pit_set_next_event(uint64_t delta_ns);
+static void pit_shutdown(void);
+
+struct clock_event_device pit_clockevent = {
+    .name = "pit",
+    .rating = 100,
+    .min_delta_ns = 2 * NSEC_PER_USEC,
+    .max_delta_ns = PIT_MAX_DELTA_NS,
+    .set_next_event = pit_set_next_event,
+    .shutdown = pit_shutdown,
+};
+
+static uint16_t pit_divisor(uint32_t hz) {
+    uint32_t divisor = (PIT_FREQUENCY + hz / 2) / hz;
+    if (divisor > 0xFFFF) {
+        divisor = 0;            // 0 means 65536, the slowest rate (~18.2 Hz)
+    }
+    return divisor;
+}
+
+static void pit_irq(struct interrupt_frame* frame, void* ctx) {
+    pit_tick_count++;
+    if (pit_clockevent.event_handler) {
+        pit_clockevent.event_handler();
+    }
+}
+
+void __init pit_init(uint32_t hz) {
+    uint16_t divisor = pit_divisor(hz);
+
+    outb(PIT_COMMAND, PIT_SELECT_CH0 | PIT_ACCESS_WORD | PIT_MODE_RATE);
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, divisor >> 8);
+
+    request_irq(IRQ_TIMER, pit_irq, NULL);
+    KINFO_INIT("PIT", "Channel 0 at %u Hz (divisor %d)", hz, divisor);
+}
+
+uint32_t __init pit_calibrate_tsc(void) {
+    uint16_t latch = pit_divisor(1000 / PIT_CALIBRATE_MS);
+    uint64_t best = ~0ULL;
+
+    // Speaker off, channel 2 gate on
+    uint8_t port_b = inb(PIT_PORT_B);
+    outb(PIT_PORT_B, (port_b & ~PIT_SPEAKER) | PIT_GATE2);
+
+    for (int pass = 0; pass < PIT_CALIBRATE_PASSES; pass++) {
+        uint32_t flags = irq_save();
+
+        // Mode 0 drives OUT low when the count is loaded and raises it on
+        // terminal count, so the interval is bounded by two port reads
+        outb(PIT_COMMAND, PIT_SELECT_CH2 | PIT_ACCESS_WORD | PIT_MODE_ONESHOT);
+        outb(PIT_CHANNEL2, latch & 0xFF);
+        outb(PIT_CHANNEL2, latch >> 8);
+
+        uint64_t start = rdtsc();
+        while (!(inb(PIT_PORT_B) & PIT_OUT2)) {
+        }
+        uint64_t delta = rdtsc() - start;
+
+        irq_restore(flags);
+
+        if (delta < best) {
+            best = delta;
+        }
+    }
+
+    outb(PIT_PORT_B, port_b);
+
+    // cycles / (latch / PIT_FREQUENCY s) / 1000
+    return (uint32_t)(best * PIT_FREQUENCY / ((uint64_t)latch * 1000));
+}
+
+// Mode 0 fires IRQ 0 once when the count runs out and then stops. The
+// count is rounded up so the interrupt never comes before the deadline.
+static void pit_set_next_event(uint64_t delta_ns) {
+    uint32_t count = (((uint64_t)(uint32_t)delta_ns * PIT_NS_MULT) >> 32) + 1;
+    if (count > 0xFFFF) {
+        count = 0xFFFF;
+    }
+
+    outb(PIT_COMMAND, PIT_SELECT_CH0 | PIT_ACCESS_WORD | PIT_MODE_ONESHOT);
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, count >> 8);
+}
+
+// Writing the mode 0 command word without a count halts the counter
+static void pit_shutdown(void) {
+    outb(PIT_COMMAND, PIT_SELECT_CH0 | PIT_ACCESS_WORD | PIT_MODE_ONESHOT);
+}
+
+uint64_t pit_ticks(void) {
+    // A 64-bit read is two loads on i686; retry if the IRQ split them
+    uint64_t ticks;
+    do {
+        ticks = pit_tick_count;
+    } while (ticks != pit_tick_count);
+    return ticks;
+}
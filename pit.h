@@ -0,0 +1,42 @@
+#ifndef PIT_H
+#define PIT_H
+
+#include <stdint.h>
+#include "clock.h"
+
+// 8253/8254 programmable interval timer
+#define PIT_FREQUENCY   1193182     // Input clock in Hz
+
+#define PIT_CHANNEL0    0x40        // System timer, wired to IRQ 0
+#define PIT_CHANNEL2    0x42        // Speaker channel, gated by port 0x61
+#define PIT_COMMAND     0x43
+#define PIT_PORT_B      0x61        // Bit 0: channel 2 gate, bit 5: channel 2 output
+
+// Command byte fields
+#define PIT_SELECT_CH0  0x00
+#define PIT_SELECT_CH2  0x80
+#define PIT_ACCESS_WORD 0x30        // Low byte then high byte
+#define PIT_MODE_ONESHOT 0x00       // Mode 0: interrupt on terminal count
+#define PIT_MODE_RATE   0x04        // Mode 2: rate generator
+
+#define PIT_GATE2       0x01
+#define PIT_SPEAKER     0x02
+#define PIT_OUT2        0x20
+
+// Largest one-shot interval: 65535 counts is about 54.9 ms
+#define PIT_MAX_DELTA_NS    54000000
+
+// Channel 0 in one-shot mode, for timer_register_clockevent()
+extern struct clock_event_device pit_clockevent;
+
+// Start channel 0 as a periodic tick at hz. IRQ 0 stays as pic_init() left it.
+void pit_init(uint32_t hz);
+
+// Measure the TSC against channel 2 and return its rate in kHz. Uses
+// polling only, so it works with interrupts disabled.
+uint32_t pit_calibrate_tsc(void);
+
+// Timer interrupts taken since pit_init()
+uint64_t pit_ticks(void);
+
+#endif // PIT_H
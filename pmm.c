@@ -0,0 +1,354 @@
+#include "pmm.h"
+#include "klog.h"
+#include "string.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "paging.h"
+#include "init.h"
+#include "trace.h"
+
+// Up to this many reserved ranges are carved out of the memory map
+#define PMM_MAX_RESERVED 16
+
+struct pmm_range {
+    uint64_t start;
+    uint64_t end;
+};
+
+static struct page* pmm_pages;          // Metadata array, indexed by frame number
+static uint32_t pmm_max_pfn;            // One past the highest tracked frame
+static struct page* pmm_free_lists[PMM_MAX_ORDER + 1];
+static struct pmm_stats pmm_stats;
+
+// Guards the free lists and the stats
+static spinlock_t pmm_lock = SPINLOCK_INIT;
+
+static struct pmm_range pmm_reserved[PMM_MAX_RESERVED];
+static int pmm_reserved_count;
+
+static const char* pmm_region_types[] = {
+    "unknown", "available", "reserved", "ACPI reclaimable", "ACPI NVS", "bad RAM"
+};
+
+static inline uint32_t pmm_pfn(const struct page* page) {
+    return page - pmm_pages;
+}
+
+static inline uintptr_t pmm_align_up(uint64_t addr) {
+    return (addr + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+}
+
+static void pmm_list_add(struct page* page, unsigned int order) {
+    page->order = order;
+    page->flags = PAGE_FREE;
+    page->prev = NULL;
+    page->next = pmm_free_lists[order];
+    if (page->next) {
+        page->next->prev = page;
+    }
+    pmm_free_lists[order] = page;
+    pmm_stats.free_blocks[order]++;
+}
+
+static void pmm_list_remove(struct page* page, unsigned int order) {
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        pmm_free_lists[order] = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+    page->flags = 0;
+    pmm_stats.free_blocks[order]--;
+}
+
+// Return a block to the free lists, merging with free buddies. Each merge
+// step is O(1), so freeing costs at most PMM_MAX_ORDER steps.
+static void pmm_free_block(uint32_t pfn, unsigned int order) {
+    pmm_stats.free_pages += 1u << order;
+
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy_pfn = pfn ^ (1u << order);
+        if (buddy_pfn >= pmm_max_pfn) {
+            break;
+        }
+
+        struct page* buddy = &pmm_pages[buddy_pfn];
+        if (!(buddy->flags & PAGE_FREE) || buddy->order != order) {
+            break;
+        }
+
+        pmm_list_remove(buddy, order);
+        pfn &= ~(1u << order);
+        order++;
+    }
+
+    pmm_list_add(&pmm_pages[pfn], order);
+}
+
+uintptr_t pmm_alloc_pages(unsigned int order) {
+    if (order > PMM_MAX_ORDER) {
+        return 0;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    TRACE_BEGIN("pmm_alloc_pages", order);
+
+    unsigned int current = order;
+    while (current <= PMM_MAX_ORDER && !pmm_free_lists[current]) {
+        current++;
+    }
+
+    if (current > PMM_MAX_ORDER) {
+        pmm_stats.failures++;
+        TRACE_END("pmm_alloc_pages", order);
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return 0;
+    }
+
+    struct page* page = pmm_free_lists[current];
+    pmm_list_remove(page, current);
+
+    // Split the block, putting the upper halves back on the free lists
+    while (current > order) {
+        current--;
+        pmm_list_add(page + (1u << current), current);
+    }
+
+    page->order = order;
+    page->private = NULL;
+    pmm_stats.free_pages -= 1u << order;
+    pmm_stats.allocs++;
+
+    TRACE_END("pmm_alloc_pages", order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return (uintptr_t)pmm_pfn(page) << PAGE_SHIFT;
+}
+
+void pmm_free_pages(uintptr_t addr, unsigned int order) {
+    uint32_t pfn = addr >> PAGE_SHIFT;
+
+    if (order > PMM_MAX_ORDER) {
+        KERROR("PMM", "Bad free of 0x%x (order %u)", addr, order);
+        return;
+    }
+
+    // Checked under the lock: a racing free of the same block would
+    // otherwise pass too and be merged twice. The order must be the one
+    // the block was allocated with.
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    if (pfn >= pmm_max_pfn || (pfn & ((1u << order) - 1)) ||
+        (pmm_pages[pfn].flags & (PAGE_FREE | PAGE_RESERVED)) ||
+        pmm_pages[pfn].order != order) {
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        KERROR("PMM", "Bad free of 0x%x (order %u)", addr, order);
+        return;
+    }
+
+    TRACE_BEGIN("pmm_free_pages", order);
+    pmm_free_block(pfn, order);
+    pmm_stats.frees++;
+    TRACE_END("pmm_free_pages", order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+unsigned int pmm_order_for(size_t size) {
+    unsigned int order = 0;
+    while (((size_t)PAGE_SIZE << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+struct page* pmm_page(uintptr_t addr) {
+    uint32_t pfn = addr >> PAGE_SHIFT;
+    return pfn < pmm_max_pfn ? &pmm_pages[pfn] : NULL;
+}
+
+void pmm_get_stats(struct pmm_stats* stats) {
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    *stats = pmm_stats;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+void pmm_dump_stats(void) {
+    struct pmm_stats stats;
+    pmm_get_stats(&stats);
+
+    KINFO("PMM", "%u/%u pages free (%u KiB), %u allocs, %u frees, %u failures",
+          stats.free_pages, stats.total_pages, stats.free_pages * (PAGE_SIZE / 1024),
+          stats.allocs, stats.frees, stats.failures);
+    for (int order = 0; order <= PMM_MAX_ORDER; order++) {
+        if (stats.free_blocks[order]) {
+            KDEBUG("PMM", "  order %d: %u free blocks", order, stats.free_blocks[order]);
+        }
+    }
+}
+
+static void __init pmm_reserve(uint64_t start, uint64_t end) {
+    if (pmm_reserved_count >= PMM_MAX_RESERVED) {
+        KPANIC("PMM", "Too many reserved ranges");
+    }
+
+    // Keep the list sorted by start address
+    int i = pmm_reserved_count++;
+    while (i > 0 && pmm_reserved[i - 1].start > start) {
+        pmm_reserved[i] = pmm_reserved[i - 1];
+        i--;
+    }
+    pmm_reserved[i].start = start & ~(uint64_t)(PAGE_SIZE - 1);
+    pmm_reserved[i].end = pmm_align_up(end);
+}
+
+// Free the whole pages of [start, end), handing them over as the largest
+// naturally aligned blocks that fit
+static void pmm_add_free(uint64_t start, uint64_t end) {
+    uint32_t pfn = pmm_align_up(start) >> PAGE_SHIFT;
+    uint32_t end_pfn = end >> PAGE_SHIFT;
+
+    while (pfn < end_pfn) {
+        unsigned int order = 0;
+        while (order < PMM_MAX_ORDER &&
+               !(pfn & ((2u << order) - 1)) &&
+               pfn + (2u << order) <= end_pfn) {
+            order++;
+        }
+
+        for (uint32_t i = 0; i < (1u << order); i++) {
+            pmm_pages[pfn + i].flags = 0;
+        }
+        pmm_stats.total_pages += 1u << order;
+        pmm_free_block(pfn, order);
+        pfn += 1u << order;
+    }
+}
+
+// Free an available region minus every reserved range that overlaps it
+static void __init pmm_add_region(uint64_t start, uint64_t end) {
+    for (int i = 0; i < pmm_reserved_count && start < end; i++) {
+        const struct pmm_range* r = &pmm_reserved[i];
+        if (r->end <= start || r->start >= end) {
+            continue;
+        }
+        if (r->start > start) {
+            pmm_add_free(start, r->start);
+        }
+        start = r->end;
+    }
+
+    if (start < end) {
+        pmm_add_free(start, end);
+    }
+}
+
+#define for_each_mmap_entry(e, mbi)                                                 \
+    for (const struct multiboot_mmap_entry* e =                                     \
+             (const struct multiboot_mmap_entry*)phys_to_virt((mbi)->mmap_addr);    \
+         virt_to_phys(e) < (mbi)->mmap_addr + (mbi)->mmap_length;                   \
+         e = (const struct multiboot_mmap_entry*)((uintptr_t)e + e->size + sizeof(e->size)))
+
+void __init pmm_init(const struct multiboot_info* mbi) {
+    KINFO_INIT("PMM", "Initializing physical memory manager...");
+
+    if (!(mbi->flags & MULTIBOOT_INFO_MEM_MAP)) {
+        KPANIC("PMM", "Bootloader did not provide a memory map");
+    }
+
+    // Find the highest usable frame covered by the direct map
+    uint64_t top = 0;
+    for_each_mmap_entry(e, mbi) {
+        uint64_t end = e->addr + e->len;
+        KDEBUG_INIT("PMM", "  0x%09llx - 0x%09llx %s", e->addr, end - 1,
+                    pmm_region_types[e->type <= MULTIBOOT_MEMORY_BADRAM ? e->type : 0]);
+
+        if (e->type == MULTIBOOT_MEMORY_AVAILABLE && end > top) {
+            top = end;
+        }
+    }
+    if (top > paging_direct_map_size()) {
+        top = paging_direct_map_size();
+    }
+    pmm_max_pfn = top >> PAGE_SHIFT;
+
+    // Reserve everything that is in use before the allocator exists
+    uintptr_t kernel_start = virt_to_phys(_kernel_start);
+    uintptr_t kernel_end = virt_to_phys(_kernel_end);
+    pmm_reserve(0, PMM_LOW_MEMORY);
+    pmm_reserve(kernel_start, kernel_end);
+    pmm_reserve(virt_to_phys(mbi), virt_to_phys(mbi) + sizeof(*mbi));
+    pmm_reserve(mbi->mmap_addr, mbi->mmap_addr + mbi->mmap_length);
+    if (mbi->flags & MULTIBOOT_INFO_CMDLINE) {
+        pmm_reserve(mbi->cmdline, mbi->cmdline + PAGE_SIZE);
+    }
+    if (mbi->flags & MULTIBOOT_INFO_MODS) {
+        const struct multiboot_module* mods = phys_to_virt(mbi->mods_addr);
+        pmm_reserve(mbi->mods_addr, mbi->mods_addr + mbi->mods_count * sizeof(*mods));
+        for (uint32_t i = 0; i < mbi->mods_count; i++) {
+            pmm_reserve(mods[i].mod_start, mods[i].mod_end);
+        }
+    }
+
+    // Place the frame metadata in the first available memory that does not
+    // overlap anything reserved so far
+    size_t meta_size = pmm_max_pfn * sizeof(struct page);
+    uint64_t meta_start = 0;
+    for_each_mmap_entry(e, mbi) {
+        if (e->type != MULTIBOOT_MEMORY_AVAILABLE) {
+            continue;
+        }
+
+        uint64_t candidate = pmm_align_up(e->addr);
+        for (int i = 0; i < pmm_reserved_count; i++) {
+            if (pmm_reserved[i].start < candidate + meta_size && pmm_reserved[i].end > candidate) {
+                candidate = pmm_reserved[i].end;
+            }
+        }
+        if (candidate + meta_size <= e->addr + e->len && candidate + meta_size <= top) {
+            meta_start = candidate;
+            break;
+        }
+    }
+    if (!meta_start) {
+        KPANIC("PMM", "No room for %u bytes of page metadata", meta_size);
+    }
+    pmm_reserve(meta_start, meta_start + meta_size);
+    pmm_pages = phys_to_virt(meta_start);
+
+    for (uint32_t pfn = 0; pfn < pmm_max_pfn; pfn++) {
+        pmm_pages[pfn].next = NULL;
+        pmm_pages[pfn].prev = NULL;
+        pmm_pages[pfn].order = 0;
+        pmm_pages[pfn].flags = PAGE_RESERVED;
+        pmm_pages[pfn].private = NULL;
+    }
+
+    for_each_mmap_entry(e, mbi) {
+        if (e->type != MULTIBOOT_MEMORY_AVAILABLE || e->addr >= top) {
+            continue;
+        }
+        uint64_t end = e->addr + e->len;
+        pmm_add_region(e->addr, end < top ? end : top);
+    }
+
+    KINFO_INIT("PMM", "Kernel image 0x%x - 0x%x, %u KiB of page metadata at 0x%x",
+               kernel_start, kernel_end, meta_size / 1024, (uint32_t)meta_start);
+    KINFO_INIT("PMM", "%u MiB usable, %u pages free", pmm_stats.total_pages / 256,
+               pmm_stats.free_pages);
+}
+
+void pmm_free_initmem(void) {
+    uintptr_t start = virt_to_phys(__init_start);
+    uintptr_t end = virt_to_phys(__init_end);
+
+    // Fill with INT3 so a stray call into freed init code traps at once
+    // rather than running whatever the page is reused for later
+    memset(__init_start, 0xCC, end - start);
+
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    pmm_add_free(start, end);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+
+    KINFO("PMM", "Freed %u bytes of init memory (%u pages)", end - start,
+          (end - start) / PAGE_SIZE);
+}
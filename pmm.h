@@ -0,0 +1,79 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "multiboot.h"
+
+#define PAGE_SIZE       4096
+#define PAGE_SHIFT      12
+
+// Largest block handed out by the buddy allocator: 2^10 pages = 4 MiB
+#define PMM_MAX_ORDER   10
+
+// Memory below this address (BIOS data, VGA, option ROMs) is never managed
+#define PMM_LOW_MEMORY  0x100000
+
+// struct page flags
+#define PAGE_FREE       0x01    // Head page of a free buddy block
+#define PAGE_RESERVED   0x02    // Not managed (hole, firmware, kernel image)
+#define PAGE_SLAB       0x04    // Owned by a slab cache, private = struct slab
+#define PAGE_KMALLOC    0x08    // Head of a large kmalloc() block
+
+// Per-frame metadata, one per physical page up to the highest usable frame
+struct page {
+    struct page* next;          // Free list links (valid while PAGE_FREE)
+    struct page* prev;
+    uint8_t order;              // Order of the block this page heads
+    uint8_t flags;
+    uint16_t reserved;
+    void* private;              // Owner data while allocated
+};
+
+struct pmm_stats {
+    uint32_t total_pages;       // Pages handed to the allocator at boot
+    uint32_t free_pages;
+    uint32_t free_blocks[PMM_MAX_ORDER + 1];
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failures;
+};
+
+// Linker-provided bounds of the kernel image (virtual addresses)
+extern char _kernel_start[];
+extern char _kernel_end[];
+
+// Build the allocator from the Multiboot memory map
+void pmm_init(const struct multiboot_info* mbi);
+
+// Release the .init section to the allocator. Called once, after the last
+// __init function has returned.
+void pmm_free_initmem(void);
+
+// Allocate 2^order physically contiguous pages. Returns the physical address
+// of the first page, or 0 if no block is large enough. All managed memory is
+// inside the direct map, so phys_to_virt() gives a usable pointer.
+uintptr_t pmm_alloc_pages(unsigned int order);
+
+// Free a block previously returned by pmm_alloc_pages() with the same order
+void pmm_free_pages(uintptr_t addr, unsigned int order);
+
+static inline uintptr_t pmm_alloc_page(void) {
+    return pmm_alloc_pages(0);
+}
+
+static inline void pmm_free_page(uintptr_t addr) {
+    pmm_free_pages(addr, 0);
+}
+
+// Smallest order whose block holds at least size bytes
+unsigned int pmm_order_for(size_t size);
+
+// Metadata for the frame containing physical address addr, or NULL if it is
+// not tracked
+struct page* pmm_page(uintptr_t addr);
+
+void pmm_get_stats(struct pmm_stats* stats);
+void pmm_dump_stats(void);
+
+#endif // PMM_H
@@ -0,0 +1,219 @@
+#include "profile.h"
+#include "idt.h"
+#include "timer.h"
+#include "sched.h"
+#include "smp.h"
+#include "pmm.h"
+#include "paging.h"
+#include "serial.h"
+#include "string.h"
+#include "klog.h"
+
+#define PROFILE_BUCKET_MASK (PROFILE_BUCKETS - 1)
+
+// Retry interval while the serial transmit ring is full
+#define PROFILE_DUMP_WAIT_NS    (10 * NSEC_PER_MSEC)
+
+// One distinct call stack, leaf first. count is written last, so a
+// non-zero count means the stack is complete.
+struct profile_entry {
+    volatile uint32_t count;
+    uint32_t depth;
+    uint32_t pcs[PROFILE_MAX_DEPTH];
+};
+
+// Only touched by the owning CPU's timer interrupt, except by dump and reset
+struct profile_cpu {
+    struct profile_entry* table;
+    struct timer timer;
+    uint32_t samples;
+    uint32_t dropped;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct profile_cpu profile_cpus[MAX_CPUS];
+
+#define PROFILE_PERIOD_NS   (NSEC_PER_SEC / (PROFILE_HZ ? PROFILE_HZ : 1))
+
+// Follow saved frame pointers up the interrupted stack. Every frame must
+// lie above the last one and inside the stack, so a garbage %ebp from code
+// built without frame pointers just ends the walk.
+static uint32_t profile_unwind(const struct interrupt_frame* frame, uint32_t* pcs) {
+    uint32_t depth = 0;
+    pcs[depth++] = frame->eip;
+
+#ifdef FRAME_POINTERS
+    struct cpu* cpu = this_cpu();
+    struct thread* t = cpu->current;
+
+    // A kernel-mode interrupt pushes no esp; the old stack ends at useresp
+    uintptr_t low = (uintptr_t)&frame->useresp;
+    uintptr_t high = t && t->stack ? (uintptr_t)phys_to_virt(t->stack) + THREAD_STACK_SIZE
+                                   : cpu->stack_top;
+    uintptr_t fp = frame->ebp;
+
+    while (depth < PROFILE_MAX_DEPTH) {
+        if (fp < low || fp > high - 2 * sizeof(uint32_t) || (fp & 3)) {
+            break;
+        }
+        const uint32_t* link = (const uint32_t*)fp;
+        if (!link[1]) {
+            break;
+        }
+        pcs[depth++] = link[1];
+        if (link[0] <= fp) {
+            break;
+        }
+        fp = link[0];
+    }
+#endif
+
+    return depth;
+}
+
+static void profile_record(struct profile_cpu* pc, const uint32_t* pcs, uint32_t depth) {
+    uint32_t hash = depth;
+    for (uint32_t i = 0; i < depth; i++) {
+        hash = (hash ^ pcs[i]) * 0x9E3779B1u;
+    }
+
+    for (uint32_t probe = 0; probe < PROFILE_MAX_PROBE; probe++) {
+        struct profile_entry* e = &pc->table[(hash + probe) & PROFILE_BUCKET_MASK];
+
+        if (!e->count) {
+            e->depth = depth;
+            memcpy(e->pcs, pcs, depth * sizeof(uint32_t));
+            __atomic_store_n(&e->count, 1, __ATOMIC_RELEASE);
+            pc->samples++;
+            return;
+        }
+        if (e->depth == depth && !memcmp(e->pcs, pcs, depth * sizeof(uint32_t))) {
+            e->count++;
+            pc->samples++;
+            return;
+        }
+    }
+    pc->dropped++;
+}
+
+// Timer callback, inside the timer interrupt whose frame is sampled
+static void profile_sample(void* data) {
+    struct profile_cpu* pc = data;
+    struct interrupt_frame* frame = this_cpu()->irq_frame;
+
+    timer_add(&pc->timer, PROFILE_PERIOD_NS);
+
+    if (frame) {
+        uint32_t pcs[PROFILE_MAX_DEPTH];
+        profile_record(pc, pcs, profile_unwind(frame, pcs));
+    }
+}
+
+void __init profile_init(void) {
+    struct profile_cpu* pc = &profile_cpus[cpu_id()];
+
+    if (!PROFILE_HZ) {
+        return;
+    }
+
+    size_t size = PROFILE_BUCKETS * sizeof(struct profile_entry);
+    uintptr_t table = pmm_alloc_pages(pmm_order_for(size));
+    if (!table) {
+        KERROR("PROF", "No memory for the CPU %u histogram", cpu_id());
+        return;
+    }
+    pc->table = phys_to_virt(table);
+    memset(pc->table, 0, size);
+
+    timer_setup(&pc->timer, profile_sample, pc);
+    timer_add(&pc->timer, PROFILE_PERIOD_NS);
+
+    if (cpu_id() == 0) {
+        KINFO_INIT("PROF", "Sampling at %u Hz, %u stacks per CPU, depth %u",
+                   PROFILE_HZ, PROFILE_BUCKETS, PROFILE_MAX_DEPTH);
+    }
+}
+
+// Queue a whole line, waiting for the UART to make room
+static void profile_write(const char* line, size_t len) {
+    while (!serial_write(SERIAL_COM1, line, len)) {
+        serial_flush(SERIAL_COM1);
+        thread_sleep(PROFILE_DUMP_WAIT_NS);
+    }
+}
+
+void profile_dump(void) {
+    // Room for the counts and PROFILE_MAX_DEPTH addresses
+    char line[32 + PROFILE_MAX_DEPTH * 11];
+    struct profile_stats stats;
+    size_t len;
+
+    profile_get_stats(&stats);
+    len = ksnprintf(line, sizeof(line), "PROFILE BEGIN %u %u %u\n",
+                    PROFILE_HZ, stats.samples, stats.dropped);
+    profile_write(line, len);
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct profile_entry* table = profile_cpus[cpu].table;
+        if (!table) {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < PROFILE_BUCKETS; i++) {
+            uint32_t count = __atomic_load_n(&table[i].count, __ATOMIC_ACQUIRE);
+            if (!count) {
+                continue;
+            }
+            len = ksnprintf(line, sizeof(line), "PROFILE %u %u", cpu, count);
+            for (uint32_t d = 0; d < table[i].depth; d++) {
+                len += ksnprintf(line + len, sizeof(line) - len, " %x", table[i].pcs[d]);
+            }
+            line[len++] = '\n';
+            profile_write(line, len);
+        }
+    }
+
+    profile_write("PROFILE END\n", 12);
+    serial_flush(SERIAL_COM1);
+}
+
+void profile_reset(void) {
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct profile_cpu* pc = &profile_cpus[cpu];
+        if (pc->table) {
+            // Racing samples on other CPUs may survive; that is harmless
+            memset(pc->table, 0, PROFILE_BUCKETS * sizeof(struct profile_entry));
+            pc->samples = 0;
+            pc->dropped = 0;
+        }
+    }
+}
+
+void profile_get_stats(struct profile_stats* stats) {
+    *stats = (struct profile_stats){ 0 };
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct profile_cpu* pc = &profile_cpus[cpu];
+        if (!pc->table) {
+            continue;
+        }
+        stats->samples += pc->samples;
+        stats->dropped += pc->dropped;
+        for (uint32_t i = 0; i < PROFILE_BUCKETS; i++) {
+            if (pc->table[i].count) {
+                stats->stacks++;
+            }
+        }
+    }
+}
+
+void profile_dump_stats(void) {
+    struct profile_stats stats;
+
+    if (!PROFILE_HZ) {
+        return;
+    }
+    profile_get_stats(&stats);
+
+    KINFO("PROF", "%u samples, %u distinct stacks, %u dropped",
+          stats.samples, stats.stacks, stats.dropped);
+}
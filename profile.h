@@ -0,0 +1,47 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+// Samples per second and CPU; 0 builds the profiler in but never arms it.
+// The timer wheel's resolution (about 1 ms) caps the useful rate.
+#ifndef PROFILE_HZ
+#define PROFILE_HZ          0
+#endif
+
+// Histogram entries per CPU (must be a power of two), and how far an
+// insertion probes before the sample is dropped
+#define PROFILE_BUCKETS     512
+#define PROFILE_MAX_PROBE   16
+
+// Call stack depth per sample. Without frame pointers only the interrupted
+// EIP is meaningful.
+#ifdef FRAME_POINTERS
+#define PROFILE_MAX_DEPTH   8
+#else
+#define PROFILE_MAX_DEPTH   1
+#endif
+
+struct profile_stats {
+    uint32_t samples;           // Samples recorded
+    uint32_t dropped;           // Samples lost to a full histogram
+    uint32_t stacks;            // Distinct stacks in the histograms
+};
+
+// Allocate the calling CPU's histogram and start sampling it at PROFILE_HZ.
+// The boot CPU calls it after apic_init(), application processors after
+// apic_init_ap().
+void profile_init(void);
+
+// Write every CPU's histogram to COM1, one "PROFILE" line per stack, for
+// tools/profsym.py. Thread context only: waits for room in the transmit
+// ring.
+void profile_dump(void);
+
+// Forget all samples
+void profile_reset(void);
+
+void profile_get_stats(struct profile_stats* stats);
+void profile_dump_stats(void);
+
+#endif // PROFILE_H
@@ -0,0 +1,543 @@
+#include "sched.h"
+#include "smp.h"
+#include "apic.h"
+#include "irq.h"
+#include "slab.h"
+#include "pmm.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "clock.h"
+#include "cpu.h"
+#include "klog.h"
+
+// One per CPU. Wakeups and new threads are queued on the CPU that makes
+// them runnable; only stealing touches another CPU's queue.
+struct runqueue {
+    spinlock_t lock;
+    uint32_t bitmap;                    // Bit p set: queue p is non-empty
+    volatile uint32_t nr_queued;        // Runnable threads waiting, not counting current
+    struct thread* head[SCHED_PRIORITIES];
+    struct thread* tail[SCHED_PRIORITIES];
+
+    struct thread idle;                 // The CPU's boot context
+    struct thread* last;                // Thread switched away from, for the one switched to
+    struct timer slice_timer;
+
+    uint64_t lock_tsc;                  // When the lock was taken
+    uint64_t switch_tsc;                // When the last switch started
+    // Odd while the lock is held, so sched_get_stats() can copy the stats
+    // without taking it
+    uint32_t stats_seq;
+    struct sched_stats stats;           // Times in TSC cycles until sched_get_stats()
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct runqueue runqueues[MAX_CPUS];
+static struct kmem_cache* thread_cache;
+static uint32_t thread_next_id = 1;
+
+// switch.s
+extern void context_switch(uint32_t* prev_esp, uint32_t next_esp);
+extern void thread_start(void);
+
+void sched_thread_start(void);
+
+// Interrupts must be off so the caller cannot move to another CPU
+static inline struct runqueue* this_rq(void) {
+    return &runqueues[cpu_id()];
+}
+
+static inline void rq_lock(struct runqueue* rq) {
+    spin_lock(&rq->lock);
+    __atomic_store_n(&rq->stats_seq, rq->stats_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rq->lock_tsc = rdtsc();
+}
+
+static inline void rq_unlock(struct runqueue* rq) {
+    uint64_t held = rdtsc() - rq->lock_tsc;
+    rq->stats.lock_holds++;
+    rq->stats.lock_hold_ns += held;
+    if (held > rq->stats.lock_hold_max_ns) {
+        rq->stats.lock_hold_max_ns = held;
+    }
+    __atomic_store_n(&rq->stats_seq, rq->stats_seq + 1, __ATOMIC_RELEASE);
+    spin_unlock(&rq->lock);
+}
+
+static void rq_enqueue(struct runqueue* rq, struct thread* t) {
+    unsigned int prio = t->priority;
+
+    t->next = NULL;
+    if (rq->tail[prio]) {
+        rq->tail[prio]->next = t;
+    } else {
+        rq->head[prio] = t;
+    }
+    rq->tail[prio] = t;
+    rq->bitmap |= 1u << prio;
+    rq->nr_queued++;
+    t->state = THREAD_RUNNABLE;
+}
+
+// Remove and return the most urgent waiting thread, or NULL
+static struct thread* rq_pop(struct runqueue* rq) {
+    if (!rq->bitmap) {
+        return NULL;
+    }
+
+    unsigned int prio = __builtin_ctz(rq->bitmap);
+    struct thread* t = rq->head[prio];
+    rq->head[prio] = t->next;
+    if (!t->next) {
+        rq->tail[prio] = NULL;
+        rq->bitmap &= ~(1u << prio);
+    }
+    rq->nr_queued--;
+    return t;
+}
+
+// Same, skipping pinned threads, for stealing
+static struct thread* rq_pop_movable(struct runqueue* rq) {
+    uint32_t bits = rq->bitmap;
+
+    while (bits) {
+        unsigned int prio = __builtin_ctz(bits);
+        bits &= bits - 1;
+
+        struct thread* prev = NULL;
+        for (struct thread* t = rq->head[prio]; t; prev = t, t = t->next) {
+            if (t->pinned) {
+                continue;
+            }
+            if (prev) {
+                prev->next = t->next;
+            } else {
+                rq->head[prio] = t->next;
+            }
+            if (rq->tail[prio] == t) {
+                rq->tail[prio] = prev;
+            }
+            if (!rq->head[prio]) {
+                rq->bitmap &= ~(1u << prio);
+            }
+            rq->nr_queued--;
+            return t;
+        }
+    }
+    return NULL;
+}
+
+int sched_in_idle(void) {
+    struct cpu* cpu = this_cpu();
+    return cpu->current == &runqueues[cpu->id].idle;
+}
+
+// The idle CPU steals from its own idle loop
+void sched_kick_idle(void) {
+    if (!apic_enabled()) {
+        return;
+    }
+
+    uint32_t self = cpu_id();
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (i != self && cpus[i].online && cpus[i].current == &runqueues[i].idle) {
+            lapic_send_ipi(cpus[i].apic_id, APIC_RESCHED_VECTOR);
+            return;
+        }
+    }
+}
+
+// Move one waiting thread from the first busy CPU found to this one
+static void sched_steal(struct runqueue* rq) {
+    uint32_t self = cpu_id();
+
+    for (uint32_t i = 1; i < MAX_CPUS; i++) {
+        uint32_t victim_id = (self + i) % MAX_CPUS;
+        struct runqueue* victim = &runqueues[victim_id];
+        if (!cpus[victim_id].online || !victim->nr_queued) {
+            continue;
+        }
+
+        // Never hold two run queue locks at once
+        uint32_t flags = irq_save();
+        rq_lock(victim);
+        struct thread* t = rq_pop_movable(victim);
+        rq_unlock(victim);
+
+        if (t) {
+            rq_lock(rq);
+            rq_enqueue(rq, t);
+            rq->stats.steals++;
+            rq_unlock(rq);
+            irq_restore(flags);
+            return;
+        }
+        irq_restore(flags);
+    }
+}
+
+static void thread_free(struct thread* t) {
+    fpu_release(t);
+    pmm_free_pages(t->stack, pmm_order_for(THREAD_STACK_SIZE));
+    kmem_cache_free(thread_cache, t);
+}
+
+// Second half of a switch, on the new thread's stack: account the switch,
+// let the old thread be picked up elsewhere and drop the lock schedule()
+// took
+static void sched_finish_switch(void) {
+    struct runqueue* rq = this_rq();
+    struct thread* prev = rq->last;
+
+    uint64_t latency = rdtsc() - rq->switch_tsc;
+    rq->stats.switch_ns += latency;
+    if (latency > rq->stats.switch_max_ns) {
+        rq->stats.switch_max_ns = latency;
+    }
+
+    int dead = prev->state == THREAD_DEAD;
+    __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+    rq_unlock(rq);
+
+    if (dead) {
+        thread_free(prev);
+    }
+}
+
+// preempt: called because need_resched was set on the way out of an
+// interrupt, so a switch away from the running thread is a preemption
+static void sched_switch(int preempt) {
+    uint32_t flags = irq_save();
+    struct cpu* cpu = this_cpu();
+    struct runqueue* rq = &runqueues[cpu->id];
+    struct thread* prev = cpu->current;
+
+    rq_lock(rq);
+    cpu->need_resched = 0;
+
+    if (prev->state == THREAD_RUNNING && prev != &rq->idle) {
+        rq_enqueue(rq, prev);
+    }
+
+    struct thread* next = rq_pop(rq);
+    if (!next) {
+        next = &rq->idle;
+    }
+    if (next == prev) {
+        prev->state = THREAD_RUNNING;
+        rq_unlock(rq);
+        irq_restore(flags);
+        return;
+    }
+    if (preempt) {
+        rq->stats.preemptions++;
+    }
+
+    // A thread woken just as it blocked elsewhere may still be on that
+    // CPU's stack for a moment
+    while (__atomic_load_n(&next->on_cpu, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+
+    uint64_t now = ktime_ns();
+    prev->runtime_ns += now - prev->switched_in_ns;
+    next->switched_in_ns = now;
+    next->switches++;
+    next->state = THREAD_RUNNING;
+    next->on_cpu = 1;
+    next->cpu = cpu->id;
+    cpu->current = next;
+
+    // Idle runs until something else is runnable; everyone else gets a slice
+    if (next != &rq->idle) {
+        timer_add(&rq->slice_timer, SCHED_SLICE_NS);
+    } else {
+        timer_cancel(&rq->slice_timer);
+    }
+
+    fpu_switch(prev, next);
+
+    rq->last = prev;
+    rq->stats.switches++;
+    rq->switch_tsc = rdtsc();
+    context_switch(&prev->esp, next->esp);
+
+    // Back, possibly on another CPU
+    sched_finish_switch();
+    irq_restore(flags);
+}
+
+void schedule(void) {
+    sched_switch(0);
+}
+
+// First code a new thread runs, entered from thread_start in switch.s
+void sched_thread_start(void) {
+    sched_finish_switch();
+
+    struct thread* self = current_thread();
+    __asm__ volatile ("sti");
+    self->entry(self->arg);
+    thread_exit();
+}
+
+static void sched_slice_expired(void* data) {
+    this_cpu()->need_resched = 1;
+}
+
+static void thread_sleep_expired(void* data) {
+    struct thread* t = data;
+
+    __atomic_store_n(&t->sleep_expired, 1, __ATOMIC_RELEASE);
+    thread_wake(t);
+}
+
+static struct thread* thread_spawn(const char* name, void (*entry)(void* arg), void* arg,
+                                   unsigned int priority, int pinned) {
+    if (priority >= SCHED_PRIORITIES) {
+        priority = SCHED_PRIORITIES - 1;
+    }
+
+    struct thread* t = kmem_cache_alloc(thread_cache);
+    if (!t) {
+        return NULL;
+    }
+    uintptr_t stack = pmm_alloc_pages(pmm_order_for(THREAD_STACK_SIZE));
+    if (!stack) {
+        kmem_cache_free(thread_cache, t);
+        KERROR("SCHED", "No stack for thread %s", name);
+        return NULL;
+    }
+
+    t->id = __atomic_fetch_add(&thread_next_id, 1, __ATOMIC_RELAXED);
+    t->name = name;
+    t->priority = priority;
+    t->pinned = pinned;
+    t->fpu = NULL;
+    t->fpu_cpu = FPU_NO_CPU;
+    t->on_cpu = 0;
+    t->wake_pending = 0;
+    t->stack = stack;
+    t->entry = entry;
+    t->arg = arg;
+    t->switches = 0;
+    t->runtime_ns = 0;
+    timer_setup(&t->sleep_timer, thread_sleep_expired, t);
+
+    // What context_switch() pops: the callee-saved registers, then the
+    // return address. thread_start gets a null return address of its own.
+    uint32_t* sp = (uint32_t*)((uintptr_t)phys_to_virt(stack) + THREAD_STACK_SIZE);
+    *--sp = 0;
+    *--sp = (uint32_t)thread_start;
+    *--sp = 0;                          // ebp
+    *--sp = 0;                          // ebx
+    *--sp = 0;                          // esi
+    *--sp = 0;                          // edi
+    t->esp = (uint32_t)sp;
+
+    uint32_t flags = irq_save();
+    struct runqueue* rq = this_rq();
+    rq_lock(rq);
+    t->cpu = cpu_id();
+    rq_enqueue(rq, t);
+    if (t->priority < current_thread()->priority) {
+        this_cpu()->need_resched = 1;
+    }
+    rq_unlock(rq);
+    sched_kick_idle();
+    irq_restore(flags);
+
+    KDEBUG("SCHED", "Thread %u (%s) created, priority %u", t->id, name, priority);
+    return t;
+}
+
+struct thread* thread_create(const char* name, void (*entry)(void* arg), void* arg,
+                             unsigned int priority) {
+    return thread_spawn(name, entry, arg, priority, 0);
+}
+
+struct thread* thread_create_pinned(const char* name, void (*entry)(void* arg), void* arg,
+                                    unsigned int priority) {
+    return thread_spawn(name, entry, arg, priority, 1);
+}
+
+void thread_yield(void) {
+    schedule();
+}
+
+void thread_block(void) {
+    uint32_t flags = irq_save();
+    struct thread* self = current_thread();
+
+    __atomic_store_n(&self->state, THREAD_BLOCKED, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&self->wake_pending, 0, __ATOMIC_SEQ_CST)) {
+        // Woken before getting here. Unless the waker has just queued us
+        // anyway, carry on running.
+        uint8_t expected = THREAD_BLOCKED;
+        if (__atomic_compare_exchange_n(&self->state, &expected, THREAD_RUNNING, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            irq_restore(flags);
+            return;
+        }
+    }
+
+    schedule();
+    irq_restore(flags);
+}
+
+int thread_wake(struct thread* t) {
+    __atomic_store_n(&t->wake_pending, 1, __ATOMIC_SEQ_CST);
+
+    uint8_t expected = THREAD_BLOCKED;
+    if (!__atomic_compare_exchange_n(&t->state, &expected, THREAD_RUNNABLE, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        return 0;
+    }
+
+    uint32_t flags = irq_save();
+    uint32_t cpu = t->pinned ? t->cpu : cpu_id();
+    struct runqueue* rq = &runqueues[cpu];
+    rq_lock(rq);
+    rq_enqueue(rq, t);
+    if (cpu == cpu_id() && t->priority < current_thread()->priority) {
+        this_cpu()->need_resched = 1;
+    }
+    rq_unlock(rq);
+
+    if (cpu != cpu_id()) {
+        // Nobody else may take it, so its own CPU has to notice
+        if (cpus[cpu].current == &rq->idle && apic_enabled()) {
+            lapic_send_ipi(cpus[cpu].apic_id, APIC_RESCHED_VECTOR);
+        }
+    } else {
+        sched_kick_idle();
+    }
+    irq_restore(flags);
+    return 1;
+}
+
+void thread_sleep(uint64_t ns) {
+    struct thread* self = current_thread();
+
+    // Wait on the timer itself, not the clock: after the wakeup the thread
+    // may run on a CPU whose clock still reads earlier, with no timer left
+    // to wake it again
+    self->sleep_expired = 0;
+    timer_add(&self->sleep_timer, ns);
+    while (!__atomic_load_n(&self->sleep_expired, __ATOMIC_ACQUIRE)) {
+        thread_block();
+    }
+}
+
+void thread_exit(void) {
+    irq_save();
+    current_thread()->state = THREAD_DEAD;
+    schedule();
+
+    // The next thread frees this one; nothing switches back here
+    for (;;) {
+    }
+}
+
+void sched_irq_exit(void) {
+    struct cpu* cpu = this_cpu();
+
+    // The idle thread notices for itself once its halt returns
+    if (cpu->need_resched && cpu->current != &runqueues[cpu->id].idle) {
+        sched_switch(1);
+    }
+}
+
+// Only here to end an idle CPU's halt; sched_irq_exit() does the rest
+static void sched_resched_irq(struct interrupt_frame* frame, void* ctx) {
+}
+
+void sched_idle(void) {
+    irq_save();
+    struct runqueue* rq = this_rq();
+
+    if (!rq->nr_queued) {
+        sched_steal(rq);
+    }
+    if (rq->nr_queued || this_cpu()->need_resched) {
+        schedule();
+        __asm__ volatile ("sti");
+        return;
+    }
+
+    // Anything made runnable from here on comes with an interrupt (a local
+    // one, or the IPI from sched_kick_idle()) that ends the halt
+    timer_idle();
+}
+
+// Turn the calling CPU's current context into its idle thread
+static void sched_init_cpu(void) {
+    struct cpu* cpu = this_cpu();
+    struct runqueue* rq = &runqueues[cpu->id];
+    struct thread* idle = &rq->idle;
+
+    idle->name = "idle";
+    idle->priority = SCHED_PRIO_IDLE;
+    idle->state = THREAD_RUNNING;
+    idle->on_cpu = 1;
+    idle->cpu = cpu->id;
+    idle->fpu_cpu = FPU_NO_CPU;
+    idle->switched_in_ns = ktime_ns();
+    timer_setup(&rq->slice_timer, sched_slice_expired, NULL);
+    cpu->current = idle;
+}
+
+void __init sched_init(void) {
+    thread_cache = kmem_cache_create("thread", sizeof(struct thread), 0, KMEM_HWALIGN, NULL);
+    request_irq(APIC_RESCHED_VECTOR, sched_resched_irq, NULL);
+    sched_init_cpu();
+    KINFO_INIT("SCHED", "%d priorities, %u ms slices, %d KiB thread stacks",
+               SCHED_PRIORITIES, (uint32_t)(SCHED_SLICE_NS / NSEC_PER_MSEC),
+               THREAD_STACK_SIZE / 1024);
+}
+
+void __init sched_init_ap(void) {
+    sched_init_cpu();
+}
+
+void sched_get_stats(uint32_t cpu, struct sched_stats* stats) {
+    struct runqueue* rq = &runqueues[cpu];
+
+    // Taking the lock would count in the very lock statistics read here and
+    // hold up the CPU that owns the queue. Copy until no holder overlapped.
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&rq->stats_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            cpu_relax();
+            continue;
+        }
+        *stats = rq->stats;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&rq->stats_seq, __ATOMIC_RELAXED) == seq) {
+            break;
+        }
+    }
+
+    stats->switch_ns = clock_cycles_to_ns(stats->switch_ns);
+    stats->switch_max_ns = clock_cycles_to_ns(stats->switch_max_ns);
+    stats->lock_hold_ns = clock_cycles_to_ns(stats->lock_hold_ns);
+    stats->lock_hold_max_ns = clock_cycles_to_ns(stats->lock_hold_max_ns);
+}
+
+void sched_dump_stats(void) {
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!cpus[cpu].online) {
+            continue;
+        }
+
+        struct sched_stats s;
+        sched_get_stats(cpu, &s);
+        uint32_t switch_avg = s.switches ? (uint32_t)(s.switch_ns / s.switches) : 0;
+        uint32_t hold_avg = s.lock_holds ? (uint32_t)(s.lock_hold_ns / s.lock_holds) : 0;
+
+        KINFO("SCHED", "CPU %u: %u switches, %u preempted, %u stolen", cpu,
+              s.switches, s.preemptions, s.steals);
+        KINFO("SCHED", "CPU %u: switch %u ns avg, %u ns max; rq lock held %u ns avg, %u ns max",
+              cpu, switch_avg, (uint32_t)s.switch_max_ns, hold_avg, (uint32_t)s.lock_hold_max_ns);
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include "timer.h"
+#include "fpu.h"
+
+// Priorities run from 0 (most urgent) to SCHED_PRIORITIES - 1. Each CPU
+// keeps one FIFO per priority plus a bitmap of the non-empty ones, so
+// picking the next thread is a single bit scan.
+#define SCHED_PRIORITIES        32
+#define SCHED_PRIO_DEFAULT      16
+#define SCHED_PRIO_IDLE         SCHED_PRIORITIES    // Below every real thread
+
+// Longest a thread runs before others of its priority get a turn
+#define SCHED_SLICE_NS          (10 * NSEC_PER_MSEC)
+
+#define THREAD_STACK_SIZE       8192
+
+typedef enum {
+    THREAD_RUNNABLE,            // On a run queue
+    THREAD_RUNNING,
+    THREAD_BLOCKED,             // Waiting for thread_wake()
+    THREAD_DEAD,                // Exited, freed by the next thread to run
+} thread_state_t;
+
+struct thread {
+    uint32_t esp;               // Saved by context_switch()
+    struct thread* next;        // Run queue link
+    uint32_t id;
+    const char* name;
+    volatile uint8_t state;
+    uint8_t priority;
+    uint8_t cpu;                // CPU it last ran on
+    uint8_t pinned;             // Stays on cpu: never stolen, woken there
+    volatile uint8_t on_cpu;    // Still running until the switch away completes
+    volatile uint8_t wake_pending;  // Woken while not blocked
+    uintptr_t stack;            // Physical base of the stack, 0 for idle threads
+    void (*entry)(void* arg);
+    void* arg;
+    struct timer sleep_timer;
+    volatile uint8_t sleep_expired; // Set by sleep_timer; thread_sleep() waits on it
+    struct fpu_state* fpu;      // Saved FPU/SSE registers, allocated on first use
+    uint8_t fpu_cpu;            // CPU whose registers hold them, or FPU_NO_CPU
+
+    uint32_t switches;          // Times switched in
+    uint64_t runtime_ns;
+    uint64_t switched_in_ns;
+};
+
+struct sched_stats {
+    uint32_t switches;
+    uint32_t preemptions;       // Switches forced by need_resched at interrupt exit
+    uint32_t steals;            // Threads taken from other CPUs' queues
+    uint32_t lock_holds;
+    uint64_t switch_ns;         // Total and worst context switch latency
+    uint64_t switch_max_ns;
+    uint64_t lock_hold_ns;      // Total and worst run queue lock hold time
+    uint64_t lock_hold_max_ns;
+};
+
+// Turn the boot context into CPU 0's idle thread. Needs kmem_init().
+void sched_init(void);
+
+// Same for the calling application processor
+void sched_init_ap(void);
+
+// Create a thread and queue it on the calling CPU. Returns NULL if out of
+// memory.
+struct thread* thread_create(const char* name, void (*entry)(void* arg), void* arg,
+                             unsigned int priority);
+
+// Same, but the thread only ever runs on the calling CPU
+struct thread* thread_create_pinned(const char* name, void (*entry)(void* arg), void* arg,
+                                    unsigned int priority);
+
+// Give up the CPU to any thread of equal or higher priority
+void thread_yield(void);
+
+// Block the calling thread until thread_wake(). A wakeup that arrives while
+// the thread is still running is remembered and makes the next call return
+// at once, so callers check their condition, then block, in a loop.
+void thread_block(void);
+
+// Make a blocked thread runnable on the calling CPU, or on its own if it is
+// pinned. Returns 0 if it was not blocked. Safe from interrupt handlers.
+int thread_wake(struct thread* t);
+
+// Sleep for at least ns
+void thread_sleep(uint64_t ns);
+
+void thread_exit(void) __attribute__((noreturn));
+
+// Pick the next thread to run on this CPU
+void schedule(void);
+
+// Called at the end of interrupt_dispatch(): switch away if the slice ran out or
+// a more urgent thread was woken
+void sched_irq_exit(void);
+
+// Body of the idle loop: run queued or stolen work, else halt. Setting
+// need_resched sends the idle loop round again instead.
+void sched_idle(void);
+
+// Non-zero if the calling CPU is running its idle thread
+int sched_in_idle(void);
+
+// Send a reschedule IPI to one idle CPU, if there is one
+void sched_kick_idle(void);
+
+void sched_get_stats(uint32_t cpu, struct sched_stats* stats);
+void sched_dump_stats(void);
+
+// Idle loop every CPU ends up in (kernel.c)
+void cpu_idle(void);
+
+#endif // SCHED_H
@@ -0,0 +1,278 @@
+#include "serial.h"
+#include "klog.h"
+#include "pic.h"
+#include "irq.h"
+#include "cpu.h"
+#include "clock.h"
+#include "string.h"
+#include "spinlock.h"
+
+#define SERIAL_TX_RING_MASK (SERIAL_TX_RING_SIZE - 1)
+
+// Transmit ring. Producers (the klog drain, profile dumps) serialize on
+// write_lock in serial_write(); the consumer is the UART interrupt or
+// serial_start_tx(), which may run on different CPUs and serialize on
+// tx_lock.
+struct serial_port {
+    spinlock_t tx_lock;
+    spinlock_t write_lock;
+    uint16_t base;
+    uint8_t irq;
+    uint8_t present;
+    volatile uint32_t tx_head;      // Next byte to queue
+    volatile uint32_t tx_tail;      // Next byte to send
+    uint32_t tx_dropped;            // Bytes refused because the ring was full
+    uint32_t tx_irqs;               // THRE interrupts taken
+    char tx_ring[SERIAL_TX_RING_SIZE];
+};
+
+static struct serial_port serial_ports[SERIAL_PORT_COUNT];
+
+static const uint16_t serial_port_bases[] = { COM1_BASE, COM2_BASE };
+static const uint8_t serial_port_irqs[] = { IRQ_COM1 - 32, IRQ_COM2 - 32 };
+static const char* serial_port_names[] = { "COM1", "COM2" };
+
+static int __init serial_probe(struct serial_port* sp) {
+    // Loopback test: a byte written to THR must come straight back
+    outb(sp->base + UART_MCR, UART_MCR_LOOP | UART_MCR_OUT2 | UART_MCR_RTS);
+    outb(sp->base + UART_DATA, 0xAE);
+    int ok = inb(sp->base + UART_DATA) == 0xAE;
+    outb(sp->base + UART_MCR, 0);
+    return ok;
+}
+
+static void __init serial_setup(struct serial_port* sp, uint32_t baud) {
+    uint16_t divisor = UART_CLOCK / baud;
+
+    outb(sp->base + UART_IER, 0);                       // Interrupts off
+    outb(sp->base + UART_LCR, UART_LCR_DLAB);
+    outb(sp->base + UART_DATA, divisor & 0xFF);
+    outb(sp->base + UART_IER, divisor >> 8);
+    outb(sp->base + UART_LCR, UART_LCR_8N1);
+    outb(sp->base + UART_FCR, UART_FCR_ENABLE | UART_FCR_CLR_RX |
+                              UART_FCR_CLR_TX | UART_FCR_TRIG14);
+    outb(sp->base + UART_MCR, UART_MCR_DTR | UART_MCR_RTS | UART_MCR_OUT2);
+
+    // Clear any stale interrupt conditions
+    (void)inb(sp->base + UART_LSR);
+    (void)inb(sp->base + UART_DATA);
+    (void)inb(sp->base + UART_IIR);
+    (void)inb(sp->base + UART_MSR);
+}
+
+// Move up to one FIFO's worth of bytes from the ring to the UART, then leave
+// the THRE interrupt enabled only while there is more to send. Must be called
+// with tx_lock held.
+static void serial_fill_fifo(struct serial_port* sp) {
+    uint32_t tail = sp->tx_tail;
+    uint32_t head = __atomic_load_n(&sp->tx_head, __ATOMIC_ACQUIRE);
+
+    if (inb(sp->base + UART_LSR) & UART_LSR_THRE) {
+        for (int i = 0; i < UART_FIFO_SIZE && tail != head; i++) {
+            outb(sp->base + UART_DATA, sp->tx_ring[tail & SERIAL_TX_RING_MASK]);
+            tail++;
+        }
+        __atomic_store_n(&sp->tx_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    outb(sp->base + UART_IER, tail != head ? UART_IER_THRI : 0);
+}
+
+static void serial_start_tx(struct serial_port* sp) {
+    uint32_t flags = spin_lock_irqsave(&sp->tx_lock);
+    serial_fill_fifo(sp);
+    spin_unlock_irqrestore(&sp->tx_lock, flags);
+}
+
+size_t serial_write(serial_port_t port, const char* data, size_t len) {
+    struct serial_port* sp = &serial_ports[port];
+    if (!sp->present) {
+        return 0;
+    }
+
+    // A panic writes without the lock: its holder may never come back
+    int panic = klog_in_panic();
+    uint32_t flags = panic ? 0 : spin_lock_irqsave(&sp->write_lock);
+
+    uint32_t head = sp->tx_head;
+    uint32_t used = head - __atomic_load_n(&sp->tx_tail, __ATOMIC_ACQUIRE);
+    if (len > SERIAL_TX_RING_SIZE - used && panic) {
+        // Panic output must not be lost; make room the slow way
+        serial_drain_polled(port);
+        used = 0;
+    }
+    if (len > SERIAL_TX_RING_SIZE - used) {
+        sp->tx_dropped += len;
+        len = 0;
+    } else {
+        for (size_t i = 0; i < len; i++) {
+            sp->tx_ring[(head + i) & SERIAL_TX_RING_MASK] = data[i];
+        }
+        __atomic_store_n(&sp->tx_head, head + len, __ATOMIC_RELEASE);
+    }
+
+    if (!panic) {
+        spin_unlock_irqrestore(&sp->write_lock, flags);
+    }
+    return len;
+}
+
+void serial_flush(serial_port_t port) {
+    if (serial_ports[port].present) {
+        serial_start_tx(&serial_ports[port]);
+    }
+}
+
+int serial_pending(serial_port_t port) {
+    struct serial_port* sp = &serial_ports[port];
+    if (!sp->present) {
+        return 0;
+    }
+    return sp->tx_tail != __atomic_load_n(&sp->tx_head, __ATOMIC_ACQUIRE) ||
+           !(inb(sp->base + UART_LSR) & UART_LSR_TEMT);
+}
+
+void serial_drain_polled(serial_port_t port) {
+    struct serial_port* sp = &serial_ports[port];
+    if (!sp->present) {
+        return;
+    }
+
+    outb(sp->base + UART_IER, 0);
+    while (sp->tx_tail != sp->tx_head) {
+        while (!(inb(sp->base + UART_LSR) & UART_LSR_THRE)) {
+            cpu_relax();
+        }
+        outb(sp->base + UART_DATA, sp->tx_ring[sp->tx_tail & SERIAL_TX_RING_MASK]);
+        sp->tx_tail++;
+    }
+}
+
+static void serial_irq(struct interrupt_frame* frame, void* ctx) {
+    struct serial_port* sp = ctx;
+    uint8_t iir;
+
+    while (!((iir = inb(sp->base + UART_IIR)) & UART_IIR_NO_INT)) {
+        switch (iir & UART_IIR_ID) {
+            case UART_IIR_THRI:
+                sp->tx_irqs++;
+                spin_lock(&sp->tx_lock);
+                serial_fill_fifo(sp);
+                spin_unlock(&sp->tx_lock);
+                break;
+            case UART_IIR_RDI:
+            case UART_IIR_TIMEOUT:
+                (void)inb(sp->base + UART_DATA);
+                break;
+            case UART_IIR_RLSI:
+                (void)inb(sp->base + UART_LSR);
+                break;
+            default:
+                (void)inb(sp->base + UART_MSR);
+                break;
+        }
+    }
+}
+
+int serial_present(serial_port_t port) {
+    return serial_ports[port].present;
+}
+
+// klog sink for COM1
+
+#ifdef KLOG_BINARY
+
+// Binary entries (see klog.h): a few bytes per record instead of a line of
+// text. tools/klogdecode.py renders them on the host.
+static int serial_clock_sent;
+
+static void serial_sink_write(const struct klog_record* rec, const char* msg, size_t len) {
+    uint8_t entry[KLOG_BIN_MAX];
+
+    // The decoder needs the TSC scale; it is known once clock_init() ran
+    if (!serial_clock_sent && clock_data.mult) {
+        serial_write(SERIAL_COM1, (const char*)entry, klog_clock_encode(entry));
+        serial_clock_sent = 1;
+    }
+    serial_write(SERIAL_COM1, (const char*)entry, klog_record_encode(rec, entry));
+}
+
+#else
+
+static void serial_sink_write(const struct klog_record* rec, const char* msg, size_t len) {
+    char line[KLOG_TIME_MAX + KLOG_MSG_MAX + 32];
+    size_t n = klog_format_time(line, klog_record_time(rec));
+
+    line[n++] = '[';
+    for (const char* p = klog_level_name(rec->site->level); *p; p++) {
+        line[n++] = *p;
+    }
+    line[n++] = ']';
+    line[n++] = ' ';
+    // At most 12 characters of subsystem; the line has room for them
+    size_t limit = n + 12;
+    for (const char* p = rec->site->subsystem; *p && n < limit; p++) {
+        line[n++] = *p;
+    }
+    line[n++] = ':';
+    line[n++] = ' ';
+    memcpy(line + n, msg, len);
+    n += len;
+    line[n++] = '\r';
+    line[n++] = '\n';
+
+    serial_write(SERIAL_COM1, line, n);
+}
+
+#endif // KLOG_BINARY
+
+static void serial_sink_flush(void) {
+    if (klog_in_panic()) {
+        serial_drain_polled(SERIAL_COM1);
+    } else {
+        serial_flush(SERIAL_COM1);
+    }
+}
+
+static void serial_sink_puts(const char* str) {
+    // Raw text: translate newlines for terminals on the other end
+    for (; *str; str++) {
+        if (*str == '\n') {
+            serial_write(SERIAL_COM1, "\r", 1);
+        }
+        serial_write(SERIAL_COM1, str, 1);
+    }
+}
+
+static const struct klog_sink serial_sink = {
+    .name = "serial",
+    .write = serial_sink_write,
+    .flush = serial_sink_flush,
+    .puts = serial_sink_puts,
+};
+
+void __init serial_init(void) {
+    KINFO_INIT("SERIAL", "Initializing 16550 UARTs...");
+
+    for (int i = 0; i < SERIAL_PORT_COUNT; i++) {
+        struct serial_port* sp = &serial_ports[i];
+        sp->base = serial_port_bases[i];
+        sp->irq = serial_port_irqs[i];
+
+        if (!serial_probe(sp)) {
+            KDEBUG_INIT("SERIAL", "%s not present", serial_port_names[i]);
+            continue;
+        }
+
+        serial_setup(sp, UART_CLOCK);
+        sp->present = 1;
+        request_irq(IRQ_VECTOR(sp->irq), serial_irq, sp);
+        irq_clear_mask(sp->irq);
+        KINFO_INIT("SERIAL", "%s at 0x%x, IRQ %d, 115200 8N1, FIFO enabled",
+                   serial_port_names[i], sp->base, sp->irq);
+    }
+
+    if (serial_ports[SERIAL_COM1].present) {
+        klog_register_sink(&serial_sink);
+    }
+}
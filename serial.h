@@ -0,0 +1,88 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Standard PC serial port base addresses
+#define COM1_BASE       0x3F8
+#define COM2_BASE       0x2F8
+
+// Register offsets from the base port
+#define UART_DATA       0       // RBR (read) / THR (write), DLL when DLAB=1
+#define UART_IER        1       // Interrupt enable, DLM when DLAB=1
+#define UART_IIR        2       // Interrupt identification (read)
+#define UART_FCR        2       // FIFO control (write)
+#define UART_LCR        3       // Line control
+#define UART_MCR        4       // Modem control
+#define UART_LSR        5       // Line status
+#define UART_MSR        6       // Modem status
+#define UART_SCRATCH    7
+
+// IER bits
+#define UART_IER_RDI    0x01    // Receive data available
+#define UART_IER_THRI   0x02    // Transmit holding register empty
+
+// IIR bits
+#define UART_IIR_NO_INT 0x01    // No interrupt pending
+#define UART_IIR_ID     0x0E    // Interrupt source mask
+#define UART_IIR_MSI    0x00    // Modem status
+#define UART_IIR_THRI   0x02    // Transmit holding register empty
+#define UART_IIR_RDI    0x04    // Receive data available
+#define UART_IIR_RLSI   0x06    // Receiver line status
+#define UART_IIR_TIMEOUT 0x0C   // Receive FIFO timeout
+
+// FCR bits
+#define UART_FCR_ENABLE 0x01    // Enable FIFOs
+#define UART_FCR_CLR_RX 0x02    // Clear receive FIFO
+#define UART_FCR_CLR_TX 0x04    // Clear transmit FIFO
+#define UART_FCR_TRIG14 0xC0    // Receive interrupt at 14 bytes
+
+// LCR bits
+#define UART_LCR_8N1    0x03    // 8 data bits, no parity, 1 stop bit
+#define UART_LCR_DLAB   0x80    // Divisor latch access
+
+// MCR bits
+#define UART_MCR_DTR    0x01
+#define UART_MCR_RTS    0x02
+#define UART_MCR_OUT2   0x08    // Gates the UART interrupt onto the ISA bus
+#define UART_MCR_LOOP   0x10    // Loopback test mode
+
+// LSR bits
+#define UART_LSR_DR     0x01    // Data ready
+#define UART_LSR_THRE   0x20    // Transmit holding register empty
+#define UART_LSR_TEMT   0x40    // Transmitter completely idle
+
+#define UART_CLOCK      115200  // Divisor 1 gives 115200 baud
+#define UART_FIFO_SIZE  16      // 16550A transmit FIFO depth
+
+// Size of the per-port transmit ring (must be a power of two)
+#define SERIAL_TX_RING_SIZE 16384
+
+typedef enum {
+    SERIAL_COM1 = 0,
+    SERIAL_COM2 = 1,
+    SERIAL_PORT_COUNT
+} serial_port_t;
+
+// Probe and initialize COM1/COM2 and register COM1 as a klog sink
+void serial_init(void);
+
+// Returns non-zero if the port was found during serial_init()
+int serial_present(serial_port_t port);
+
+// Queue bytes for transmission; safe against concurrent writers. Never waits
+// for the UART: if the ring cannot hold all of len, nothing is queued and
+// the bytes are counted as dropped. Returns the number of bytes queued.
+size_t serial_write(serial_port_t port, const char* data, size_t len);
+
+// Start sending whatever is queued; does not wait for it to go out
+void serial_flush(serial_port_t port);
+
+// Non-zero while queued bytes have not all left the UART
+int serial_pending(serial_port_t port);
+
+// Write out everything queued by polling the UART. Only for panic paths.
+void serial_drain_polled(serial_port_t port);
+
+#endif // SERIAL_H
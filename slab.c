@@ -0,0 +1,363 @@
+#include "slab.h"
+#include "pmm.h"
+#include "klog.h"
+#include "string.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "paging.h"
+#include "trace.h"
+
+// Slab header, stored at the start of the slab's first page. Free objects
+// form a singly linked list through a word inside each free object.
+struct kmem_slab {
+    struct kmem_cache* cache;
+    struct kmem_slab* next;
+    struct kmem_slab* prev;
+    void* free;                     // First free object
+    uint16_t inuse;
+    uint16_t total;
+};
+
+// Aim for at least this many objects per slab before settling on an order
+#define KMEM_MIN_OBJECTS    8
+#define KMEM_MAX_SLAB_ORDER 3
+
+static struct kmem_cache kmem_caches[KMEM_MAX_CACHES];
+static int kmem_cache_count;
+static spinlock_t kmem_caches_lock = SPINLOCK_INIT;
+
+static struct kmem_cache* kmalloc_caches[8];    // 16 .. 2048 bytes
+static const char* kmalloc_names[] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+};
+
+static inline size_t kmem_align_up(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static inline void** kmem_free_link(struct kmem_cache* cache, void* obj) {
+    return (void**)((char*)obj + cache->free_offset);
+}
+
+// Objects start past the slab header, aligned as far as their stride
+// allows, up to a cache line. That cap is why kmem_cache_create() takes
+// no alignment above CACHE_LINE_SIZE.
+static inline size_t kmem_header_size(size_t stride) {
+    size_t align = stride & -stride;                    // Largest power of two dividing stride
+    if (align > CACHE_LINE_SIZE) {
+        align = CACHE_LINE_SIZE;
+    }
+    return kmem_align_up(sizeof(struct kmem_slab), align);
+}
+
+static inline size_t kmem_first_object(struct kmem_cache* cache) {
+    return kmem_header_size(cache->stride);
+}
+
+// Slab list helpers. Every list is doubly linked so moves are O(1).
+static void kmem_list_add(struct kmem_slab** list, struct kmem_slab* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (slab->next) {
+        slab->next->prev = slab;
+    }
+    *list = slab;
+}
+
+static void kmem_list_remove(struct kmem_slab** list, struct kmem_slab* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+struct kmem_cache* kmem_cache_create(const char* name, size_t size, size_t align,
+                                     unsigned int flags, kmem_ctor_t ctor) {
+    if (align > CACHE_LINE_SIZE || (align & (align - 1))) {
+        KERROR("SLAB", "Cache %s: unsupported alignment %u", name, align);
+        return NULL;
+    }
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+    if ((flags & KMEM_HWALIGN) && align < CACHE_LINE_SIZE) {
+        align = CACHE_LINE_SIZE;
+    }
+
+    // Constructed objects keep their state while free, so the link goes
+    // after the object instead of over its first word
+    size_t stride = size < sizeof(void*) ? sizeof(void*) : size;
+    size_t free_offset = 0;
+    if (ctor) {
+        free_offset = kmem_align_up(stride, sizeof(void*));
+        stride = free_offset + sizeof(void*);
+    }
+    stride = kmem_align_up(stride, align);
+
+    // Pick the smallest slab that wastes no more than 1/8 of its space
+    unsigned int order = 0;
+    size_t count;
+    for (;;) {
+        size_t slab_bytes = (size_t)PAGE_SIZE << order;
+        size_t usable = slab_bytes - kmem_header_size(stride);
+        count = stride <= usable ? usable / stride : 0;
+        size_t waste = usable - count * stride;
+
+        if (order == KMEM_MAX_SLAB_ORDER ||
+            (count >= KMEM_MIN_OBJECTS && waste * 8 <= slab_bytes)) {
+            break;
+        }
+        order++;
+    }
+    if (!count) {
+        KERROR("SLAB", "Cache %s: %u-byte objects do not fit a %d-page slab",
+               name, size, 1 << KMEM_MAX_SLAB_ORDER);
+        return NULL;
+    }
+
+    uint32_t irq_flags = spin_lock_irqsave(&kmem_caches_lock);
+    if (kmem_cache_count >= KMEM_MAX_CACHES) {
+        spin_unlock_irqrestore(&kmem_caches_lock, irq_flags);
+        KERROR("SLAB", "Out of cache descriptors for %s", name);
+        return NULL;
+    }
+    struct kmem_cache* cache = &kmem_caches[kmem_cache_count++];
+    spin_unlock_irqrestore(&kmem_caches_lock, irq_flags);
+
+    cache->name = name;
+    cache->object_size = size;
+    cache->ctor = ctor;
+    cache->stride = stride;
+    cache->free_offset = free_offset;
+    cache->slab_order = order;
+    cache->objects_per_slab = count;
+
+    KDEBUG("SLAB", "Cache %s: %u-byte objects, stride %u, %u per %d-page slab",
+           name, size, cache->stride, cache->objects_per_slab, 1 << cache->slab_order);
+    return cache;
+}
+
+static struct kmem_slab* kmem_cache_grow(struct kmem_cache* cache) {
+    uintptr_t addr = pmm_alloc_pages(cache->slab_order);
+    if (!addr) {
+        return NULL;
+    }
+
+    struct kmem_slab* slab = phys_to_virt(addr);
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->total = cache->objects_per_slab;
+    slab->free = NULL;
+
+    for (unsigned int i = 0; i < (1u << cache->slab_order); i++) {
+        struct page* page = pmm_page(addr + i * PAGE_SIZE);
+        page->flags = PAGE_SLAB;
+        page->private = slab;
+    }
+
+    // Thread the free list in address order so allocations walk forward
+    char* base = (char*)slab + kmem_first_object(cache);
+    for (int i = cache->objects_per_slab - 1; i >= 0; i--) {
+        void* obj = base + i * cache->stride;
+        if (cache->ctor) {
+            cache->ctor(obj);
+        }
+        *kmem_free_link(cache, obj) = slab->free;
+        slab->free = obj;
+    }
+
+    cache->slabs++;
+    cache->grows++;
+    cache->total_objects += cache->objects_per_slab;
+    return slab;
+}
+
+static void kmem_cache_shrink_slab(struct kmem_cache* cache, struct kmem_slab* slab) {
+    uintptr_t addr = virt_to_phys(slab);
+
+    for (unsigned int i = 0; i < (1u << cache->slab_order); i++) {
+        struct page* page = pmm_page(addr + i * PAGE_SIZE);
+        page->flags = 0;
+        page->private = NULL;
+    }
+
+    cache->slabs--;
+    cache->shrinks++;
+    cache->total_objects -= cache->objects_per_slab;
+    pmm_free_pages(addr, cache->slab_order);
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache) {
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    TRACE_BEGIN("kmem_cache_alloc", cache->object_size);
+
+    struct kmem_slab* slab = cache->partial;
+    if (!slab) {
+        slab = cache->empty;
+        if (slab) {
+            kmem_list_remove(&cache->empty, slab);
+            cache->empty_slabs--;
+        } else {
+            slab = kmem_cache_grow(cache);
+            if (!slab) {
+                TRACE_END("kmem_cache_alloc", cache->object_size);
+                spin_unlock_irqrestore(&cache->lock, flags);
+                KERROR("SLAB", "Cache %s: out of memory", cache->name);
+                return NULL;
+            }
+        }
+        kmem_list_add(&cache->partial, slab);
+    }
+
+    void* obj = slab->free;
+    slab->free = *kmem_free_link(cache, obj);
+    if (++slab->inuse == slab->total) {
+        kmem_list_remove(&cache->partial, slab);
+        kmem_list_add(&cache->full, slab);
+    }
+
+    cache->allocs++;
+    cache->active_objects++;
+
+    TRACE_END("kmem_cache_alloc", cache->object_size);
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache* cache, void* obj) {
+    struct page* page = pmm_page(virt_to_phys(obj));
+    if (!page || !(page->flags & PAGE_SLAB) ||
+        ((struct kmem_slab*)page->private)->cache != cache) {
+        KERROR("SLAB", "Cache %s: bad free of %p", cache->name, obj);
+        return;
+    }
+    struct kmem_slab* slab = page->private;
+
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    TRACE_BEGIN("kmem_cache_free", cache->object_size);
+
+    *kmem_free_link(cache, obj) = slab->free;
+    slab->free = obj;
+
+    if (slab->inuse-- == slab->total) {
+        kmem_list_remove(&cache->full, slab);
+        kmem_list_add(&cache->partial, slab);
+    }
+
+    if (slab->inuse == 0) {
+        kmem_list_remove(&cache->partial, slab);
+        if (cache->empty_slabs) {
+            // Keep one empty slab around to absorb alloc/free churn
+            kmem_cache_shrink_slab(cache, slab);
+        } else {
+            kmem_list_add(&cache->empty, slab);
+            cache->empty_slabs++;
+        }
+    }
+
+    cache->frees++;
+    cache->active_objects--;
+
+    TRACE_END("kmem_cache_free", cache->object_size);
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+static inline int kmalloc_index(size_t size) {
+    int index = 0;
+    size_t class_size = KMALLOC_MIN_SIZE;
+    while (class_size < size) {
+        class_size <<= 1;
+        index++;
+    }
+    return index;
+}
+
+void* kmalloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    if (size <= KMALLOC_MAX_SIZE) {
+        return kmem_cache_alloc(kmalloc_caches[kmalloc_index(size)]);
+    }
+
+    // Large allocations bypass the caches and take whole pages
+    unsigned int order = pmm_order_for(size);
+    uintptr_t addr = pmm_alloc_pages(order);
+    if (!addr) {
+        KERROR("SLAB", "kmalloc(%u) failed", size);
+        return NULL;
+    }
+    pmm_page(addr)->flags = PAGE_KMALLOC;
+    return phys_to_virt(addr);
+}
+
+void* kzalloc(size_t size) {
+    void* ptr = kmalloc(size);
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+void kfree(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    struct page* page = pmm_page(virt_to_phys(ptr));
+    if (page && (page->flags & PAGE_SLAB)) {
+        kmem_cache_free(((struct kmem_slab*)page->private)->cache, ptr);
+    } else if (page && (page->flags & PAGE_KMALLOC) && !((uintptr_t)ptr & (PAGE_SIZE - 1))) {
+        page->flags = 0;
+        pmm_free_pages(virt_to_phys(ptr), page->order);
+    } else {
+        KERROR("SLAB", "kfree of unknown pointer %p", ptr);
+    }
+}
+
+void __init kmem_init(void) {
+    KINFO_INIT("SLAB", "Initializing slab allocator...");
+
+    size_t size = KMALLOC_MIN_SIZE;
+    for (int i = 0; size <= KMALLOC_MAX_SIZE; i++, size <<= 1) {
+        // Power-of-two classes are naturally aligned up to a cache line
+        size_t align = size < CACHE_LINE_SIZE ? size : CACHE_LINE_SIZE;
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], size, align, 0, NULL);
+    }
+
+    KINFO_INIT("SLAB", "kmalloc size classes %d-%d bytes ready", KMALLOC_MIN_SIZE, KMALLOC_MAX_SIZE);
+}
+
+void kmem_dump_stats(void) {
+    int order[KMEM_MAX_CACHES];
+    for (int i = 0; i < kmem_cache_count; i++) {
+        order[i] = i;
+    }
+
+    // Insertion sort by allocation count so the hottest caches come first
+    for (int i = 1; i < kmem_cache_count; i++) {
+        int current = order[i];
+        int j = i;
+        while (j > 0 && kmem_caches[order[j - 1]].allocs < kmem_caches[current].allocs) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = current;
+    }
+
+    for (int i = 0; i < kmem_cache_count; i++) {
+        const struct kmem_cache* c = &kmem_caches[order[i]];
+        if (!c->allocs && !c->slabs) {
+            continue;
+        }
+        KINFO("SLAB", "%s: %u bytes, %u/%u objects, %u slabs, %u allocs, %u frees",
+              c->name, c->object_size, c->active_objects, c->total_objects,
+              c->slabs, c->allocs, c->frees);
+    }
+}
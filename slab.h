@@ -0,0 +1,72 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "spinlock.h"
+
+#define CACHE_LINE_SIZE     64
+
+// kmem_cache_create() flags
+#define KMEM_HWALIGN        0x01    // Align objects to cache lines
+
+// Smallest and largest kmalloc() size classes; larger requests get whole pages
+#define KMALLOC_MIN_SIZE    16
+#define KMALLOC_MAX_SIZE    2048
+
+// Maximum number of caches, including the kmalloc() size classes
+#define KMEM_MAX_CACHES     32
+
+typedef void (*kmem_ctor_t)(void* obj);
+
+struct kmem_slab;
+
+// A cache of equally sized objects carved from slabs of 2^order pages
+struct kmem_cache {
+    spinlock_t lock;                // Guards the slab lists and counters
+    const char* name;
+    size_t object_size;             // Size requested by the creator
+    size_t stride;                  // Distance between objects in a slab
+    size_t free_offset;             // Where the free-list link lives in an object
+    kmem_ctor_t ctor;
+    unsigned int slab_order;
+    unsigned int objects_per_slab;
+
+    struct kmem_slab* partial;      // Slabs with both used and free objects
+    struct kmem_slab* full;         // Slabs with no free objects
+    struct kmem_slab* empty;        // Fully free slabs kept for reuse
+
+    // Usage counters
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t active_objects;
+    uint32_t total_objects;
+    uint32_t slabs;
+    uint32_t empty_slabs;
+    uint32_t grows;
+    uint32_t shrinks;
+};
+
+// Set up the kmalloc() size classes. Needs pmm_init().
+void kmem_init(void);
+
+// Create a cache of objects of the given size. align of 0 means natural
+// word alignment; otherwise it must be a power of two no larger than
+// CACHE_LINE_SIZE. ctor, if given, runs once per object when its slab is
+// created; objects must be returned to the constructed state before
+// kmem_cache_free(). Returns NULL if the alignment is unsupported, an
+// object does not fit the largest slab or the descriptors have run out.
+struct kmem_cache* kmem_cache_create(const char* name, size_t size, size_t align,
+                                     unsigned int flags, kmem_ctor_t ctor);
+
+void* kmem_cache_alloc(struct kmem_cache* cache);
+void kmem_cache_free(struct kmem_cache* cache, void* obj);
+
+void* kmalloc(size_t size);
+void* kzalloc(size_t size);
+void kfree(void* ptr);
+
+// Log per-cache usage, hottest caches first
+void kmem_dump_stats(void);
+
+#endif // SLAB_H
@@ -0,0 +1,235 @@
+#include "smp.h"
+#include "apic.h"
+#include "idt.h"
+#include "irq.h"
+#include "sched.h"
+#include "softirq.h"
+#include "fpu.h"
+#include "profile.h"
+#include "trace.h"
+#include "paging.h"
+#include "pmm.h"
+#include "clock.h"
+#include "cpu.h"
+#include "klog.h"
+#include "string.h"
+#include "spinlock.h"
+
+// How long an AP gets to reach ap_main() after its startup IPIs
+#define AP_BOOT_TIMEOUT_US  100000
+
+// Parameter block at the end of trampoline.s
+struct trampoline_params {
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t stack;
+    uint32_t entry;
+    uint32_t cpu;
+};
+
+extern char trampoline_start[], trampoline_params[], trampoline_end[];
+
+struct cpu cpus[MAX_CPUS];
+
+// Who owns an AP's startup. The AP claims it on entry to ap_main(); the
+// boot CPU claims it on a timeout. Only the first claim succeeds.
+#define AP_STARTING         0
+#define AP_RUNNING          1
+#define AP_DEAD             2
+
+static uint32_t smp_online = 1;
+static volatile uint32_t smp_boot_done;
+static uint32_t smp_ap_state[MAX_CPUS];
+
+// The TLB shootdown in flight: its range, and a bit per CPU that has yet
+// to flush it. One at a time, under smp_tlb_lock.
+static spinlock_t smp_tlb_lock = SPINLOCK_INIT;
+static uintptr_t smp_tlb_start;
+static size_t smp_tlb_size;
+static int smp_tlb_global;
+static uint32_t smp_tlb_pending;
+
+// Flush for the shootdown in flight if it includes this CPU
+static void smp_tlb_service(void) {
+    uint32_t bit = 1u << cpu_id();
+
+    if (__atomic_load_n(&smp_tlb_pending, __ATOMIC_ACQUIRE) & bit) {
+        tlb_flush_range(smp_tlb_start, smp_tlb_size, smp_tlb_global);
+        __atomic_and_fetch(&smp_tlb_pending, ~bit, __ATOMIC_RELEASE);
+    }
+}
+
+static void smp_tlb_irq(struct interrupt_frame* frame, void* ctx) {
+    smp_tlb_service();
+}
+
+void smp_flush_tlb_range(uintptr_t virt, size_t size, int global) {
+    uint32_t flags = irq_save();
+
+    tlb_flush_range(virt, size, global);
+    if (!__atomic_load_n(&smp_boot_done, __ATOMIC_ACQUIRE)) {
+        irq_restore(flags);
+        return;
+    }
+
+    // Whoever holds the lock may be waiting for this CPU, whose interrupts
+    // can be off: answer it while waiting
+    while (!spin_trylock(&smp_tlb_lock)) {
+        smp_tlb_service();
+        cpu_relax();
+    }
+
+    uint32_t self = cpu_id();
+    uint32_t targets = 0;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (i != self && cpus[i].online) {
+            targets |= 1u << i;
+        }
+    }
+
+    if (targets) {
+        smp_tlb_start = virt;
+        smp_tlb_size = size;
+        smp_tlb_global = global;
+        __atomic_store_n(&smp_tlb_pending, targets, __ATOMIC_RELEASE);
+        for (uint32_t i = 0; i < MAX_CPUS; i++) {
+            if (targets & (1u << i)) {
+                lapic_send_ipi(cpus[i].apic_id, APIC_TLB_VECTOR);
+            }
+        }
+        while (__atomic_load_n(&smp_tlb_pending, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+
+    spin_unlock(&smp_tlb_lock);
+    irq_restore(flags);
+}
+
+static void __init ap_init(struct cpu* cpu) {
+    gdt_init_cpu(cpu);
+    idt_load();
+    sched_init_ap();
+    softirq_init();
+    fpu_init();
+    apic_init_ap();
+    profile_init();
+    KINFO_INIT("SMP", "CPU %u (APIC %u) online", cpu->id, cpu->apic_id);
+}
+
+// Entered from trampoline.s on the CPU's own stack. Stays resident: the
+// AP may still be spinning here when the boot CPU frees .init.
+static void ap_main(struct cpu* cpu) {
+    // Too late: the boot CPU has given up on this CPU and may have freed
+    // ap_init() already
+    uint32_t starting = AP_STARTING;
+    if (!__atomic_compare_exchange_n(&smp_ap_state[cpu->id], &starting, AP_RUNNING, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        for (;;) {
+            __asm__ volatile ("cli\n\thlt");
+        }
+    }
+    ap_init(cpu);
+    __atomic_store_n(&cpu->online, 1, __ATOMIC_RELEASE);
+
+    // The identity mapping the trampoline ran on is gone once the boot CPU
+    // lets go; drop whatever of it this TLB still holds
+    while (!__atomic_load_n(&smp_boot_done, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+    write_cr3(read_cr3());
+
+    __asm__ volatile ("sti");
+    cpu_idle();
+}
+
+// INIT, then up to two startup IPIs as the MP specification asks
+static int __init smp_start_ap(struct cpu* cpu, volatile struct trampoline_params* params) {
+    uintptr_t stack = pmm_alloc_pages(pmm_order_for(AP_STACK_SIZE));
+    if (!stack) {
+        KERROR("SMP", "No stack for CPU %u", cpu->id);
+        return -1;
+    }
+    cpu->stack_top = (uintptr_t)phys_to_virt(stack) + AP_STACK_SIZE;
+    trace_init_cpu(cpu->id);
+    params->stack = cpu->stack_top;
+    params->cpu = (uint32_t)cpu;
+
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+    udelay(10000);
+    for (int i = 0; i < 2 && !cpu->online; i++) {
+        lapic_send_ipi(cpu->apic_id, LAPIC_ICR_STARTUP | (TRAMPOLINE_BASE >> PAGE_SHIFT));
+        udelay(200);
+    }
+
+    for (uint32_t waited = 0; !cpu->online && waited < AP_BOOT_TIMEOUT_US; waited += 100) {
+        udelay(100);
+    }
+
+    uint32_t starting = AP_STARTING;
+    if (__atomic_compare_exchange_n(&smp_ap_state[cpu->id], &starting, AP_DEAD, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // Put it back to waiting for a startup IPI it will never get, so it
+        // cannot run the trampoline later on the next CPU's parameters.
+        // Should it reach ap_main() first anyway, it stops there.
+        lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+        KWARN("SMP", "CPU %u (APIC %u) did not come up", cpu->id, cpu->apic_id);
+        return -1;
+    }
+
+    // It got into ap_main() in time, so it finishes ap_init() before .init
+    // is freed
+    while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+    return 0;
+}
+
+void __init smp_init(void) {
+    struct cpu* bsp = &cpus[0];
+    bsp->online = 1;
+
+    if (!apic_enabled()) {
+        KINFO_INIT("SMP", "No local APIC, running on the boot CPU only");
+        return;
+    }
+    bsp->apic_id = lapic_id();
+    request_irq(APIC_TLB_VECTOR, smp_tlb_irq, NULL);
+
+    // Copy the trampoline below 1 MiB, where real mode can reach it
+    memcpy(phys_to_virt(TRAMPOLINE_BASE), trampoline_start, trampoline_end - trampoline_start);
+
+    volatile struct trampoline_params* params =
+        phys_to_virt(TRAMPOLINE_BASE + (trampoline_params - trampoline_start));
+    params->cr0 = read_cr0();
+    params->cr3 = read_cr3();
+    params->cr4 = read_cr4();
+    params->entry = (uint32_t)ap_main;
+
+    // The trampoline turns paging on while running at its physical address
+    paging_map(0, 0, LARGE_PAGE_SIZE, PTE_WRITE);
+
+    uint32_t next = 1;
+    for (uint32_t i = 0; i < acpi_info.cpu_count && next < MAX_CPUS; i++) {
+        if (acpi_info.cpu_apic_ids[i] == bsp->apic_id) {
+            continue;
+        }
+
+        struct cpu* cpu = &cpus[next];
+        cpu->id = next++;
+        cpu->apic_id = acpi_info.cpu_apic_ids[i];
+        if (smp_start_ap(cpu, params) == 0) {
+            smp_online++;
+        }
+    }
+
+    paging_unmap(0, LARGE_PAGE_SIZE);
+    __atomic_store_n(&smp_boot_done, 1, __ATOMIC_RELEASE);
+
+    KINFO_INIT("SMP", "%u CPUs online", smp_online);
+}
+
+uint32_t smp_cpu_count(void) {
+    return smp_online;
+}
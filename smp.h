@@ -0,0 +1,95 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "gdt.h"
+#include "acpi.h"
+#include "slab.h"
+
+#define MAX_CPUS            ACPI_MAX_CPUS
+
+// Stack given to each application processor
+#define AP_STACK_SIZE       16384
+
+// Physical page the real-mode trampoline is copied to. The startup IPI
+// vector is its page number, so it must be below 1 MiB.
+#define TRAMPOLINE_BASE     0x8000      // Keep in sync with trampoline.s
+
+struct thread;
+struct interrupt_frame;
+
+// Per-CPU data. Each CPU loads %gs with a segment based at its own block, so
+// its fields are one %gs-relative access away and, being touched only by
+// their owner, need no locks.
+struct cpu {
+    struct cpu* self;           // Must stay first: this_cpu() reads %gs:0
+    uint32_t id;                // Logical number; the boot CPU is 0
+    uint32_t apic_id;
+    volatile uint32_t online;
+    uintptr_t stack_top;
+
+    struct thread* current;     // Thread running on this CPU
+    // Set to switch threads on the way out of the next interrupt
+    volatile uint32_t need_resched;
+
+    // Bit n set: softirq n is raised on this CPU (softirq.h)
+    volatile uint32_t softirq_pending;
+    uint32_t in_softirq;        // Bottom halves running; interrupts defer to them
+    // Frame of the hardware interrupt being handled, NULL outside handlers
+    struct interrupt_frame* irq_frame;
+
+    // Counters
+    uint32_t irqs;              // Hardware interrupts taken
+    uint32_t exceptions;        // CPU exceptions taken
+
+    struct gdt_entry gdt[GDT_ENTRIES];
+    struct tss tss;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+extern struct cpu cpus[MAX_CPUS];
+
+static inline struct cpu* this_cpu(void) {
+    struct cpu* cpu;
+    __asm__ volatile ("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+static inline uint32_t cpu_id(void) {
+    uint32_t id;
+    __asm__ volatile ("mov %%gs:%c1, %0" : "=r"(id) : "i"(offsetof(struct cpu, id)));
+    return id;
+}
+
+static inline struct thread* current_thread(void) {
+    struct thread* t;
+    __asm__ volatile ("mov %%gs:%c1, %0" : "=r"(t) : "i"(offsetof(struct cpu, current)));
+    return t;
+}
+
+// Bump a counter of the calling CPU. A single instruction, so it cannot be
+// torn by an interrupt and needs neither a lock nor irq_save().
+#define this_cpu_inc(field)                                                 \
+    __asm__ volatile ("incl %%gs:%c0"                                       \
+                      : : "i"(offsetof(struct cpu, field)) : "memory")
+
+// Set bits in a field of the calling CPU, as one instruction for the same
+// reason
+#define this_cpu_or(field, bits)                                            \
+    __asm__ volatile ("orl %1, %%gs:%c0"                                    \
+                      : : "i"(offsetof(struct cpu, field)), "ri"(bits) : "memory")
+
+// Start every application processor listed in the MADT. Needs apic_init().
+void smp_init(void);
+
+// Number of CPUs running, the boot CPU included
+uint32_t smp_cpu_count(void);
+
+// tlb_flush_range() on every online CPU: this one directly, the others by
+// IPI. Returns once all of them have flushed. Until smp_init() has
+// finished only this CPU is flushed; APs still starting flush their whole
+// TLB before they run anything. Callers must not hold a lock other CPUs
+// may spin on with interrupts off.
+void smp_flush_tlb_range(uintptr_t virt, size_t size, int global);
+
+#endif // SMP_H
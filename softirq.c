@@ -0,0 +1,209 @@
+#include "softirq.h"
+#include "sched.h"
+#include "smp.h"
+#include "cpu.h"
+#include "klog.h"
+
+struct softirq_cpu {
+    struct work* head;          // Work queue, touched with interrupts off
+    struct work* tail;
+    struct thread* thread;      // Takes over when the exit budget runs out
+    struct softirq_stats stats;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct softirq_cpu softirq_cpus[MAX_CPUS];
+static void (*softirq_handlers[SOFTIRQ_COUNT])(void);
+
+static const char* softirq_names[SOFTIRQ_COUNT] = {
+    "input",
+    "work",
+};
+
+void open_softirq(unsigned int nr, void (*handler)(void)) {
+    if (nr < SOFTIRQ_COUNT) {
+        softirq_handlers[nr] = handler;
+    }
+}
+
+// Interrupts off. flags is the caller's interrupt state: with interrupts
+// on it is a thread, which no interrupt exit is coming to run the bottom
+// half for, so the softirq thread gets it instead.
+static void softirq_raise_irqoff(unsigned int nr, uint32_t flags) {
+    struct cpu* cpu = this_cpu();
+
+    this_cpu_or(softirq_pending, 1u << nr);
+
+    if ((flags & EFLAGS_IF) && !cpu->in_softirq) {
+        struct thread* t = softirq_cpus[cpu->id].thread;
+        if (t) {
+            thread_wake(t);
+        }
+    }
+}
+
+void raise_softirq(unsigned int nr) {
+    uint32_t flags = irq_save();
+    softirq_raise_irqoff(nr, flags);
+    irq_restore(flags);
+}
+
+void softirq_run(void) {
+    struct cpu* cpu = this_cpu();
+    struct softirq_cpu* sc = &softirq_cpus[cpu->id];
+    uint64_t start = ktime_ns();
+
+    // Interrupts taken from here on see in_softirq and leave both the
+    // bottom halves and any reschedule to this pass
+    cpu->in_softirq = 1;
+    for (unsigned int round = 0;; round++) {
+        uint32_t pending = cpu->softirq_pending;
+        cpu->softirq_pending = 0;
+
+        __asm__ volatile ("sti" : : : "memory");
+        while (pending) {
+            unsigned int nr = __builtin_ctz(pending);
+            pending &= pending - 1;
+            if (softirq_handlers[nr]) {
+                sc->stats.runs[nr]++;
+                softirq_handlers[nr]();
+            }
+        }
+        __asm__ volatile ("cli" : : : "memory");
+
+        if (!cpu->softirq_pending) {
+            break;
+        }
+        if (round + 1 >= SOFTIRQ_MAX_ROUNDS || ktime_ns() - start >= SOFTIRQ_BUDGET_NS) {
+            sc->stats.deferred++;
+            if (sc->thread) {
+                thread_wake(sc->thread);
+            }
+            break;
+        }
+    }
+    cpu->in_softirq = 0;
+
+    uint64_t elapsed = ktime_ns() - start;
+    if (elapsed > sc->stats.max_ns) {
+        sc->stats.max_ns = elapsed;
+    }
+}
+
+// Runs like any other thread, so leftover softirqs cannot starve them
+static void softirq_thread(void* arg) {
+    struct softirq_cpu* sc = arg;
+
+    for (;;) {
+        uint32_t flags = irq_save();
+        if (this_cpu()->softirq_pending) {
+            sc->stats.thread_runs++;
+            softirq_run();
+        }
+        int more = this_cpu()->softirq_pending != 0;
+        irq_restore(flags);
+
+        if (more) {
+            thread_yield();
+        } else {
+            thread_block();
+        }
+    }
+}
+
+void work_setup(struct work* w, void (*func)(void* data), void* data) {
+    w->next = NULL;
+    w->func = func;
+    w->data = data;
+    w->pending = 0;
+}
+
+int work_queue(struct work* w) {
+    uint32_t expected = 0;
+    if (!__atomic_compare_exchange_n(&w->pending, &expected, 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+
+    uint32_t flags = irq_save();
+    struct softirq_cpu* sc = &softirq_cpus[cpu_id()];
+    w->next = NULL;
+    if (sc->tail) {
+        sc->tail->next = w;
+    } else {
+        sc->head = w;
+    }
+    sc->tail = w;
+    // Judged by work_queue()'s caller: raise_softirq() here would only see
+    // the interrupts this function just turned off
+    softirq_raise_irqoff(SOFTIRQ_WORK, flags);
+    irq_restore(flags);
+    return 1;
+}
+
+static void work_softirq(void) {
+    struct softirq_cpu* sc = &softirq_cpus[cpu_id()];
+
+    for (int budget = WORK_BUDGET; budget > 0; budget--) {
+        uint32_t flags = irq_save();
+        struct work* w = sc->head;
+        if (!w) {
+            irq_restore(flags);
+            return;
+        }
+        sc->head = w->next;
+        if (!sc->head) {
+            sc->tail = NULL;
+        }
+        irq_restore(flags);
+
+        // Cleared first, so the function may queue the item again
+        __atomic_store_n(&w->pending, 0, __ATOMIC_RELEASE);
+        w->func(w->data);
+        sc->stats.work_items++;
+    }
+
+    if (sc->head) {
+        this_cpu_or(softirq_pending, 1u << SOFTIRQ_WORK);
+    }
+}
+
+void __init softirq_init(void) {
+    struct softirq_cpu* sc = &softirq_cpus[cpu_id()];
+
+    sc->thread = thread_create_pinned("softirqd", softirq_thread, sc, SCHED_PRIO_DEFAULT);
+    if (!sc->thread) {
+        KWARN("SOFTIRQ", "No softirq thread on CPU %u", cpu_id());
+    }
+
+    if (cpu_id() == 0) {
+        open_softirq(SOFTIRQ_WORK, work_softirq);
+        KINFO_INIT("SOFTIRQ", "%d softirqs, %d rounds or %u us per interrupt exit",
+                   SOFTIRQ_COUNT, SOFTIRQ_MAX_ROUNDS,
+                   (uint32_t)(SOFTIRQ_BUDGET_NS / NSEC_PER_USEC));
+    }
+}
+
+void softirq_get_stats(uint32_t cpu, struct softirq_stats* stats) {
+    uint32_t flags = irq_save();
+    *stats = softirq_cpus[cpu].stats;
+    irq_restore(flags);
+}
+
+void softirq_dump_stats(void) {
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!cpus[cpu].online) {
+            continue;
+        }
+
+        struct softirq_stats stats;
+        softirq_get_stats(cpu, &stats);
+        for (int nr = 0; nr < SOFTIRQ_COUNT; nr++) {
+            if (stats.runs[nr]) {
+                KINFO("SOFTIRQ", "CPU %u %s: %u runs", cpu, softirq_names[nr], stats.runs[nr]);
+            }
+        }
+        KINFO("SOFTIRQ", "CPU %u: %u work items, %u deferred, %u thread runs, %u us longest exit",
+              cpu, stats.work_items, stats.deferred, stats.thread_runs,
+              (uint32_t)(stats.max_ns / NSEC_PER_USEC));
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <stdint.h>
+#include "clock.h"
+
+// Bottom halves. An interrupt handler does only what the device needs right
+// away, then raises a softirq; the softirq runs on the same CPU once the
+// interrupt is acknowledged, with interrupts enabled. Lower numbers run
+// first within a round.
+enum {
+    SOFTIRQ_INPUT,              // Keyboard and other input decoding
+    SOFTIRQ_WORK,               // Queued work items
+    SOFTIRQ_COUNT
+};
+
+// Softirqs are restarted while they keep raising each other, at most this
+// many rounds or this long per interrupt exit. Whatever is left over goes to
+// the CPU's softirq thread, which competes with ordinary threads.
+#define SOFTIRQ_MAX_ROUNDS      8
+#define SOFTIRQ_BUDGET_NS       (2 * NSEC_PER_MSEC)
+
+// Work items run per SOFTIRQ_WORK round; the rest wait for the next one
+#define WORK_BUDGET             16
+
+// A deferred call, queued from interrupt or thread context and run once on
+// the queuing CPU
+struct work {
+    struct work* next;
+    void (*func)(void* data);
+    void* data;
+    volatile uint32_t pending;
+};
+
+struct softirq_stats {
+    uint32_t runs[SOFTIRQ_COUNT];
+    uint32_t work_items;
+    uint32_t deferred;          // Budget ran out, handed to the thread
+    uint32_t thread_runs;
+    uint64_t max_ns;            // Longest single pass
+};
+
+// Set up the calling CPU; the boot CPU calls it after sched_init() and each
+// application processor after sched_init_ap()
+void softirq_init(void);
+
+// Install the handler for one softirq number
+void open_softirq(unsigned int nr, void (*handler)(void));
+
+// Mark nr pending on the calling CPU. Safe from interrupt handlers; from
+// thread context it runs on the next interrupt exit or the softirq thread.
+void raise_softirq(unsigned int nr);
+
+// Run the pending softirqs within the budget. Called by interrupt_dispatch()
+// with interrupts disabled; returns with them disabled.
+void softirq_run(void);
+
+void work_setup(struct work* w, void (*func)(void* data), void* data);
+
+// Queue w on the calling CPU. Returns 0 if it was already queued.
+int work_queue(struct work* w);
+
+void softirq_get_stats(uint32_t cpu, struct softirq_stats* stats);
+void softirq_dump_stats(void);
+
+#endif // SOFTIRQ_H
@@ -0,0 +1,180 @@
+#include "string.h"
+#include <stdint.h>
+
+// The definitions below must not go through the builtin macros
+#undef memcpy
+#undef memmove
+#undef memset
+#undef memcmp
+#undef strlen
+#undef strcmp
+
+// Below this, aligning the destination first costs more than it saves
+#define STRING_ALIGN_MIN    16
+
+// Word loads that may alias anything; unaligned_word_t may also be unaligned
+typedef uint32_t __attribute__((may_alias)) word_t;
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_word_t;
+
+// Non-zero if any byte of w is zero
+#define HAS_ZERO_BYTE(w)    (((w) - 0x01010101u) & ~(w) & 0x80808080u)
+
+// Everything below is string instructions or explicit word loops: GCC
+// would otherwise recognize plain byte loops as memset/memcpy and call
+// straight back into them.
+
+void* memcpy(void* restrict dst, const void* restrict src, size_t n) {
+    void* ret = dst;
+
+    if (n >= STRING_ALIGN_MIN) {
+        size_t head = -(uintptr_t)dst & 3;
+        n -= head;
+        __asm__ volatile ("rep movsb"
+                          : "+D"(dst), "+S"(src), "+c"(head)
+                          : : "memory");
+    }
+
+    size_t dwords = n >> 2;
+    __asm__ volatile ("rep movsl\n\t"
+                      "movl %3, %%ecx\n\t"
+                      "rep movsb"
+                      : "+D"(dst), "+S"(src), "+c"(dwords)
+                      : "r"(n & 3) : "memory");
+    return ret;
+}
+
+void* memmove(void* dst, const void* src, size_t n) {
+    // Forward copying is safe unless dst starts inside the source
+    if ((uintptr_t)dst - (uintptr_t)src >= n) {
+        return memcpy(dst, src, n);
+    }
+
+    // Copy downwards from the last byte: the odd bytes at the end, then
+    // whole dwords, whose first one starts 3 bytes below where the byte
+    // copy left off
+    void* d = (uint8_t*)dst + n - 1;
+    const void* s = (const uint8_t*)src + n - 1;
+    size_t tail = n & 3;
+    __asm__ volatile ("std\n\t"
+                      "rep movsb\n\t"
+                      "subl $3, %%esi\n\t"
+                      "subl $3, %%edi\n\t"
+                      "movl %3, %%ecx\n\t"
+                      "rep movsl\n\t"
+                      "cld"
+                      : "+D"(d), "+S"(s), "+c"(tail)
+                      : "r"(n >> 2) : "memory", "cc");
+    return dst;
+}
+
+void* memset(void* dst, int c, size_t n) {
+    void* ret = dst;
+    uint32_t pattern = (uint8_t)c * 0x01010101u;
+
+    if (n >= STRING_ALIGN_MIN) {
+        size_t head = -(uintptr_t)dst & 3;
+        n -= head;
+        __asm__ volatile ("rep stosb"
+                          : "+D"(dst), "+c"(head)
+                          : "a"(pattern) : "memory");
+    }
+
+    size_t dwords = n >> 2;
+    __asm__ volatile ("rep stosl\n\t"
+                      "movl %2, %%ecx\n\t"
+                      "rep stosb"
+                      : "+D"(dst), "+c"(dwords)
+                      : "r"(n & 3), "a"(pattern) : "memory");
+    return ret;
+}
+
+int memcmp(const void* s1, const void* s2, size_t n) {
+    const uint8_t* a = s1;
+    const uint8_t* b = s2;
+
+    // Skip equal words, then find the differing byte
+    while (n >= 4 && *(const unaligned_word_t*)a == *(const unaligned_word_t*)b) {
+        a += 4;
+        b += 4;
+        n -= 4;
+    }
+    for (; n; n--, a++, b++) {
+        if (*a != *b) {
+            return *a - *b;
+        }
+    }
+    return 0;
+}
+
+// Aligned word loads never cross a page boundary, so reading a little past
+// the terminator is safe
+size_t strlen(const char* str) {
+    const char* p = str;
+
+    for (; (uintptr_t)p & 3; p++) {
+        if (!*p) {
+            return p - str;
+        }
+    }
+
+    const word_t* w = (const word_t*)p;
+    while (!HAS_ZERO_BYTE(*w)) {
+        w++;
+    }
+
+    for (p = (const char*)w; *p; p++) {
+    }
+    return p - str;
+}
+
+size_t strnlen(const char* str, size_t maxlen) {
+    const char* p = str;
+    const char* end = str + maxlen;
+
+    for (; p < end && ((uintptr_t)p & 3); p++) {
+        if (!*p) {
+            return p - str;
+        }
+    }
+
+    for (; end - p >= 4; p += 4) {
+        if (HAS_ZERO_BYTE(*(const word_t*)p)) {
+            break;
+        }
+    }
+
+    for (; p < end && *p; p++) {
+    }
+    return p - str;
+}
+
+int strcmp(const char* s1, const char* s2) {
+    const uint8_t* a = (const uint8_t*)s1;
+    const uint8_t* b = (const uint8_t*)s2;
+
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a - *b;
+}
+
+int strword(const char* str, const char* word) {
+    while (*str) {
+        const char* w = word;
+        while (*str == ' ') {
+            str++;
+        }
+        while (*w && *str == *w) {
+            str++;
+            w++;
+        }
+        if (!*w && (*str == ' ' || !*str)) {
+            return 1;
+        }
+        while (*str && *str != ' ') {
+            str++;
+        }
+    }
+    return 0;
+}
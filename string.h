@@ -0,0 +1,32 @@
+#ifndef STRING_H
+#define STRING_H
+
+#include <stddef.h>
+
+// Freestanding memory and string primitives. GCC emits calls to the mem*
+// functions for structure copies even with -ffreestanding, so these are
+// the real symbols.
+void* memcpy(void* restrict dst, const void* restrict src, size_t n);
+void* memmove(void* dst, const void* src, size_t n);
+void* memset(void* dst, int c, size_t n);
+int memcmp(const void* s1, const void* s2, size_t n);
+size_t strlen(const char* str);
+size_t strnlen(const char* str, size_t maxlen);
+int strcmp(const char* s1, const char* s2);
+
+// Non-zero if word appears in str as a whole, space-separated word, as in
+// a kernel command line
+int strword(const char* str, const char* word);
+
+// Route calls through the builtins: -ffreestanding turns off GCC's own
+// handling of the plain names, but the builtins still expand small
+// constant sizes into a few moves and fold lengths of literals, and fall
+// back to the functions above for everything else
+#define memcpy(dst, src, n)     __builtin_memcpy(dst, src, n)
+#define memmove(dst, src, n)    __builtin_memmove(dst, src, n)
+#define memset(dst, c, n)       __builtin_memset(dst, c, n)
+#define memcmp(s1, s2, n)       __builtin_memcmp(s1, s2, n)
+#define strlen(str)             __builtin_strlen(str)
+#define strcmp(s1, s2)          __builtin_strcmp(s1, s2)
+
+#endif // STRING_H
@@ -0,0 +1,301 @@
+#include "string_test.h"
+#include "string.h"
+#include "pmm.h"
+#include "paging.h"
+#include "clock.h"
+#include "cpu.h"
+#include "klog.h"
+
+// Longest length tested, plus room for misalignment and guard bytes
+#define STRING_TEST_MAX_LEN     4100
+#define STRING_TEST_SLACK       32
+#define STRING_TEST_BUF_SIZE    (STRING_TEST_MAX_LEN + STRING_TEST_SLACK)
+
+#define STRING_TEST_MAX_ALIGN   8
+#define STRING_TEST_MAX_REPORTS 16
+
+// Benchmark repetitions; the fastest one counts
+#define STRING_BENCH_ROUNDS     32
+
+// Every length up to past STRING_ALIGN_MIN and the word loops' first few
+// rounds, then both sides of the larger powers of two
+static const uint16_t string_test_lengths[] = {
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+    16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+    32, 33, 34, 35, 36, 40,
+    63, 64, 65, 127, 128, 129, 255, 256, 257, 511, 512, 513,
+    1023, 1024, 1025, 4095, 4096, 4097, STRING_TEST_MAX_LEN,
+};
+
+#define STRING_TEST_LENGTHS (sizeof(string_test_lengths) / sizeof(string_test_lengths[0]))
+
+// Hide a value from the optimizer, so calls are not folded or inlined as
+// constant-size builtins
+#define STRING_TEST_HIDE(x) __asm__ volatile ("" : "+r"(x))
+
+// The references go through volatile bytes: GCC would turn plain byte
+// loops into calls to the very functions under test
+typedef volatile uint8_t string_test_byte_t;
+
+static uint8_t* string_test_src;
+static uint8_t* string_test_dst;
+static uint8_t* string_test_ref;
+static int string_test_failures;
+
+static void string_test_fail(const char* func, uint32_t dst_off, uint32_t src_off, uint32_t len) {
+    if (string_test_failures++ < STRING_TEST_MAX_REPORTS) {
+        KERROR("STRING", "%s failed: dst+%u src+%u length %u", func, dst_off, src_off, len);
+    }
+}
+
+// Varied bytes in 1-254: strings end only where a test puts a NUL, and
+// memcmp() can move any byte up or down by one
+static void string_test_fill(uint8_t* buf, size_t len, uint32_t seed) {
+    string_test_byte_t* b = buf;
+    for (size_t i = 0; i < len; i++) {
+        b[i] = (uint8_t)((i * 7 + seed) % 254 + 1);
+    }
+}
+
+static void string_test_copy_ref(uint8_t* dst, const uint8_t* src, size_t len) {
+    string_test_byte_t* d = dst;
+    const string_test_byte_t* s = src;
+    for (size_t i = 0; i < len; i++) {
+        d[i] = s[i];
+    }
+}
+
+static int string_test_equal(const uint8_t* a, const uint8_t* b, size_t len) {
+    const string_test_byte_t* x = a;
+    const string_test_byte_t* y = b;
+    for (size_t i = 0; i < len; i++) {
+        if (x[i] != y[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Copies between separate buffers. STRING_TEST_SLACK bytes past the copy
+// and everything before it are compared too, to catch stray writes.
+static void string_test_memcpy(uint32_t da, uint32_t sa, size_t len) {
+    uint8_t* dst = string_test_dst + da;
+    const uint8_t* src = string_test_src + sa;
+    size_t span = len + STRING_TEST_SLACK;
+
+    string_test_fill(string_test_src, span, 1);
+    string_test_fill(string_test_dst, span, 2);
+    string_test_copy_ref(string_test_ref, string_test_dst, span);
+    string_test_copy_ref(string_test_ref + da, src, len);
+
+    STRING_TEST_HIDE(dst);
+    STRING_TEST_HIDE(len);
+    if (memcpy(dst, src, len) != dst || !string_test_equal(string_test_dst, string_test_ref, span)) {
+        string_test_fail("memcpy", da, sa, len);
+    }
+}
+
+// Moves within one buffer: source and destination overlap whenever their
+// offsets differ by less than len, in either direction
+static void string_test_memmove(uint32_t da, uint32_t sa, size_t len) {
+    uint8_t* dst = string_test_dst + da;
+    const uint8_t* src = string_test_dst + sa;
+    size_t span = len + STRING_TEST_SLACK;
+
+    string_test_fill(string_test_dst, span, 3);
+    string_test_copy_ref(string_test_ref, string_test_dst, span);
+    string_test_copy_ref(string_test_src, src, len);
+    string_test_copy_ref(string_test_ref + da, string_test_src, len);
+
+    STRING_TEST_HIDE(dst);
+    STRING_TEST_HIDE(len);
+    if (memmove(dst, src, len) != dst || !string_test_equal(string_test_dst, string_test_ref, span)) {
+        string_test_fail("memmove", da, sa, len);
+    }
+}
+
+static void string_test_memset(uint32_t da, size_t len) {
+    uint8_t* dst = string_test_dst + da;
+    string_test_byte_t* ref = string_test_ref;
+    size_t span = len + STRING_TEST_SLACK;
+
+    string_test_fill(string_test_dst, span, 4);
+    string_test_copy_ref(string_test_ref, string_test_dst, span);
+    for (size_t i = 0; i < len; i++) {
+        ref[da + i] = 0xA5;
+    }
+
+    STRING_TEST_HIDE(dst);
+    STRING_TEST_HIDE(len);
+    if (memset(dst, 0xA5, len) != dst || !string_test_equal(string_test_dst, string_test_ref, span)) {
+        string_test_fail("memset", da, 0, len);
+    }
+}
+
+// Equal ranges, then one byte changed first, in the middle and last, in
+// both directions so the sign of the result is checked too
+static void string_test_memcmp(uint32_t da, uint32_t sa, size_t len) {
+    uint8_t* a = string_test_dst + da;
+    uint8_t* b = string_test_src + sa;
+
+    string_test_fill(string_test_src, len + STRING_TEST_SLACK, 5);
+    string_test_copy_ref(a, b, len);
+
+    STRING_TEST_HIDE(a);
+    STRING_TEST_HIDE(len);
+    if (memcmp(a, b, len) != 0) {
+        string_test_fail("memcmp", da, sa, len);
+        return;
+    }
+
+    const size_t positions[] = { 0, len / 2, len - 1 };
+    for (uint32_t p = 0; len && p < 3; p++) {
+        string_test_byte_t* x = a;
+        uint8_t saved = x[positions[p]];
+
+        x[positions[p]] = saved - 1;
+        int below = memcmp(a, b, len);
+        x[positions[p]] = saved + 1;
+        int above = memcmp(a, b, len);
+        x[positions[p]] = saved;
+
+        if (below >= 0 || above <= 0) {
+            string_test_fail("memcmp", da, sa, len);
+            return;
+        }
+    }
+}
+
+static void string_test_strlen(uint32_t sa, size_t len) {
+    char* str = (char*)string_test_src + sa;
+    string_test_byte_t* s = (uint8_t*)str;
+
+    string_test_fill(string_test_src, len + STRING_TEST_SLACK, 6);
+    s[len] = 0;
+
+    STRING_TEST_HIDE(str);
+    if (strlen(str) != len) {
+        string_test_fail("strlen", 0, sa, len);
+    }
+    // A limit below, at and above the terminator
+    if ((len && strnlen(str, len - 1) != len - 1) ||
+        strnlen(str, len) != len || strnlen(str, len + 1) != len) {
+        string_test_fail("strnlen", 0, sa, len);
+    }
+}
+
+int string_selftest(void) {
+    unsigned int order = pmm_order_for(3 * STRING_TEST_BUF_SIZE);
+    uintptr_t block = pmm_alloc_pages(order);
+    if (!block) {
+        KERROR("STRING", "No memory for the self-test buffers");
+        return 1;
+    }
+    string_test_src = phys_to_virt(block);
+    string_test_dst = string_test_src + STRING_TEST_BUF_SIZE;
+    string_test_ref = string_test_dst + STRING_TEST_BUF_SIZE;
+    string_test_failures = 0;
+
+    for (uint32_t i = 0; i < STRING_TEST_LENGTHS; i++) {
+        size_t len = string_test_lengths[i];
+
+        for (uint32_t da = 0; da < STRING_TEST_MAX_ALIGN; da++) {
+            for (uint32_t sa = 0; sa < STRING_TEST_MAX_ALIGN; sa++) {
+                string_test_memcpy(da, sa, len);
+                string_test_memmove(da, sa, len);
+                string_test_memcmp(da, sa, len);
+            }
+            string_test_memset(da, len);
+            string_test_strlen(da, len);
+        }
+    }
+
+    pmm_free_pages(block, order);
+
+    if (string_test_failures) {
+        KERROR("STRING", "Self-test: %d failures", string_test_failures);
+    } else {
+        KINFO("STRING", "Self-test passed: %u lengths, alignments 0-%u",
+              (uint32_t)STRING_TEST_LENGTHS, STRING_TEST_MAX_ALIGN - 1);
+    }
+    return string_test_failures;
+}
+
+enum string_bench_op {
+    STRING_BENCH_MEMCPY,
+    STRING_BENCH_MEMMOVE,
+    STRING_BENCH_MEMSET,
+    STRING_BENCH_MEMCMP,
+    STRING_BENCH_STRLEN,
+};
+
+static const char* string_bench_names[] = {
+    "memcpy", "memmove", "memset", "memcmp", "strlen",
+};
+
+// Results of the pure functions land here, or their calls would be dropped
+static volatile uint32_t string_bench_sink;
+
+// Fewest cycles one call took over STRING_BENCH_ROUNDS
+static uint32_t string_bench_one(enum string_bench_op op, uint8_t* dst, uint8_t* src, size_t len) {
+    uint64_t best = ~0ULL;
+
+    for (int round = 0; round < STRING_BENCH_ROUNDS; round++) {
+        STRING_TEST_HIDE(dst);
+        STRING_TEST_HIDE(src);
+        STRING_TEST_HIDE(len);
+        uint64_t start = rdtsc();
+        switch (op) {
+            case STRING_BENCH_MEMCPY:  memcpy(dst, src, len); break;
+            case STRING_BENCH_MEMMOVE: memmove(dst, src, len); break;
+            case STRING_BENCH_MEMSET:  memset(dst, 0, len); break;
+            case STRING_BENCH_MEMCMP:  string_bench_sink = memcmp(dst, src, len); break;
+            case STRING_BENCH_STRLEN:  string_bench_sink = strlen((const char*)src); break;
+        }
+        uint64_t cycles = rdtsc() - start;
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+    return best;
+}
+
+void string_benchmark(void) {
+    static const uint16_t sizes[] = { 16, 64, 256, 4096 };
+    unsigned int order = pmm_order_for(2 * STRING_TEST_BUF_SIZE);
+    uintptr_t block = pmm_alloc_pages(order);
+    if (!block) {
+        KERROR("STRING", "No memory for the benchmark buffers");
+        return;
+    }
+    uint8_t* src = phys_to_virt(block);
+    uint8_t* dst = src + STRING_TEST_BUF_SIZE;
+
+    for (uint32_t op = STRING_BENCH_MEMCPY; op <= STRING_BENCH_STRLEN; op++) {
+        for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            size_t len = sizes[i];
+
+            // Aligned, then both pointers off by one. memmove overlaps
+            // backwards, the slow direction.
+            for (uint32_t off = 0; off < 2; off++) {
+                uint8_t* d = dst + off;
+                uint8_t* s = src + off;
+                if (op == STRING_BENCH_MEMMOVE) {
+                    d = src + off + 8;
+                }
+
+                string_test_fill(src, STRING_TEST_BUF_SIZE, 7);
+                string_test_copy_ref(dst, src, STRING_TEST_BUF_SIZE);
+                ((string_test_byte_t*)s)[len] = 0;
+
+                uint32_t cycles = string_bench_one(op, d, s, len);
+                // bytes / (cycles / kHz) = kB/ms = MB/s
+                uint32_t mbps = cycles ? (uint64_t)len * clock_data.tsc_khz / cycles / 1000 : 0;
+                KINFO("STRING", "%-7s %4u bytes, offset %u: %5u cycles, %5u MB/s",
+                      string_bench_names[op], (uint32_t)len, off, cycles, mbps);
+            }
+        }
+    }
+
+    pmm_free_pages(block, order);
+}
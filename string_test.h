@@ -0,0 +1,15 @@
+#ifndef STRING_TEST_H
+#define STRING_TEST_H
+
+// Check memcpy, memmove, memset, memcmp, strlen and strnlen against byte
+// by byte references, for every source and destination misalignment 0-7
+// and lengths around each size class of string.c, including memmove
+// overlapping in both directions. Logs each failure and returns how many
+// there were.
+int string_selftest(void);
+
+// Log cycles per call and throughput of the same functions for a few
+// sizes, aligned and misaligned. Needs clock_init().
+void string_benchmark(void);
+
+#endif // STRING_TEST_H
@@ -0,0 +1,39 @@
+# switch.s - Kernel thread context switch
+
+.section .text
+
+# void context_switch(uint32_t* prev_esp, uint32_t next_esp)
+#
+# Saves the callee-saved registers on the current stack, stores the stack
+# pointer through prev_esp and resumes the thread whose stack is next_esp.
+# The caller-saved registers are already dead across the call, and
+# schedule() keeps interrupts off around it, so EFLAGS needs no saving.
+.global context_switch
+.type context_switch, @function
+context_switch:
+    mov 4(%esp), %eax
+    mov 8(%esp), %edx
+
+    push %ebp
+    push %ebx
+    push %esi
+    push %edi
+    mov %esp, (%eax)
+
+    mov %edx, %esp
+    pop %edi
+    pop %esi
+    pop %ebx
+    pop %ebp
+    ret
+
+.size context_switch, . - context_switch
+
+# Where a new thread's first context_switch() returns to (see
+# thread_create()). sched_thread_start() runs the thread and never returns.
+.global thread_start
+.type thread_start, @function
+thread_start:
+    call sched_thread_start
+
+.size thread_start, . - thread_start
@@ -0,0 +1,360 @@
+#include "timer.h"
+#include "pit.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "cpu.h"
+#include "klog.h"
+
+#define TIMER_NONE  (~0ULL)
+
+// One wheel per CPU, driven by that CPU's clock event device. Timers fire
+// on the CPU that last armed them.
+struct timer_base {
+    spinlock_t lock;
+    struct timer* slots[TIMER_LEVELS][TIMER_SLOTS];
+    uint64_t occupied[TIMER_LEVELS];    // Bit n set: slot n is non-empty
+    uint64_t clk;                       // Next unit to process
+    uint32_t active;
+
+    struct clock_event_device* device;
+    uint64_t next_event_ns;             // What the device is armed for
+
+    struct timer_stats stats;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct timer_base timer_bases[MAX_CPUS];
+
+// Interrupts must be off so the caller cannot move to another CPU
+static inline struct timer_base* timer_this_base(void) {
+    return &timer_bases[cpu_id()];
+}
+
+static inline uint64_t timer_ns_to_units(uint64_t ns) {
+    return (ns + (1ULL << TIMER_UNIT_SHIFT) - 1) >> TIMER_UNIT_SHIFT;
+}
+
+// Number of trailing zero bits of a non-zero 64-bit value, i.e. the index
+// of its lowest set bit. On i686 __builtin_ctzll() becomes a call to
+// libgcc's __ctzdi2; two 32-bit __builtin_ctz() are each a single bsf, so
+// the next-expiry search stays inline.
+static inline unsigned int timer_ctz64(uint64_t bits) {
+    uint32_t lo = (uint32_t)bits;
+    return lo ? __builtin_ctz(lo) : 32 + __builtin_ctz((uint32_t)(bits >> 32));
+}
+
+static inline uint64_t timer_ror64(uint64_t bits, unsigned int n) {
+    return n ? (bits >> n) | (bits << (64 - n)) : bits;
+}
+
+// Put t on the level whose slots are just coarse enough to hold its delay
+static void timer_enqueue(struct timer_base* base, struct timer* t) {
+    uint64_t expires = t->expires;
+    unsigned int level = 0;
+
+    if ((int64_t)(expires - base->clk) < 0) {
+        expires = base->clk;
+    } else {
+        uint64_t delta = expires - base->clk;
+        if (delta > TIMER_MAX_UNITS) {
+            delta = TIMER_MAX_UNITS;
+            expires = base->clk + delta;
+        }
+        while (level < TIMER_LEVELS - 1 && delta >= (1ULL << ((level + 1) * TIMER_SLOT_BITS))) {
+            level++;
+        }
+    }
+
+    unsigned int slot = (expires >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+    struct timer** head = &base->slots[level][slot];
+
+    t->prev = NULL;
+    t->next = *head;
+    if (*head) {
+        (*head)->prev = t;
+    }
+    *head = t;
+
+    t->base = base;
+    t->level = level;
+    t->slot = slot;
+    t->pending = 1;
+    base->occupied[level] |= 1ULL << slot;
+    base->active++;
+}
+
+static void timer_dequeue(struct timer_base* base, struct timer* t) {
+    if (t->prev) {
+        t->prev->next = t->next;
+    } else {
+        base->slots[t->level][t->slot] = t->next;
+    }
+    if (t->next) {
+        t->next->prev = t->prev;
+    }
+    if (!base->slots[t->level][t->slot]) {
+        base->occupied[t->level] &= ~(1ULL << t->slot);
+    }
+
+    t->next = t->prev = NULL;
+    t->pending = 0;
+    base->active--;
+}
+
+// Re-file every timer of one slot; they all land on lower levels
+static void timer_cascade(struct timer_base* base, unsigned int level, unsigned int slot) {
+    struct timer* t;
+    while ((t = base->slots[level][slot])) {
+        timer_dequeue(base, t);
+        timer_enqueue(base, t);
+        base->stats.cascaded++;
+    }
+}
+
+// Next unit at which the wheel has work, or TIMER_NONE. Exact for level 0;
+// for higher levels it is the time their next occupied slot cascades.
+static uint64_t timer_next_expiry(const struct timer_base* base) {
+    uint64_t next = TIMER_NONE;
+
+    for (unsigned int level = 0; level < TIMER_LEVELS; level++) {
+        uint64_t bits = base->occupied[level];
+        if (!bits) {
+            continue;
+        }
+
+        unsigned int shift = level * TIMER_SLOT_BITS;
+        unsigned int current = (base->clk >> shift) & TIMER_SLOT_MASK;
+
+        // Level 0 slots expire at their own unit. Higher level slots are
+        // emptied when the level below wraps into them; unless clk sits on
+        // such a wrap that is still to be processed, the current slot has
+        // already been cascaded and the search starts one past it.
+        unsigned int skip = (base->clk & ((1ULL << shift) - 1)) != 0;
+        unsigned int first = (current + skip) & TIMER_SLOT_MASK;
+        unsigned int distance = timer_ctz64(timer_ror64(bits, first)) + skip;
+        uint64_t when = ((base->clk >> shift) + distance) << shift;
+
+        if (when < next) {
+            next = when;
+        }
+    }
+    return next;
+}
+
+// Arm the device for the next expiry; with no timers pending it stays idle
+static void timer_program(struct timer_base* base, uint64_t now) {
+    uint64_t next = timer_next_expiry(base);
+    struct clock_event_device* dev = base->device;
+
+    if (!dev || next == TIMER_NONE) {
+        base->next_event_ns = TIMER_NONE;
+        return;
+    }
+
+    uint64_t deadline = next << TIMER_UNIT_SHIFT;
+    uint64_t delta = deadline > now ? deadline - now : 0;
+    if (delta < dev->min_delta_ns) {
+        delta = dev->min_delta_ns;
+    } else if (delta > dev->max_delta_ns) {
+        delta = dev->max_delta_ns;
+    }
+
+    base->next_event_ns = now + delta;
+    dev->set_next_event(delta);
+    base->stats.reprograms++;
+}
+
+// Process every unit up to and including now, skipping runs of empty
+// slots. Callbacks run with the lock dropped so they can re-arm timers.
+static void timer_run(struct timer_base* base, uint64_t now) {
+    while (base->clk <= now) {
+        unsigned int index = base->clk & TIMER_SLOT_MASK;
+
+        if (!index) {
+            for (unsigned int level = 1; level < TIMER_LEVELS; level++) {
+                unsigned int slot = (base->clk >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+                timer_cascade(base, level, slot);
+                if (slot) {
+                    break;
+                }
+            }
+        }
+
+        // Advance first, so timers re-armed by a callback for an expired
+        // time land in the next slot instead of the one being emptied
+        base->clk++;
+
+        struct timer* t;
+        while ((t = base->slots[0][index])) {
+            timer_dequeue(base, t);
+            base->stats.expired++;
+            spin_unlock(&base->lock);
+            t->func(t->data);
+            spin_lock(&base->lock);
+        }
+
+        // Jump to the next occupied level 0 slot, but never past the next
+        // wrap, where higher levels have to cascade
+        index = base->clk & TIMER_SLOT_MASK;
+        if (index) {
+            uint64_t ahead = base->occupied[0] >> index;
+            uint64_t target = ahead ? base->clk + timer_ctz64(ahead)
+                                    : (base->clk | TIMER_SLOT_MASK) + 1;
+            base->clk = target <= now ? target : now + 1;
+        }
+    }
+}
+
+static void timer_interrupt(void) {
+    struct timer_base* base = timer_this_base();
+
+    spin_lock(&base->lock);
+    base->stats.interrupts++;
+    base->next_event_ns = TIMER_NONE;
+
+    timer_run(base, ktime_ns() >> TIMER_UNIT_SHIFT);
+    timer_program(base, ktime_ns());
+    spin_unlock(&base->lock);
+}
+
+void timer_register_clockevent(struct clock_event_device* dev) {
+    uint32_t flags = irq_save();
+    struct timer_base* base = timer_this_base();
+
+    spin_lock(&base->lock);
+    if (base->device && base->device->rating >= dev->rating) {
+        spin_unlock_irqrestore(&base->lock, flags);
+        return;
+    }
+    if (base->device) {
+        base->device->event_handler = NULL;
+        base->device->shutdown();
+    }
+
+    // Whatever the device was doing before (e.g. a periodic boot tick)
+    // stops; from here on it only fires for pending timers
+    base->device = dev;
+    dev->event_handler = timer_interrupt;
+    dev->shutdown();
+    timer_program(base, ktime_ns());
+
+    spin_unlock_irqrestore(&base->lock, flags);
+    KINFO("TIMER", "CPU %u clock event device: %s (max one-shot %u us)",
+          cpu_id(), dev->name, (uint32_t)(dev->max_delta_ns / NSEC_PER_USEC));
+}
+
+void __init timer_init(void) {
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        timer_bases[cpu].next_event_ns = TIMER_NONE;
+    }
+    timer_bases[0].clk = ktime_ns() >> TIMER_UNIT_SHIFT;
+    timer_register_clockevent(&pit_clockevent);
+    KINFO_INIT("TIMER", "%d-level timer wheel, %d slots per level, %d us resolution",
+               TIMER_LEVELS, TIMER_SLOTS, (1 << TIMER_UNIT_SHIFT) / NSEC_PER_USEC);
+}
+
+void timer_setup(struct timer* t, void (*func)(void* data), void* data) {
+    t->next = t->prev = NULL;
+    t->base = NULL;
+    t->func = func;
+    t->data = data;
+    t->pending = 0;
+}
+
+// Take t off whichever wheel holds it. Returns 1 if it was pending.
+static int timer_detach(struct timer* t) {
+    struct timer_base* base = t->base;
+    int was_pending = 0;
+
+    if (base) {
+        spin_lock(&base->lock);
+        if (t->pending && t->base == base) {
+            timer_dequeue(base, t);
+            was_pending = 1;
+        }
+        spin_unlock(&base->lock);
+    }
+    return was_pending;
+}
+
+void timer_add(struct timer* t, uint64_t delay_ns) {
+    uint32_t flags = irq_save();
+    struct timer_base* base = timer_this_base();
+
+    timer_detach(t);
+
+    spin_lock(&base->lock);
+    uint64_t now = ktime_ns();
+
+    // While tickless with nothing pending, nobody advances the wheel.
+    // Catch up here rather than cascading through the idle stretch later.
+    if (!base->active) {
+        base->clk = now >> TIMER_UNIT_SHIFT;
+    }
+
+    t->expires = timer_ns_to_units(now + delay_ns);
+    timer_enqueue(base, t);
+
+    if ((t->expires << TIMER_UNIT_SHIFT) < base->next_event_ns) {
+        timer_program(base, now);
+    }
+
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+int timer_cancel(struct timer* t) {
+    // The device stays armed; an early interrupt with nothing due just
+    // reprograms it
+    uint32_t flags = irq_save();
+    int was_pending = timer_detach(t);
+    irq_restore(flags);
+    return was_pending;
+}
+
+void timer_idle(void) {
+    irq_save();
+    struct timer_base* base = timer_this_base();
+
+    uint64_t start = ktime_ns();
+    spin_lock(&base->lock);
+    base->stats.idle_entries++;
+
+    // Normally already armed by timer_add() or the last interrupt
+    uint64_t next = timer_next_expiry(base);
+    if (next != TIMER_NONE && (next << TIMER_UNIT_SHIFT) < base->next_event_ns) {
+        timer_program(base, start);
+    }
+    spin_unlock(&base->lock);
+
+    cpu_wait_for_interrupt();
+
+    uint32_t flags = spin_lock_irqsave(&base->lock);
+    base->stats.idle_ns += ktime_ns() - start;
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+void timer_get_stats(struct timer_stats* stats) {
+    *stats = (struct timer_stats){ 0 };
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct timer_base* base = &timer_bases[cpu];
+        uint32_t flags = spin_lock_irqsave(&base->lock);
+        stats->interrupts += base->stats.interrupts;
+        stats->expired += base->stats.expired;
+        stats->cascaded += base->stats.cascaded;
+        stats->reprograms += base->stats.reprograms;
+        stats->idle_entries += base->stats.idle_entries;
+        stats->idle_ns += base->stats.idle_ns;
+        stats->pending += base->active;
+        spin_unlock_irqrestore(&base->lock, flags);
+    }
+}
+
+void timer_dump_stats(void) {
+    struct timer_stats stats;
+    timer_get_stats(&stats);
+
+    KINFO("TIMER", "%u interrupts, %u expired, %u cascaded, %u reprograms, %u pending",
+          stats.interrupts, stats.expired, stats.cascaded, stats.reprograms, stats.pending);
+    KINFO("TIMER", "%u idle entries, %u ms idle", stats.idle_entries,
+          (uint32_t)(stats.idle_ns / NSEC_PER_MSEC));
+}
@@ -0,0 +1,74 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include "clock.h"
+
+// Hierarchical timer wheel. Time is counted in units of 2^TIMER_UNIT_SHIFT
+// ns (about 1 ms). Level n has TIMER_SLOTS slots that each cover
+// TIMER_SLOTS^n units; timers move down a level whenever the level below
+// wraps. Insert and cancel are O(1), and a per-level occupancy bitmap
+// finds the next expiry without walking empty slots. Each CPU has its own
+// wheel and clock event device; a timer fires on the CPU that armed it.
+#define TIMER_UNIT_SHIFT    20
+#define TIMER_LEVELS        4
+#define TIMER_SLOT_BITS     6
+#define TIMER_SLOTS         (1 << TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK     (TIMER_SLOTS - 1)
+
+// Longest delay the wheel holds, about 4.9 hours; later expiries are clamped
+#define TIMER_MAX_UNITS     ((1ULL << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)
+
+struct timer_base;
+
+struct timer {
+    struct timer* next;
+    struct timer* prev;
+    struct timer_base* base;    // Wheel it was last queued on
+    uint64_t expires;           // In wheel units
+    void (*func)(void* data);   // Runs in interrupt context
+    void* data;
+    uint8_t pending;
+    uint8_t level;
+    uint8_t slot;
+};
+
+struct timer_stats {
+    uint32_t interrupts;        // Clock event interrupts taken
+    uint32_t expired;           // Callbacks run
+    uint32_t cascaded;          // Timers moved down a level
+    uint32_t reprograms;        // Clock event device writes
+    uint32_t idle_entries;
+    uint32_t pending;           // Timers queued right now
+    uint64_t idle_ns;           // Time spent halted in timer_idle()
+};
+
+// Switch the calling CPU's timer interrupts to dev if it is the best device
+// that CPU has seen so far. The device is only ever used in one-shot mode.
+void timer_register_clockevent(struct clock_event_device* dev);
+
+// Start the boot CPU's wheel on the PIT. Needs clock_init() and gdt_init().
+void timer_init(void);
+
+void timer_setup(struct timer* t, void (*func)(void* data), void* data);
+
+// (Re)arm t on the calling CPU to fire no earlier than delay_ns from now.
+// A timer must not be armed from two CPUs at once.
+void timer_add(struct timer* t, uint64_t delay_ns);
+
+// Disarm t. Returns 1 if it was pending.
+int timer_cancel(struct timer* t);
+
+static inline int timer_pending(const struct timer* t) {
+    return t->pending;
+}
+
+// Program this CPU's clock event device for the next expiry and halt until an
+// interrupt arrives. Returns with interrupts enabled.
+void timer_idle(void);
+
+// Totals over all CPUs
+void timer_get_stats(struct timer_stats* stats);
+void timer_dump_stats(void);
+
+#endif // TIMER_H
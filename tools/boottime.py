@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""Summarize boot time breakdowns from several boots.
+
+Usage: boottime.py [--baseline FILE] [--save FILE] [--threshold PCT] [--min-us US] LOG...
+
+Each LOG holds the decoded serial output of one boot (make boottime runs
+them through klogdecode.py), with the "Boot stage NAME: N us" and "Boot
+total: N us" lines boottime_report() logs. Prints the median and p95 of
+every stage across the boots.
+
+With --baseline, also shows each median against the one stored in FILE
+and exits with status 1 if any stage got slower by more than PCT percent
+(default 10) and more than US microseconds (default 50), or if FILE does
+not exist. --save writes the medians of this run to FILE as the new
+baseline.
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+
+STAGE = re.compile(r"Boot stage (\S+): (\d+) us")
+TOTAL = re.compile(r"Boot total: (\d+) us")
+
+
+def read_boot(path):
+    """Return {stage: us} for one boot, in log order."""
+    stages = {}
+    with open(path, "rb") as f:
+        for raw in f:
+            line = raw.decode("latin-1")
+            m = STAGE.search(line)
+            if m:
+                stages[m[1]] = stages.get(m[1], 0) + int(m[2])
+                continue
+            m = TOTAL.search(line)
+            if m:
+                stages["total"] = int(m[1])
+    if "total" not in stages:
+        sys.exit("%s: no boot time breakdown" % path)
+    return stages
+
+
+def percentile(values, pct):
+    """Nearest-rank percentile of a non-empty list."""
+    ordered = sorted(values)
+    rank = max(1, -(-len(ordered) * pct // 100))
+    return ordered[rank - 1]
+
+
+def main():
+    parser = argparse.ArgumentParser(usage=__doc__.strip().splitlines()[2][7:])
+    parser.add_argument("logs", nargs="+")
+    parser.add_argument("--baseline", metavar="FILE")
+    parser.add_argument("--save", metavar="FILE")
+    parser.add_argument("--threshold", type=float, default=10.0)
+    parser.add_argument("--min-us", type=int, default=50)
+    args = parser.parse_args()
+
+    boots = [read_boot(path) for path in args.logs]
+    names = []
+    for boot in boots:
+        names.extend(name for name in boot if name not in names)
+    # The total reads best last
+    names.remove("total")
+    names.append("total")
+
+    baseline = {}
+    if args.baseline:
+        # Without one nothing could ever count as a regression
+        if not os.path.exists(args.baseline):
+            sys.exit("no baseline at %s: record one with make boottime-baseline "
+                     "on the reference setup and commit it" % args.baseline)
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    medians = {}
+    regressions = []
+    print("%d boots" % len(boots))
+    print("%-22s %9s %9s %9s %8s" % ("stage", "median", "p95", "baseline", "change"))
+    for name in names:
+        values = [boot.get(name, 0) for boot in boots]
+        median = percentile(values, 50)
+        medians[name] = median
+        line = "%-22s %7dus %7dus" % (name, median, percentile(values, 95))
+        if name in baseline:
+            base = baseline[name]
+            change = 100.0 * (median - base) / base if base else 0.0
+            line += " %7dus %+7.1f%%" % (base, change)
+            if median - base > args.min_us and change > args.threshold:
+                line += "  REGRESSION"
+                regressions.append(name)
+        print(line)
+
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump(medians, f, indent=2)
+            f.write("\n")
+        print("baseline saved to %s" % args.save)
+
+    if regressions:
+        sys.exit("boot time regressed in: %s" % ", ".join(regressions))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""Decode the kernel log stream from COM1.
+
+Usage: klogdecode.py KERNEL [CAPTURE]
+
+KERNEL is the mykernel.bin the log came from; CAPTURE is a file holding the
+serial output (default: stdin). Plain text passes through unchanged. Binary
+entries (built with KLOG_BINARY=1, see struct klog_bin_header in klog.h)
+are rendered as the text sink would have printed them, using the format
+strings and subsystem names of the .klog_sites records in KERNEL. Format
+strings of __init code are read from the file, so they still decode after
+the kernel has freed them.
+"""
+
+import re
+import struct
+import sys
+
+KLOG_BIN_SYNC = 0xFE
+KLOG_BIN_CLOCK = 0xFFFF
+KLOG_DATA_SIZE = 128
+KLOG_MAX_ARGS = 12
+HEADER = struct.Struct("<BBHQ")
+SITE = struct.Struct("<IIIBBBB")
+
+LEVELS = ["DEBUG", "INFO ", "WARN ", "ERROR", "PANIC"]
+
+# Same subset as kvformat() in klog.c
+SPEC = re.compile(r"%([-0+ #]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|z)?(.?)", re.S)
+
+
+class Elf:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1:
+            sys.exit(f"{path}: not a 32-bit ELF file")
+
+        shoff, = struct.unpack_from("<I", self.data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", self.data, 0x2E)
+        headers = [struct.unpack_from("<IIIIIIIIII", self.data, shoff + i * shentsize)
+                   for i in range(shnum)]
+        strtab = headers[shstrndx][4]
+
+        # name -> (addr, offset, size), for sections with file contents
+        self.sections = {}
+        for name, kind, _, addr, offset, size, *_ in headers:
+            if kind == 8:   # SHT_NOBITS
+                continue
+            end = self.data.index(b"\0", strtab + name)
+            self.sections[self.data[strtab + name:end].decode()] = (addr, offset, size)
+
+    def string(self, addr):
+        for base, offset, size in self.sections.values():
+            if base and base <= addr < base + size:
+                start = offset + addr - base
+                return self.data[start:self.data.index(b"\0", start)].decode("latin-1")
+        return f"<bad string 0x{addr:08x}>"
+
+
+class Site:
+    def __init__(self, elf, fields):
+        fmt, subsystem, _, level, _, _, _ = fields
+        self.format = elf.string(fmt)
+        self.subsystem = elf.string(subsystem)
+        self.level = LEVELS[level] if level < len(LEVELS) else "?????"
+
+
+def load_sites(elf):
+    if ".klog_sites" not in elf.sections:
+        sys.exit("kernel has no .klog_sites section")
+    _, offset, size = elf.sections[".klog_sites"]
+    return [Site(elf, SITE.unpack_from(elf.data, offset + i))
+            for i in range(0, size, SITE.size)]
+
+
+class Args:
+    """Argument words of one record, consumed the way klog.c lays them out."""
+
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+        self.count = 0
+
+    def word(self):
+        self.count += 1
+        if self.count > KLOG_MAX_ARGS or self.pos + 4 > len(self.data):
+            return 0
+        value, = struct.unpack_from("<I", self.data, self.pos)
+        self.pos += 4
+        return value
+
+    def dword(self):
+        self.count += 1
+        if self.count > KLOG_MAX_ARGS or self.pos + 8 > len(self.data):
+            return 0
+        value, = struct.unpack_from("<Q", self.data, self.pos)
+        self.pos += 8
+        return value
+
+    def string(self):
+        offset = self.word()
+        if offset >= len(self.data):
+            return "(null)"
+        end = self.data.find(b"\0", offset)
+        return self.data[offset:end if end >= 0 else None].decode("latin-1")
+
+
+def signed(value, bits):
+    return value - (1 << bits) if value >> (bits - 1) else value
+
+
+def render(fmt, args):
+    def conversion(m):
+        flags, width, precision, length, conv = m.groups()
+        if width == "*":
+            width = str(signed(args.word(), 32))
+        if precision == "*":
+            precision = str(signed(args.word(), 32))
+        spec = "%" + flags + (width or "") + ("." + precision if precision is not None else "")
+
+        if conv in "di":
+            if length == "ll":
+                return (spec + "d") % signed(args.dword(), 64)
+            bits = {"hh": 8, "h": 16}.get(length, 32)
+            return (spec + "d") % signed(args.word() & ((1 << bits) - 1), bits)
+        if conv in "uxX":
+            value = args.dword() if length == "ll" else args.word()
+            if length in ("hh", "h"):
+                value &= 0xFF if length == "hh" else 0xFFFF
+            return (spec + ("d" if conv == "u" else conv)) % value
+        if conv == "p":
+            return ("%" + flags.replace("0", "") + (width or "") + "s") % ("0x%08x" % args.word())
+        if conv == "s":
+            return (spec + "s") % args.string()
+        if conv == "c":
+            return (spec + "c") % chr(args.word() & 0xFF)
+        if conv == "%":
+            return "%"
+        return m.group(0)
+
+    return SPEC.sub(conversion, fmt)
+
+
+def format_time(ns):
+    sec, rem = divmod(ns, 1000000000)
+    return "[%5d.%06d] " % (sec, rem // 1000)
+
+
+class Decoder:
+    def __init__(self, sites, out):
+        self.sites = sites
+        self.out = out
+        self.clock = None   # (tsc_base, mult, shift)
+        self.text = bytearray()
+
+    def time(self, tsc):
+        if not self.clock:
+            return 0
+        base, mult, shift = self.clock
+        return max(tsc - base, 0) * mult >> shift
+
+    def entry(self, site, tsc, data):
+        if site == KLOG_BIN_CLOCK:
+            self.clock = (tsc,) + struct.unpack_from("<II", data)
+            return
+        s = self.sites[site]
+        self.out.write("%s[%s] %s: %s\n" % (format_time(self.time(tsc)), s.level,
+                                            s.subsystem, render(s.format, Args(data))))
+
+    def flush_text(self):
+        if self.text:
+            self.out.write(self.text.decode("latin-1").replace("\r", ""))
+            self.text.clear()
+
+    def feed(self, buf):
+        """Decode what buf holds; returns the bytes of an incomplete entry."""
+        i = 0
+        while i < len(buf):
+            if buf[i] != KLOG_BIN_SYNC:
+                j = buf.find(bytes([KLOG_BIN_SYNC]), i)
+                j = len(buf) if j < 0 else j
+                self.text += buf[i:j]
+                i = j
+                continue
+            if len(buf) - i < HEADER.size:
+                break
+            _, size, site, tsc = HEADER.unpack_from(buf, i)
+            if size > KLOG_DATA_SIZE or (site >= len(self.sites) and site != KLOG_BIN_CLOCK):
+                # Not an entry after all; resynchronize on the next sync byte
+                self.text.append(buf[i])
+                i += 1
+                continue
+            if len(buf) - i < HEADER.size + size:
+                break
+            self.flush_text()
+            start = i + HEADER.size
+            self.entry(site, tsc, bytes(buf[start:start + size]))
+            i = start + size
+
+        if b"\n" in self.text:
+            cut = self.text.rindex(b"\n") + 1
+            self.out.write(self.text[:cut].decode("latin-1").replace("\r", ""))
+            del self.text[:cut]
+        self.out.flush()
+        return buf[i:]
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit(__doc__.strip().splitlines()[2])
+
+    decoder = Decoder(load_sites(Elf(sys.argv[1])), sys.stdout)
+    src = open(sys.argv[2], "rb") if len(sys.argv) == 3 else sys.stdin.buffer
+    pending = b""
+    with src:
+        while True:
+            chunk = src.read1(4096) if hasattr(src, "read1") else src.read(4096)
+            if not chunk:
+                break
+            pending = decoder.feed(pending + chunk)
+    decoder.text += pending
+    decoder.flush_text()
+
+
+if __name__ == "__main__":
+    main()
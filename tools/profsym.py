@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Symbolize a profile dump from the kernel.
+
+Usage: profsym.py [--folded FILE] [--top N] KERNEL [CAPTURE]
+
+CAPTURE holds the serial output (default: stdin) with the PROFILE lines
+that profile_dump() writes (press F9 in a PROFILE_HZ build); the last
+complete dump in it is used. Log lines around it are ignored, so the raw
+capture or the output of klogdecode.py both work. KERNEL is the matching
+build/mykernel.bin.
+
+Prints a flat profile: samples whose interrupted EIP is in a function
+(self) and samples with the function anywhere on the stack (total). With
+--folded, also writes one "caller;...;leaf count" line per distinct stack,
+the input format of flamegraph.pl. Stacks are only deeper than one frame
+in FRAME_POINTERS=1 builds.
+"""
+
+import argparse
+import bisect
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+LINE = re.compile(r"PROFILE (\d+) (\d+)((?: [0-9a-f]+)*)\s*$")
+BEGIN = re.compile(r"PROFILE BEGIN (\d+) (\d+) (\d+)")
+
+
+class Symbols:
+    def __init__(self, kernel):
+        nm = os.environ.get("NM") or shutil.which("i686-elf-nm") or "nm"
+        out = subprocess.run([nm, "-n", "--defined-only", kernel],
+                             check=True, capture_output=True, text=True).stdout
+        self.addrs = []
+        self.names = []
+        for line in out.splitlines():
+            fields = line.split()
+            if len(fields) == 3 and fields[1] in "tTwW":
+                self.addrs.append(int(fields[0], 16))
+                self.names.append(fields[2])
+
+    def lookup(self, addr):
+        i = bisect.bisect_right(self.addrs, addr) - 1
+        return self.names[i] if i >= 0 else "0x%08x" % addr
+
+
+def read_dump(src):
+    """Return (header, stacks) of the last complete dump in src."""
+    dump = None
+    current = None
+    for raw in src:
+        line = raw.decode("latin-1") if isinstance(raw, bytes) else raw
+        if "PROFILE BEGIN" in line:
+            m = BEGIN.search(line)
+            current = ({"hz": int(m[1]), "samples": int(m[2]), "dropped": int(m[3])}, [])
+        elif "PROFILE END" in line:
+            if current:
+                dump = current
+            current = None
+        elif current is not None:
+            m = LINE.search(line)
+            if m:
+                pcs = [int(x, 16) for x in m[3].split()]
+                current[1].append((int(m[1]), int(m[2]), pcs))
+    if not dump:
+        sys.exit("no complete PROFILE dump found")
+    return dump
+
+
+def main():
+    parser = argparse.ArgumentParser(usage=__doc__.strip().splitlines()[2][7:])
+    parser.add_argument("kernel")
+    parser.add_argument("capture", nargs="?")
+    parser.add_argument("--folded", metavar="FILE")
+    parser.add_argument("--top", type=int, default=30)
+    args = parser.parse_args()
+
+    syms = Symbols(args.kernel)
+    with (open(args.capture, "rb") if args.capture else sys.stdin.buffer) as src:
+        header, stacks = read_dump(src)
+
+    total_samples = sum(count for _, count, _ in stacks) or 1
+    self_counts = {}
+    total_counts = {}
+    folded = {}
+
+    for _, count, pcs in stacks:
+        # Return addresses point past the call; step back into it
+        frames = [syms.lookup(pc if i == 0 else pc - 1) for i, pc in enumerate(pcs)]
+        self_counts[frames[0]] = self_counts.get(frames[0], 0) + count
+        for name in set(frames):
+            total_counts[name] = total_counts.get(name, 0) + count
+        key = ";".join(reversed(frames))
+        folded[key] = folded.get(key, 0) + count
+
+    print("%d samples at %d Hz per CPU, %d dropped" %
+          (header["samples"], header["hz"], header["dropped"]))
+    print("%7s %7s %7s %7s  %s" % ("self%", "self", "total%", "total", "function"))
+    ranked = sorted(total_counts, key=lambda n: (-self_counts.get(n, 0), -total_counts[n], n))
+    for name in ranked[:args.top]:
+        s = self_counts.get(name, 0)
+        t = total_counts[name]
+        print("%6.2f%% %7d %6.2f%% %7d  %s" %
+              (100.0 * s / total_samples, s, 100.0 * t / total_samples, t, name))
+
+    if args.folded:
+        with open(args.folded, "w") as out:
+            for key in sorted(folded):
+                out.write("%s %d\n" % (key, folded[key]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""Convert a kernel trace dump to Chrome trace event JSON.
+
+Usage: trace2json.py [CAPTURE]
+
+CAPTURE holds the serial output (default: stdin) with the TRACE lines that
+trace_dump() writes (make trace boots with "trace" on the command line and
+captures them); the last complete dump in it is used. Log lines around it
+are ignored. Writes JSON to stdout for ui.perfetto.dev or chrome://tracing:
+one track per CPU, spans for IRQs, exceptions, boot stages, console flushes
+and allocator calls, timestamps relative to the earliest record.
+"""
+
+import argparse
+import json
+import re
+import sys
+
+BEGIN = re.compile(r"TRACE BEGIN (\d+) (\d+) (\d+)")
+EVENT = re.compile(r"TRACE EVENT (\d+) (\S+)")
+RECORD = re.compile(r"TRACE (\d+) ([0-9a-f]+) (\d+) ([BEi]) ([0-9a-f]+)\s*$")
+
+
+def read_dump(src):
+    """Return (header, names, records) of the last complete dump in src."""
+    dump = None
+    current = None
+    for raw in src:
+        line = raw.decode("latin-1") if isinstance(raw, bytes) else raw
+        if "TRACE BEGIN" in line:
+            m = BEGIN.search(line)
+            header = {"tsc_khz": int(m[1]), "records": int(m[2]), "dropped": int(m[3])}
+            current = (header, {}, [])
+        elif "TRACE END" in line:
+            if current:
+                dump = current
+            current = None
+        elif current is not None:
+            m = EVENT.search(line)
+            if m:
+                current[1][int(m[1])] = m[2]
+                continue
+            m = RECORD.search(line)
+            if m:
+                current[2].append((int(m[1]), int(m[2], 16), int(m[3]), m[4], int(m[5], 16)))
+    if not dump:
+        sys.exit("no complete TRACE dump found")
+    return dump
+
+
+def main():
+    parser = argparse.ArgumentParser(usage=__doc__.strip().splitlines()[2][7:])
+    parser.add_argument("capture", nargs="?")
+    args = parser.parse_args()
+
+    with (open(args.capture, "rb") if args.capture else sys.stdin.buffer) as src:
+        header, names, records = read_dump(src)
+    if not header["tsc_khz"]:
+        sys.exit("dump has no TSC frequency")
+    if not records:
+        sys.exit("dump has no records")
+
+    base = min(tsc for _, tsc, _, _, _ in records)
+    cycles_per_us = header["tsc_khz"] / 1000.0
+    events = []
+    open_spans = {}
+
+    for cpu in sorted({cpu for cpu, _, _, _, _ in records}):
+        events.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": cpu,
+                       "args": {"name": "CPU %d" % cpu}})
+
+    # Each CPU's ring is in time order already
+    for cpu, tsc, event, phase, arg in records:
+        ts = (tsc - base) / cycles_per_us
+        name = names.get(event, "event%d" % event)
+        stack = open_spans.setdefault(cpu, [])
+        if phase == "B":
+            stack.append(name)
+        elif phase == "E":
+            # Its begin may predate tracing or have been dropped
+            if name not in stack:
+                continue
+            # Spans opened inside it and never ended are closed with it
+            while stack[-1] != name:
+                events.append({"name": stack.pop(), "ph": "E", "ts": ts, "pid": 0, "tid": cpu})
+            stack.pop()
+        ev = {"name": name, "ph": phase, "ts": ts, "pid": 0, "tid": cpu, "args": {"arg": arg}}
+        if phase == "i":
+            ev["s"] = "t"
+        events.append(ev)
+
+    # Close spans still open when tracing stopped
+    end = max(e.get("ts", 0) for e in events)
+    for cpu, stack in open_spans.items():
+        while stack:
+            events.append({"name": stack.pop(), "ph": "E", "ts": end, "pid": 0, "tid": cpu})
+
+    json.dump({"traceEvents": events, "displayTimeUnit": "ns",
+               "otherData": {"tsc_khz": header["tsc_khz"], "dropped": header["dropped"]}},
+              sys.stdout)
+    sys.stdout.write("\n")
+    print("%d records, %d dropped" % (len(records), header["dropped"]), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,135 @@
+#include "trace.h"
+#include "clock.h"
+#include "sched.h"
+#include "smp.h"
+#include "pmm.h"
+#include "paging.h"
+#include "serial.h"
+#include "string.h"
+#include "cpu.h"
+#include "klog.h"
+
+// Retry interval while the serial transmit ring is full
+#define TRACE_DUMP_WAIT_NS  (10 * NSEC_PER_MSEC)
+
+extern const struct trace_event __trace_events_start[];
+extern const struct trace_event __trace_events_end[];
+
+// Written only by the owning CPU with interrupts off; head is published
+// last so the dump never reads a half-written record
+struct trace_cpu {
+    struct trace_record* ring;
+    volatile uint32_t head;
+    uint32_t dropped;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+uint8_t trace_active;
+
+static struct trace_cpu trace_cpus[MAX_CPUS];
+static struct trace_record trace_boot_ring[TRACE_RING_SIZE];
+
+void trace_record(const struct trace_event* event, uint8_t phase, uint32_t arg) {
+    uint32_t flags = irq_save();
+    struct trace_cpu* tc = &trace_cpus[cpu_id()];
+    uint32_t head = tc->head;
+
+    if (tc->ring && head < TRACE_RING_SIZE) {
+        struct trace_record* rec = &tc->ring[head];
+        rec->tsc = rdtsc();
+        rec->event = event - __trace_events_start;
+        rec->phase = phase;
+        rec->arg = arg;
+        __atomic_store_n(&tc->head, head + 1, __ATOMIC_RELEASE);
+    } else {
+        tc->dropped++;
+    }
+    irq_restore(flags);
+}
+
+void __init trace_init(const char* cmdline) {
+    if (!cmdline || !strword(cmdline, "trace")) {
+        return;
+    }
+
+    trace_cpus[cpu_id()].ring = trace_boot_ring;
+    __atomic_store_n(&trace_active, 1, __ATOMIC_RELEASE);
+    KINFO_INIT("TRACE", "Tracing %u events per CPU for %u ms",
+               TRACE_RING_SIZE, TRACE_WINDOW_MS);
+}
+
+void __init trace_init_cpu(uint32_t cpu) {
+    if (!__atomic_load_n(&trace_active, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    uintptr_t ring = pmm_alloc_pages(pmm_order_for(TRACE_RING_SIZE * sizeof(struct trace_record)));
+    if (!ring) {
+        KERROR("TRACE", "No memory for the CPU %u ring", cpu);
+        return;
+    }
+    __atomic_store_n(&trace_cpus[cpu].ring, phys_to_virt(ring), __ATOMIC_RELEASE);
+}
+
+void trace_stop(void) {
+    __atomic_store_n(&trace_active, 0, __ATOMIC_RELEASE);
+}
+
+// Queue a whole line, waiting for the UART to make room
+static void trace_write(const char* line, size_t len) {
+    while (!serial_write(SERIAL_COM1, line, len)) {
+        serial_flush(SERIAL_COM1);
+        thread_sleep(TRACE_DUMP_WAIT_NS);
+    }
+}
+
+void trace_dump(void) {
+    char line[64];
+    struct trace_stats stats;
+    size_t len;
+
+    trace_get_stats(&stats);
+    len = ksnprintf(line, sizeof(line), "TRACE BEGIN %u %u %u\n",
+                    clock_data.tsc_khz, stats.records, stats.dropped);
+    trace_write(line, len);
+
+    for (const struct trace_event* ev = __trace_events_start; ev < __trace_events_end; ev++) {
+        len = ksnprintf(line, sizeof(line), "TRACE EVENT %u %s\n",
+                        (uint32_t)(ev - __trace_events_start), ev->name);
+        trace_write(line, len);
+    }
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct trace_cpu* tc = &trace_cpus[cpu];
+        uint32_t head = __atomic_load_n(&tc->head, __ATOMIC_ACQUIRE);
+
+        for (uint32_t i = 0; i < head; i++) {
+            const struct trace_record* rec = &tc->ring[i];
+            len = ksnprintf(line, sizeof(line), "TRACE %u %016llx %u %c %x\n",
+                            cpu, rec->tsc, rec->event, rec->phase, rec->arg);
+            trace_write(line, len);
+        }
+    }
+
+    trace_write("TRACE END\n", 10);
+    serial_flush(SERIAL_COM1);
+}
+
+void trace_get_stats(struct trace_stats* stats) {
+    *stats = (struct trace_stats){ 0 };
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        stats->records += __atomic_load_n(&trace_cpus[cpu].head, __ATOMIC_ACQUIRE);
+        stats->dropped += trace_cpus[cpu].dropped;
+    }
+}
+
+void trace_dump_stats(void) {
+    struct trace_stats stats;
+
+    if (!trace_active) {
+        return;
+    }
+    trace_get_stats(&stats);
+
+    KINFO("TRACE", "%u records, %u dropped", stats.records, stats.dropped);
+}
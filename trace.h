@@ -0,0 +1,82 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Records per CPU. The boot CPU's ring is static so tracing can start
+// before the page allocator; the others are allocated by trace_init_cpu().
+// Once a ring is full, later records are counted as dropped, which keeps
+// the boot path intact.
+#define TRACE_RING_SIZE     4096
+
+// How long "trace" on the command line records before the rings are dumped
+// to COM1 and QEMU is told to exit
+#ifndef TRACE_WINDOW_MS
+#define TRACE_WINDOW_MS     1000
+#endif
+
+// Chrome trace event phases, stored as is
+#define TRACE_PHASE_BEGIN   'B'
+#define TRACE_PHASE_END     'E'
+#define TRACE_PHASE_INSTANT 'i'
+
+// One per tracepoint, in .trace_events. Records name their event by its
+// index in the section.
+struct trace_event {
+    const char* name;
+};
+
+struct trace_record {
+    uint64_t tsc;
+    uint16_t event;
+    uint8_t phase;
+    uint8_t reserved;
+    uint32_t arg;
+};
+
+struct trace_stats {
+    uint32_t records;           // Records in the rings
+    uint32_t dropped;           // Records lost to a full or missing ring
+};
+
+// Non-zero while tracepoints record. Read on every tracepoint, so it is
+// the only thing a disabled one costs.
+extern uint8_t trace_active;
+
+void trace_record(const struct trace_event* event, uint8_t phase, uint32_t arg);
+
+#define __trace_event __attribute__((section(".trace_events"), used, aligned(4)))
+
+#define TRACE(phase, name, arg) do {                                        \
+        static const struct trace_event __trace_ev __trace_event = { name }; \
+        if (__builtin_expect(__atomic_load_n(&trace_active, __ATOMIC_RELAXED), 0)) { \
+            trace_record(&__trace_ev, phase, arg);                          \
+        }                                                                   \
+    } while (0)
+
+// Spans must nest on each CPU. Keep interrupts off from BEGIN to END:
+// preemption could otherwise move the thread, and its END, to another CPU.
+#define TRACE_BEGIN(name, arg)      TRACE(TRACE_PHASE_BEGIN, name, arg)
+#define TRACE_END(name, arg)        TRACE(TRACE_PHASE_END, name, arg)
+#define TRACE_INSTANT(name, arg)    TRACE(TRACE_PHASE_INSTANT, name, arg)
+
+// Start tracing on the boot CPU if the kernel command line has a "trace"
+// word. Needs gdt_init() for cpu_id(); everything earlier is not traced.
+void trace_init(const char* cmdline);
+
+// Give an application processor its ring, if tracing. Called by the boot
+// CPU before starting it, so the AP's first span is recorded whole and the
+// allocation lands on the boot CPU's track.
+void trace_init_cpu(uint32_t cpu);
+
+// Stop recording. The rings keep their contents for trace_dump().
+void trace_stop(void);
+
+// Write the event names and every CPU's records to COM1 as "TRACE" lines,
+// for tools/trace2json.py. Thread context only, after trace_stop().
+void trace_dump(void);
+
+void trace_get_stats(struct trace_stats* stats);
+void trace_dump_stats(void);
+
+#endif // TRACE_H
@@ -0,0 +1,74 @@
+# trampoline.s - Real-mode entry point for application processors
+#
+# smp_init() copies this blob to TRAMPOLINE_BASE and fills in the parameter
+# block before sending the startup IPIs. An AP starts here in real mode at
+# TRAMPOLINE_BASE:0, switches to protected mode with paging, then calls
+# ap_main(cpu) on its own stack in the higher half. Only boot needs it, so
+# it lives in .init.
+
+.set TRAMPOLINE_BASE, 0x8000    # keep in sync with smp.h
+.set CR0_PE,          0x1
+
+.section .init.text, "ax"
+.global trampoline_start
+.global trampoline_params
+.global trampoline_end
+
+.code16
+trampoline_start:
+    cli
+    cld
+    xor %ax, %ax
+    mov %ax, %ds
+
+    # Flat segments until gdt_init_cpu() loads this CPU's own GDT
+    lgdtl (tramp_gdt_ptr - trampoline_start + TRAMPOLINE_BASE)
+    mov %cr0, %eax
+    or $CR0_PE, %eax
+    mov %eax, %cr0
+    ljmpl $0x08, $(tramp_protected - trampoline_start + TRAMPOLINE_BASE)
+
+.code32
+tramp_protected:
+    mov $0x10, %ax
+    mov %ax, %ds
+    mov %ax, %es
+    mov %ax, %fs
+    mov %ax, %gs
+    mov %ax, %ss
+
+    # Same paging setup as the boot CPU. The first 4 MiB are identity
+    # mapped for the duration of the bring-up so this code keeps running.
+    mov (tramp_cr4 - trampoline_start + TRAMPOLINE_BASE), %eax
+    mov %eax, %cr4
+    mov (tramp_cr3 - trampoline_start + TRAMPOLINE_BASE), %eax
+    mov %eax, %cr3
+    mov (tramp_cr0 - trampoline_start + TRAMPOLINE_BASE), %eax
+    mov %eax, %cr0
+
+    # ap_main(cpu) never returns
+    mov (tramp_stack - trampoline_start + TRAMPOLINE_BASE), %esp
+    xor %ebp, %ebp
+    pushl (tramp_cpu - trampoline_start + TRAMPOLINE_BASE)
+    pushl $0
+    jmp *(tramp_entry - trampoline_start + TRAMPOLINE_BASE)
+
+.align 8
+tramp_gdt:
+    .quad 0                     # Null descriptor
+    .quad 0x00CF9A000000FFFF    # 0x08: flat 32-bit code
+    .quad 0x00CF92000000FFFF    # 0x10: flat 32-bit data
+tramp_gdt_ptr:
+    .word tramp_gdt_ptr - tramp_gdt - 1
+    .long tramp_gdt - trampoline_start + TRAMPOLINE_BASE
+
+# Filled in by smp_init(); layout matches struct trampoline_params
+.align 4
+trampoline_params:
+tramp_cr0:   .long 0
+tramp_cr3:   .long 0
+tramp_cr4:   .long 0
+tramp_stack: .long 0
+tramp_entry: .long 0
+tramp_cpu:   .long 0
+trampoline_end:
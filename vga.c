@@ -0,0 +1,175 @@
+#include "vga.h"
+#include "io.h"
+#include "string.h"
+#include "paging.h"
+#include "init.h"
+#include "trace.h"
+#include "cpu.h"
+
+static const size_t VGA_WIDTH = 80;
+static const size_t VGA_HEIGHT = 25;
+
+// The whole 32 KiB text VRAM window at 0xB8000, in rows. Scrolling moves the
+// CRTC start address through this window instead of copying the screen.
+#define VGA_VRAM_ROWS   204
+#define VGA_VRAM_CELLS  (VGA_VRAM_ROWS * 80)
+
+// CRTC registers (16-bit values are split over a high/low register pair)
+#define VGA_CRTC_INDEX          0x3D4
+#define VGA_CRTC_DATA           0x3D5
+#define VGA_CRTC_START_HIGH     0x0C    // Display start address
+#define VGA_CRTC_CURSOR_HIGH    0x0E    // Cursor location
+
+size_t terminal_row;
+size_t terminal_column;
+uint8_t terminal_color;
+uint16_t* terminal_buffer;
+
+// RAM copy of the VRAM window. All rendering happens here; terminal_flush()
+// copies the rows marked dirty to video memory.
+static uint16_t terminal_shadow[VGA_VRAM_CELLS] __attribute__((aligned(4)));
+static uint32_t terminal_dirty[(VGA_VRAM_ROWS + 31) / 32];
+static size_t terminal_origin;          // VRAM row shown at the top of the screen
+static size_t terminal_hw_origin;       // Origin last written to the CRTC
+
+uint8_t vga_entry_color(enum vga_color fg, enum vga_color bg) {
+    return fg | bg << 4;
+}
+
+uint16_t vga_entry(unsigned char uc, uint8_t color) {
+    return (uint16_t) uc | (uint16_t) color << 8;
+}
+
+// Rows are 80 cells, so cell counts are always even and whole dwords fill
+static inline void vga_fill_cells(uint16_t* dst, uint16_t entry, size_t cells) {
+    size_t dwords = cells / 2;
+    uint32_t pattern = (uint32_t)entry << 16 | entry;
+    __asm__ volatile ("rep stosl"
+                      : "+D"(dst), "+c"(dwords)
+                      : "a"(pattern) : "memory");
+}
+
+static inline void terminal_mark_dirty(size_t vrow) {
+    terminal_dirty[vrow / 32] |= 1u << (vrow % 32);
+}
+
+static void terminal_clear_row(size_t vrow) {
+    vga_fill_cells(&terminal_shadow[vrow * VGA_WIDTH], vga_entry(' ', terminal_color), VGA_WIDTH);
+    terminal_mark_dirty(vrow);
+}
+
+static void vga_crtc_write16(uint8_t high_reg, uint16_t value) {
+    outb(VGA_CRTC_INDEX, high_reg);
+    outb(VGA_CRTC_DATA, value >> 8);
+    outb(VGA_CRTC_INDEX, high_reg + 1);
+    outb(VGA_CRTC_DATA, value & 0xFF);
+}
+
+void __init terminal_initialize(void) {
+    terminal_row = 0;
+    terminal_column = 0;
+    terminal_origin = 0;
+    terminal_color = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    terminal_buffer = (uint16_t*) phys_to_virt(0xB8000);
+
+    for (size_t y = 0; y < VGA_HEIGHT; y++) {
+        terminal_clear_row(y);
+    }
+
+    terminal_hw_origin = 1;     // Force the start address to be programmed
+    terminal_flush();
+}
+
+void terminal_setcolor(uint8_t color) {
+    terminal_color = color;
+}
+
+void terminal_putentryat(char c, uint8_t color, size_t x, size_t y) {
+    const size_t vrow = terminal_origin + y;
+    terminal_shadow[vrow * VGA_WIDTH + x] = vga_entry(c, color);
+    terminal_mark_dirty(vrow);
+}
+
+void terminal_scroll(void) {
+    if (terminal_origin + VGA_HEIGHT < VGA_VRAM_ROWS) {
+        // Move the visible window down one row; nothing is copied
+        terminal_origin++;
+    } else {
+        // Reached the end of VRAM: move the last screen back to the top.
+        // This happens once every VGA_VRAM_ROWS - VGA_HEIGHT lines.
+        memcpy(terminal_shadow, &terminal_shadow[(terminal_origin + 1) * VGA_WIDTH],
+               (VGA_HEIGHT - 1) * VGA_WIDTH * sizeof(terminal_shadow[0]));
+        terminal_origin = 0;
+        for (size_t y = 0; y < VGA_HEIGHT - 1; y++) {
+            terminal_mark_dirty(y);
+        }
+    }
+
+    // Clear the last line
+    terminal_clear_row(terminal_origin + VGA_HEIGHT - 1);
+}
+
+void terminal_putchar(char c) {
+    if (c == '\n') {
+        terminal_column = 0;
+        if (++terminal_row == VGA_HEIGHT) {
+            terminal_scroll();
+            terminal_row = VGA_HEIGHT - 1;
+        }
+        return;
+    }
+
+    terminal_putentryat(c, terminal_color, terminal_column, terminal_row);
+    if (++terminal_column == VGA_WIDTH) {
+        terminal_column = 0;
+        if (++terminal_row == VGA_HEIGHT) {
+            terminal_scroll();
+            terminal_row = VGA_HEIGHT - 1;
+        }
+    }
+}
+
+void terminal_write(const char* data, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        terminal_putchar(data[i]);
+}
+
+void terminal_writestring(const char* data) {
+    terminal_write(data, strlen(data));
+}
+
+void terminal_flush(void) {
+    const size_t first = terminal_origin;
+    const size_t last = terminal_origin + VGA_HEIGHT;
+
+    // Short, and traced as one span, which a thread switch must not split
+    uint32_t flags = irq_save();
+    TRACE_BEGIN("terminal_flush", terminal_origin);
+
+    // Rows that scrolled out of view since the last flush are skipped; they
+    // are cleared and marked dirty again before they can become visible.
+    for (size_t word = 0; word < sizeof(terminal_dirty) / sizeof(terminal_dirty[0]); word++) {
+        uint32_t bits = terminal_dirty[word];
+        terminal_dirty[word] = 0;
+
+        while (bits) {
+            size_t vrow = word * 32 + __builtin_ctz(bits);
+            bits &= bits - 1;
+
+            if (vrow >= first && vrow < last) {
+                memcpy(&terminal_buffer[vrow * VGA_WIDTH], &terminal_shadow[vrow * VGA_WIDTH],
+                       VGA_WIDTH * sizeof(terminal_shadow[0]));
+            }
+        }
+    }
+
+    if (terminal_hw_origin != terminal_origin) {
+        vga_crtc_write16(VGA_CRTC_START_HIGH, terminal_origin * VGA_WIDTH);
+        terminal_hw_origin = terminal_origin;
+    }
+
+    vga_crtc_write16(VGA_CRTC_CURSOR_HIGH,
+                     (terminal_origin + terminal_row) * VGA_WIDTH + terminal_column);
+    TRACE_END("terminal_flush", terminal_origin);
+    irq_restore(flags);
+}
@@ -27,6 +27,10 @@ enum vga_color {
 uint8_t vga_entry_color(enum vga_color fg, enum vga_color bg);
 uint16_t vga_entry(unsigned char uc, uint8_t color);
 
+extern size_t terminal_row;
+extern size_t terminal_column;
+extern uint8_t terminal_color;
+
 void terminal_initialize(void);
 void terminal_setcolor(uint8_t color);
 void terminal_putentryat(char c, uint8_t color, size_t x, size_t y);
@@ -35,6 +39,8 @@ void terminal_putchar(char c);
 void terminal_write(const char* data, size_t size);
 void terminal_writestring(const char* data);
 
-size_t strlen(const char* str);
+// Copy the rows changed since the last flush to video memory
+void terminal_flush(void);
+
 
 #endif
@@ -0,0 +1,202 @@
+#include "vmm.h"
+#include "paging.h"
+#include "pmm.h"
+#include "klog.h"
+#include "string.h"
+#include "cpu.h"
+#include "spinlock.h"
+
+static struct vmm_region vmm_regions[VMM_MAX_REGIONS];
+static spinlock_t vmm_lock = SPINLOCK_INIT;
+
+static struct vmm_region* vmm_find(uintptr_t addr) {
+    for (int i = 0; i < VMM_MAX_REGIONS; i++) {
+        if (vmm_regions[i].end && addr >= vmm_regions[i].start && addr < vmm_regions[i].end) {
+            return &vmm_regions[i];
+        }
+    }
+    return NULL;
+}
+
+int vmm_register_lazy(uintptr_t start, size_t size, uint32_t pte_flags, const char* name) {
+    if ((start | size) & (PAGE_SIZE - 1) || size == 0) {
+        KERROR("VMM", "Lazy region %s is not page aligned", name);
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&vmm_lock);
+    for (int i = 0; i < VMM_MAX_REGIONS; i++) {
+        struct vmm_region* r = &vmm_regions[i];
+        if (!r->end) {
+            r->start = start;
+            r->end = start + size;
+            r->pte_flags = pte_flags;
+            r->name = name;
+            r->resident_pages = 0;
+            spin_unlock_irqrestore(&vmm_lock, flags);
+            KDEBUG("VMM", "Lazy region %s: 0x%x - 0x%x", name, start, start + size - 1);
+            return 0;
+        }
+    }
+    spin_unlock_irqrestore(&vmm_lock, flags);
+
+    KERROR("VMM", "No free region slot for %s", name);
+    return -1;
+}
+
+void* vmm_alloc_lazy(size_t size, const char* name) {
+    size = (size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+
+    uintptr_t base = vmap_reserve(size);
+    if (!base || vmm_register_lazy(base, size, PTE_WRITE, name) < 0) {
+        return NULL;
+    }
+    return (void*)base;
+}
+
+uint32_t vmm_free_lazy(void* base) {
+    // Unregister first: from here on a fault in the range is genuine
+    // instead of mapping a frame nobody would free
+    uint32_t flags = spin_lock_irqsave(&vmm_lock);
+    struct vmm_region* r = vmm_find((uintptr_t)base);
+    if (!r) {
+        spin_unlock_irqrestore(&vmm_lock, flags);
+        KERROR("VMM", "vmm_free_lazy: %p is not a lazy region", base);
+        return 0;
+    }
+    uintptr_t start = r->start;
+    uintptr_t end = r->end;
+    r->end = 0;
+    spin_unlock_irqrestore(&vmm_lock, flags);
+
+    // Every CPU must have dropped its TLB entries before the frames go
+    // back, so collect them first, chained through their struct page
+    uintptr_t frames = 0;
+    for (uintptr_t page = start; page < end; page += PAGE_SIZE) {
+        uintptr_t phys = paging_translate(page);
+        if (phys) {
+            pmm_page(phys)->private = (void*)frames;
+            frames = phys;
+        }
+    }
+    paging_unmap(start, end - start);
+
+    // Frame 0 is never handed out, so it ends the chain
+    uint32_t freed = 0;
+    while (frames) {
+        uintptr_t next = (uintptr_t)pmm_page(frames)->private;
+        pmm_free_page(frames);
+        frames = next;
+        freed++;
+    }
+    return freed;
+}
+
+const struct vmm_region* vmm_lookup(uintptr_t addr) {
+    for (int i = 0; i < VMM_MAX_REGIONS; i++) {
+        const struct vmm_region* r = &vmm_regions[i];
+        if (!r->end) {
+            continue;
+        }
+        if (addr >= r->start && addr < r->end) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+int vmm_handle_fault(uintptr_t addr, uint32_t error_code) {
+    // Only missing pages can be demand-filled; protection faults are bugs
+    if (error_code & (PF_PRESENT | PF_RESERVED)) {
+        return 0;
+    }
+
+    uintptr_t page = addr & ~(uintptr_t)(PAGE_SIZE - 1);
+    uint32_t flags = spin_lock_irqsave(&vmm_lock);
+
+    struct vmm_region* r = vmm_find(addr);
+    if (!r) {
+        spin_unlock_irqrestore(&vmm_lock, flags);
+        return 0;
+    }
+
+    // Another CPU may have faulted on the same page first
+    if (paging_translate(page)) {
+        spin_unlock_irqrestore(&vmm_lock, flags);
+        return 1;
+    }
+
+    uintptr_t frame = pmm_alloc_page();
+    if (!frame) {
+        spin_unlock_irqrestore(&vmm_lock, flags);
+        KERROR("VMM", "Out of memory faulting in %s at 0x%x", r->name, addr);
+        return 0;
+    }
+    memset(phys_to_virt(frame), 0, PAGE_SIZE);
+
+    if (paging_map(page, frame, PAGE_SIZE, r->pte_flags) < 0) {
+        pmm_free_page(frame);
+        spin_unlock_irqrestore(&vmm_lock, flags);
+        return 0;
+    }
+
+    r->resident_pages++;
+    spin_unlock_irqrestore(&vmm_lock, flags);
+    return 1;
+}
+
+int vmm_selftest(void) {
+    const size_t size = 4 * 1024 * 1024;
+    int failures = 0;
+
+    volatile uint8_t* base = vmm_alloc_lazy(size, "selftest");
+    if (!base) {
+        KERROR("VMM", "Self-test: no lazy region");
+        return 1;
+    }
+
+    // The first page and one in the middle: both must fault in as zeros
+    volatile uint8_t* pages[2] = { base, base + size / 2 };
+    for (int i = 0; i < 2; i++) {
+        for (uint32_t off = 0; off < PAGE_SIZE; off++) {
+            if (pages[i][off]) {
+                KERROR("VMM", "Self-test: byte %u of page %d is not zero", off, i);
+                failures++;
+                break;
+            }
+        }
+        pages[i][0] = 0x5A;
+    }
+
+    const struct vmm_region* r = vmm_lookup((uintptr_t)base);
+    if (!r || r->resident_pages != 2) {
+        KERROR("VMM", "Self-test: %u pages resident, expected 2", r ? r->resident_pages : 0);
+        failures++;
+    }
+
+    uint32_t freed = vmm_free_lazy((void*)base);
+    if (freed != 2) {
+        KERROR("VMM", "Self-test: %u frames freed, expected 2", freed);
+        failures++;
+    }
+    if (vmm_lookup((uintptr_t)base) || paging_translate((uintptr_t)pages[0]) ||
+        paging_translate((uintptr_t)pages[1])) {
+        KERROR("VMM", "Self-test: region still mapped after vmm_free_lazy()");
+        failures++;
+    }
+
+    if (!failures) {
+        KINFO("VMM", "Self-test passed: %u KiB region, 2 pages faulted in and freed", size / 1024);
+    }
+    return failures;
+}
+
+void vmm_dump_regions(void) {
+    for (int i = 0; i < VMM_MAX_REGIONS; i++) {
+        const struct vmm_region* r = &vmm_regions[i];
+        if (r->end) {
+            KINFO("VMM", "%s: 0x%x - 0x%x, %u/%u pages resident", r->name,
+                  r->start, r->end - 1, r->resident_pages, (r->end - r->start) / PAGE_SIZE);
+        }
+    }
+}
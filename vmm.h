@@ -0,0 +1,53 @@
+#ifndef VMM_H
+#define VMM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Page fault error code bits
+#define PF_PRESENT      0x01    // 0: page not present, 1: protection violation
+#define PF_WRITE        0x02    // Access was a write
+#define PF_USER         0x04    // Access came from ring 3
+#define PF_RESERVED     0x08    // Reserved bit set in a paging entry
+#define PF_INSTRUCTION  0x10    // Access was an instruction fetch
+
+// Maximum number of lazily populated regions
+#define VMM_MAX_REGIONS 32
+
+// A virtual range whose pages are allocated and zeroed on first touch
+struct vmm_region {
+    uintptr_t start;
+    uintptr_t end;
+    uint32_t pte_flags;         // Flags for the pages mapped on demand
+    const char* name;
+    uint32_t resident_pages;    // Pages faulted in so far
+};
+
+// Register [start, start+size) as demand-zero. The range must be page
+// aligned and must not be mapped. Returns 0 on success.
+int vmm_register_lazy(uintptr_t start, size_t size, uint32_t pte_flags, const char* name);
+
+// Reserve size bytes of vmap space backed on demand. Nothing is allocated
+// until the memory is touched. Returns NULL if out of virtual space.
+void* vmm_alloc_lazy(size_t size, const char* name);
+
+// Unregister a lazy region, unmap it on every CPU, then free the frames
+// it faulted in. Returns how many frames were freed. The vmap space itself is never
+// given back, so every vmm_alloc_lazy() uses up its size for good.
+uint32_t vmm_free_lazy(void* base);
+
+// Region containing addr, or NULL
+const struct vmm_region* vmm_lookup(uintptr_t addr);
+
+// Try to resolve a page fault. Returns 1 if a page was mapped and the
+// faulting instruction can be restarted, 0 if the fault is genuine.
+int vmm_handle_fault(uintptr_t addr, uint32_t error_code);
+
+// Reserve a lazy region, touch two of its pages and free it again,
+// checking that they read as zero and are counted and freed. Logs each
+// failure and returns how many there were.
+int vmm_selftest(void);
+
+void vmm_dump_regions(void);
+
+#endif // VMM_H